@@ -6,4 +6,21 @@
 
 #include "gtest/gtest.h"
 #include "../SoftRasterLearning/core/game_math.hpp"
+#include "../SoftRasterLearning/core/software_renderer.hpp"
+#include "../SoftRasterLearning/core/texture.hpp"
+#include "../SoftRasterLearning/core/mesh_simplifier.hpp"
+#include "../SoftRasterLearning/core/mesh_optimizer.hpp"
+#include "../SoftRasterLearning/core/vertex_format.hpp"
+#include "../SoftRasterLearning/framework/bvh.hpp"
+#include "../SoftRasterLearning/framework/scene.hpp"
+#include "../SoftRasterLearning/loader/obj_loader.hpp"
+#include <chrono>
+#include <string>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <set>
+#include <algorithm>
+#include <atomic>
+#include <array>
 #include <DirectXMath.h>
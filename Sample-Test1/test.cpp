@@ -63,3 +63,1504 @@ TEST(DXMATH, DXMATH) {
 	EXPECT_NE(f4.x, f4.x);
 	EXPECT_TRUE(true);
 }
+
+//half: every finite encoding survives decode + encode; rounding is to nearest, ties to even
+TEST(COLOR_FORMAT, RGBA16F) {
+	using namespace core::format_detail;
+	for (core::uint32 h = 0; h <= 0xffff; ++h)
+	{
+		if ((h & 0x7c00) == 0x7c00 && (h & 0x3ff))
+		{
+			EXPECT_TRUE(std::isnan(HalfToFloat((core::uint16)h)));
+			continue;
+		}
+		ASSERT_EQ(FloatToHalf(HalfToFloat((core::uint16)h)), h);
+	}
+
+	EXPECT_EQ(FloatToHalf(1.f + std::ldexp(1.f, -11)), 0x3c00); //halfway between 1 and the next half, ties to even
+	EXPECT_EQ(FloatToHalf(1.f + 3.f * std::ldexp(1.f, -11)), 0x3c02);
+	EXPECT_EQ(FloatToHalf(65519.f), 0x7bff); //largest finite half is 65504
+	EXPECT_EQ(FloatToHalf(65520.f), 0x7c00); //overflows to inf
+	EXPECT_EQ(FloatToHalf(-1e10f), 0xfc00);
+	EXPECT_EQ(FloatToHalf(std::ldexp(1.f, -25)), 0x0000); //half of the smallest denormal rounds to even (0)
+	EXPECT_EQ(FloatToHalf(3.f * std::ldexp(1.f, -26)), 0x0001);
+	EXPECT_EQ(FloatToHalf(-0.f), 0x8000);
+	const core::uint16 nan = FloatToHalf(std::numeric_limits<float>::quiet_NaN());
+	EXPECT_EQ(nan & 0x7c00, 0x7c00);
+	EXPECT_NE(nan & 0x3ff, 0);
+
+	using traits = core::format_traits<core::Color, core::RGBA16F>;
+	const core::Color c = traits::Decode(traits::Encode(core::Color{ 0.f, 1.f, 2.5f, -0.25f }));
+	EXPECT_EQ(c.x, 0.f);
+	EXPECT_EQ(c.y, 1.f);
+	EXPECT_EQ(c.z, 2.5f);
+	EXPECT_EQ(c.w, -0.25f);
+}
+
+//R11G11B10: unsigned small floats, 6-bit mantissa for r,g and 5-bit for b; negatives become 0, no alpha
+TEST(COLOR_FORMAT, R11G11B10F) {
+	using namespace core::format_detail;
+	for (core::uint32 v = 0; v < 0x7c0; ++v)
+	{
+		ASSERT_EQ(FloatToUFloat<6>(UnpackSmallFloat<6>(v)), v);
+	}
+	for (core::uint32 v = 0; v < 0x3e0; ++v)
+	{
+		ASSERT_EQ(FloatToUFloat<5>(UnpackSmallFloat<5>(v)), v);
+	}
+
+	EXPECT_EQ(FloatToUFloat<6>(1.f + std::ldexp(1.f, -7)), FloatToUFloat<6>(1.f)); //ties to even
+	EXPECT_EQ(FloatToUFloat<6>(1.f + 3.f * std::ldexp(1.f, -7)), FloatToUFloat<6>(1.f) + 2);
+	EXPECT_EQ(FloatToUFloat<6>(65024.f), 0x7bfu); //largest value with a 6-bit mantissa
+	EXPECT_EQ(FloatToUFloat<6>(1e10f), 0x7c0u); //overflows to inf
+	EXPECT_EQ(FloatToUFloat<5>(1e10f), 0x3e0u);
+	EXPECT_EQ(FloatToUFloat<6>(std::ldexp(1.f, -20)), 1u); //smallest denormal
+	EXPECT_EQ(FloatToUFloat<6>(-1.f), 0u);
+	EXPECT_EQ(FloatToUFloat<5>(-0.f), 0u);
+
+	using traits = core::format_traits<core::Color, core::R11G11B10F>;
+	const core::R11G11B10F packed = traits::Encode(core::Color{ 1.f, 2.f, 0.5f, 0.3f });
+	EXPECT_EQ(packed.bits & 0x7ff, FloatToUFloat<6>(1.f));
+	EXPECT_EQ((packed.bits >> 11) & 0x7ff, FloatToUFloat<6>(2.f));
+	EXPECT_EQ(packed.bits >> 22, FloatToUFloat<5>(0.5f));
+	const core::Color c = traits::Decode(packed);
+	EXPECT_EQ(c.x, 1.f);
+	EXPECT_EQ(c.y, 2.f);
+	EXPECT_EQ(c.z, 0.5f);
+	EXPECT_EQ(c.w, 1.f);
+}
+
+//8-bit sRGB: every byte survives decode + encode, alpha is linear, out-of-range and NaN input is clamped
+TEST(COLOR_FORMAT, RGBA8_SRGB) {
+	using traits = core::format_traits<core::Color, core::RGBA8_SRGB>;
+	for (int i = 0; i < 256; ++i)
+	{
+		const core::uint8 v = (core::uint8)i;
+		const core::RGBA8_SRGB p = traits::Encode(traits::Decode(core::RGBA8_SRGB{ v, v, v, v }));
+		ASSERT_EQ(p.r, v);
+		ASSERT_EQ(p.g, v);
+		ASSERT_EQ(p.b, v);
+		ASSERT_EQ(p.a, v);
+	}
+
+	const float nan = std::numeric_limits<float>::quiet_NaN();
+	const core::RGBA8_SRGB p = traits::Encode(core::Color{ 2.f, -1.f, nan, 0.5f });
+	EXPECT_EQ(p.r, 255);
+	EXPECT_EQ(p.g, 0);
+	EXPECT_EQ(p.b, 0);
+	EXPECT_EQ(p.a, 128);
+}
+
+namespace
+{
+	struct ShaderFlatColor
+	{
+		core::Color color;
+
+		core::Vertex_Default VS(const core::Vertex_Default& v) const
+		{
+			return v;
+		}
+
+		core::Color FS(const core::Vertex_Default&) const
+		{
+			return color;
+		}
+	};
+
+	//clear, then draw an opaque and a blended triangle (blending decodes and re-encodes); returns the decoded center pixel
+	template<typename Format>
+	core::Color DrawToFormat()
+	{
+		core::Context<core::Color, Format> ctx;
+		ctx.Viewport(32, 32);
+		ctx.Clear(core::Color{ 0.1f, 0.2f, 0.3f, 1.f });
+
+		core::Vertex_Default triangle[3] = {
+			core::CreateVsOut<core::Vertex_Default>(core::Position{ -1.f, -1.f, 0.5f, 1.f }, core::Color{}),
+			core::CreateVsOut<core::Vertex_Default>(core::Position{ 3.f, -1.f, 0.5f, 1.f }, core::Color{}),
+			core::CreateVsOut<core::Vertex_Default>(core::Position{ -1.f, 3.f, 0.5f, 1.f }, core::Color{}),
+		};
+		constexpr size_t flag = core::RF_DEFAULT & ~core::RF_CULL_BACK & ~core::RF_ENABLE_DEPTH_TEST;
+		ShaderFlatColor shader{ core::Color{ 1.5f, 0.5f, 0.25f, 1.f } };
+		core::Renderer<ShaderFlatColor, flag, Format> opaque = { ctx, shader };
+		opaque.DrawTriangles(triangle, 3);
+		shader.color = core::Color{ 0.f, 0.25f, 1.f, 0.5f };
+		core::Renderer<ShaderFlatColor, flag, Format> blended = { ctx, shader };
+		blended.DrawTriangles(triangle, 3);
+
+		return core::format_traits<core::Color, Format>::Decode(ctx.back_buffer[16 * 32 + 16]);
+	}
+}
+
+//every color storage format works as a render target and matches the float target within its precision
+TEST(COLOR_FORMAT, CONTEXT_DRAW) {
+	const core::Color expected = DrawToFormat<core::Color>();
+	EXPECT_FLOAT_EQ(expected.x, 0.75f);
+	EXPECT_FLOAT_EQ(expected.y, 0.375f);
+	EXPECT_FLOAT_EQ(expected.z, 0.625f);
+
+	const core::Color half = DrawToFormat<core::RGBA16F>();
+	EXPECT_NEAR(half.x, expected.x, 1e-3f);
+	EXPECT_NEAR(half.y, expected.y, 1e-3f);
+	EXPECT_NEAR(half.z, expected.z, 1e-3f);
+	EXPECT_NEAR(half.w, expected.w, 1e-3f);
+
+	const core::Color packed = DrawToFormat<core::R11G11B10F>();
+	EXPECT_NEAR(packed.x, expected.x, expected.x / 32);
+	EXPECT_NEAR(packed.y, expected.y, expected.y / 32);
+	EXPECT_NEAR(packed.z, expected.z, expected.z / 16);
+
+	//the 1.5 of the first triangle is clamped to 1, and 0.5 after blending
+	const core::Color srgb = DrawToFormat<core::RGBA8_SRGB>();
+	EXPECT_NEAR(srgb.x, 0.5f, 0.01f);
+	EXPECT_NEAR(srgb.y, expected.y, 0.01f);
+	EXPECT_NEAR(srgb.z, expected.z, 0.01f);
+	EXPECT_NEAR(srgb.w, expected.w, 1.f / 255);
+}
+
+//the 8 bit sRGB target honors exposure and tonemapping when presented, like the float target
+TEST(COLOR_FORMAT, PRESENT_SETTINGS) {
+	core::Context<core::Color> ctx_float;
+	core::Context<core::Color, core::RGBA8_SRGB> ctx_srgb;
+	ctx_float.Viewport(16, 16);
+	ctx_srgb.Viewport(16, 16);
+	for (size_t i = 0; i < 16 * 16; ++i)
+	{
+		const float v = (float)i / (16 * 16);
+		//8 bit values, so both targets hold exactly the same colors
+		const core::Color c = core::format_traits<core::Color, core::RGBA8_SRGB>::Decode(core::format_traits<core::Color, core::RGBA8_SRGB>::Encode(core::Color{ v, 1.f - v, v * v, 1.f }));
+		ctx_float.back_buffer[i] = c;
+		ctx_srgb.back_buffer[i] = core::format_traits<core::Color, core::RGBA8_SRGB>::Encode(c);
+	}
+
+	const core::PresentSettings settings[] = { {}, { 2.f, core::ETonemap::None }, { 1.f, core::ETonemap::ACES }, { 0.5f, core::ETonemap::Reinhard } };
+	for (const core::PresentSettings& s : settings)
+	{
+		std::vector<core::uint32> expected(16 * 16), actual(16 * 16);
+		core::Buffer2DView<core::uint32> expected_view{ expected.data(), 16, 16 };
+		core::Buffer2DView<core::uint32> actual_view{ actual.data(), 16, 16 };
+		ctx_float.CopyToBuffer(expected_view, s);
+		ctx_srgb.CopyToBuffer(actual_view, s);
+		EXPECT_EQ(actual, expected) << "exposure " << s.exposure << " tonemap " << (int)s.tonemap;
+	}
+}
+
+namespace
+{
+	constexpr size_t raster_size = 32;
+
+	core::Vertex_Default NdcVertex(float x, float y, float z = 0.5f, float w = 1.f)
+	{
+		return core::CreateVsOut<core::Vertex_Default>(core::Position{ x * w, y * w, z * w, w }, core::Color{});
+	}
+
+	//draws the triangles in white on a black 32x32 target and returns which pixels were written
+	template<size_t flag>
+	std::vector<bool> DrawCoverage(core::Vertex_Default* vertices, size_t count)
+	{
+		core::Context<core::Color> ctx;
+		ctx.Viewport(raster_size, raster_size);
+		ctx.Clear(core::Color{ 0.f, 0.f, 0.f, 1.f });
+		ShaderFlatColor shader{ core::Color{ 1.f, 1.f, 1.f, 1.f } };
+		core::Renderer<ShaderFlatColor, flag> renderer = { ctx, shader };
+		renderer.DrawTriangles(vertices, count);
+
+		std::vector<bool> covered(raster_size * raster_size);
+		for (size_t i = 0; i < covered.size(); ++i)
+		{
+			covered[i] = ctx.back_buffer[i].x > 0.5f;
+		}
+		return covered;
+	}
+
+	//a triangle crossing the screen with one vertex far outside: covers the pixels right of x = 8 between y = 8 and y = 24
+	template<size_t flag>
+	void CheckFarVertexTriangle()
+	{
+		core::Vertex_Default triangle[3] = { NdcVertex(-0.5f, -0.5f), NdcVertex(-0.5f, 0.5f), NdcVertex(1e5f, 0.f) };
+		const std::vector<bool> covered = DrawCoverage<flag>(triangle, 3);
+		for (size_t y = 0; y < raster_size; ++y)
+		{
+			for (size_t x = 0; x < raster_size; ++x)
+			{
+				EXPECT_EQ(covered[y * raster_size + x], x >= 8 && y >= 8 && y < 24) << "flag " << flag << " pixel " << x << "," << y;
+			}
+		}
+	}
+}
+
+//vertices beyond the fixed point range are clipped instead of dropping the whole triangle, with or without CVV clipping
+TEST(RASTER, FAR_VERTEX_CLIPPED) {
+	constexpr size_t no_cull = core::RF_DEFAULT & ~core::RF_CULL_BACK & ~core::RF_ENABLE_DEPTH_TEST;
+	CheckFarVertexTriangle<no_cull>();
+	CheckFarVertexTriangle<no_cull | core::RF_CULL_CVV_GUARD_BAND>();
+	CheckFarVertexTriangle<no_cull & ~core::RF_CULL_CVV_CLIP>();
+	CheckFarVertexTriangle<no_cull | core::RF_ENABLE_TILE_BINNING>();
+}
+
+namespace
+{
+	//a vertex at pixel coordinates (px, py) of the 32x32 target
+	core::Vertex_Default PixelVertex(float px, float py)
+	{
+		return NdcVertex(px * 2.f / raster_size - 1.f, py * 2.f / raster_size - 1.f);
+	}
+
+	//draws each triangle on its own and checks that no pixel is covered twice; returns the number of covered pixels
+	template<size_t flag>
+	size_t CheckDisjointCoverage(std::vector<core::Vertex_Default>& triangles)
+	{
+		std::vector<int> count(raster_size * raster_size);
+		for (size_t t = 0; t < triangles.size(); t += 3)
+		{
+			const std::vector<bool> covered = DrawCoverage<flag>(&triangles[t], 3);
+			for (size_t i = 0; i < count.size(); ++i)
+			{
+				count[i] += covered[i];
+			}
+		}
+		size_t total = 0;
+		for (size_t i = 0; i < count.size(); ++i)
+		{
+			EXPECT_LE(count[i], 1) << "pixel " << i % raster_size << "," << i / raster_size;
+			total += count[i] > 0;
+		}
+		return total;
+	}
+}
+
+//triangles sharing an edge through pixel centers cover each of those pixels exactly once
+TEST(RASTER, TOP_LEFT_FILL_RULE) {
+	constexpr size_t no_cull = core::RF_DEFAULT & ~core::RF_CULL_BACK & ~core::RF_ENABLE_DEPTH_TEST;
+
+	//a square split along its diagonal, all edges through pixel centers: 16x16 pixels
+	std::vector<core::Vertex_Default> square = {
+		PixelVertex(4.5f, 4.5f), PixelVertex(20.5f, 4.5f), PixelVertex(20.5f, 20.5f),
+		PixelVertex(4.5f, 4.5f), PixelVertex(20.5f, 20.5f), PixelVertex(4.5f, 20.5f),
+	};
+	EXPECT_EQ(CheckDisjointCoverage<no_cull>(square), 16u * 16u);
+
+	//a fan around a pixel center, with horizontal, vertical and diagonal shared edges of both windings
+	const float rim[8][2] = { { 4.5f, 4.5f }, { 16.5f, 2.5f }, { 28.5f, 4.5f }, { 30.5f, 16.5f }, { 28.5f, 28.5f }, { 16.5f, 30.5f }, { 4.5f, 28.5f }, { 2.5f, 16.5f } };
+	std::vector<core::Vertex_Default> fan;
+	for (int k = 0; k < 8; ++k)
+	{
+		const float* a = rim[k];
+		const float* b = rim[(k + 1) % 8];
+		fan.push_back(PixelVertex(16.5f, 16.5f));
+		//alternate the winding
+		fan.push_back(k % 2 ? PixelVertex(a[0], a[1]) : PixelVertex(b[0], b[1]));
+		fan.push_back(k % 2 ? PixelVertex(b[0], b[1]) : PixelVertex(a[0], a[1]));
+	}
+	const size_t fan_pixels = CheckDisjointCoverage<no_cull>(fan);
+	const std::vector<bool> together = DrawCoverage<no_cull>(fan.data(), fan.size());
+	EXPECT_EQ(fan_pixels, (size_t)std::count(together.begin(), together.end(), true));
+
+	//the same holds with tile binning
+	EXPECT_EQ(CheckDisjointCoverage<no_cull | core::RF_ENABLE_TILE_BINNING>(square), 16u * 16u);
+}
+
+namespace
+{
+	//random overlapping triangles, each at its own constant depth; draws them one draw call each in the given order and
+	//compares the result with a brute force depth test over the coverage of every triangle drawn alone
+	template<size_t flag>
+	void CheckHiZAgainstBruteForce(bool front_to_back)
+	{
+		constexpr size_t triangle_count = 48;
+		std::mt19937 rng{ 11 };
+		std::uniform_real_distribution<float> pos{ -1.2f, 1.2f };
+		std::vector<core::Vertex_Default> triangles;
+		std::vector<float> depth(triangle_count);
+		for (size_t t = 0; t < triangle_count; ++t)
+		{
+			depth[t] = 0.05f + 0.9f * t / triangle_count;
+			//a few large triangles so whole blocks get occluded
+			const float scale = t % 8 == 0 ? 2.f : 1.f;
+			for (int k = 0; k < 3; ++k)
+			{
+				triangles.push_back(NdcVertex(pos(rng) * scale, pos(rng) * scale, depth[t]));
+			}
+		}
+		std::vector<size_t> order(triangle_count);
+		for (size_t t = 0; t < triangle_count; ++t)
+		{
+			order[t] = front_to_back ? t : triangle_count - 1 - t;
+		}
+		std::shuffle(order.begin() + triangle_count / 4, order.end() - triangle_count / 4, rng);
+
+		//brute force: the nearest triangle covering each pixel
+		std::vector<int> expected(raster_size * raster_size, -1);
+		for (size_t t = triangle_count; t-- > 0;)
+		{
+			const std::vector<bool> covered = DrawCoverage<flag>(&triangles[t * 3], 3);
+			for (size_t i = 0; i < expected.size(); ++i)
+			{
+				if (covered[i])
+				{
+					expected[i] = (int)t;
+				}
+			}
+		}
+
+		core::Context<core::Color> ctx;
+		ctx.Viewport(raster_size, raster_size);
+		ctx.Clear(core::Color{ 0.f, 0.f, 0.f, 1.f });
+		for (size_t t : order)
+		{
+			ShaderFlatColor shader{ core::Color{ (t + 1.f) / 64.f, 0.f, 0.f, 1.f } };
+			core::Renderer<ShaderFlatColor, flag> renderer = { ctx, shader };
+			renderer.DrawTriangles(&triangles[t * 3], 3);
+		}
+		for (size_t i = 0; i < expected.size(); ++i)
+		{
+			const int actual = (int)std::lround(ctx.back_buffer[i].x * 64.f) - 1;
+			EXPECT_EQ(actual, expected[i]) << "pixel " << i % raster_size << "," << i / raster_size << (front_to_back ? " front to back" : " back to front");
+			if (expected[i] >= 0)
+			{
+				EXPECT_NEAR(ctx.depth_buffer[i], depth[expected[i]], 1e-5f);
+			}
+		}
+	}
+}
+
+//Hi-Z block rejection never changes the result of the per pixel depth test
+TEST(RASTER, HIZ_MATCHES_BRUTE_FORCE) {
+	constexpr size_t flag = core::RF_DEFAULT & ~core::RF_CULL_BACK & ~core::RF_ENABLE_BLEND;
+	CheckHiZAgainstBruteForce<flag>(true);
+	CheckHiZAgainstBruteForce<flag>(false);
+	CheckHiZAgainstBruteForce<flag | core::RF_ENABLE_TILE_BINNING>(true);
+}
+
+namespace
+{
+	//counts its vertex shader invocations
+	struct ShaderCountVS
+	{
+		std::atomic<size_t>* invocations;
+
+		core::Vertex_Default VS(const core::Vertex_Default& v) const
+		{
+			++*invocations;
+			return v;
+		}
+
+		core::Color FS(const core::Vertex_Default&) const
+		{
+			return core::Color{ 1.f, 1.f, 1.f, 1.f };
+		}
+	};
+
+	//draws a 6x6 vertex grid (50 triangles) plus vertices no index refers to; returns the VS invocations
+	template<size_t flag, typename Index>
+	size_t CountGridVS(bool indexed)
+	{
+		constexpr size_t n = 6;
+		std::vector<core::Vertex_Default> vertices;
+		for (size_t y = 0; y < n; ++y)
+		{
+			for (size_t x = 0; x < n; ++x)
+			{
+				vertices.push_back(PixelVertex(2.f + x * 5.f, 2.f + y * 5.f));
+			}
+		}
+		vertices.push_back(PixelVertex(1.f, 1.f));
+		vertices.push_back(PixelVertex(3.f, 1.f));
+		std::vector<Index> indices;
+		for (size_t y = 0; y + 1 < n; ++y)
+		{
+			for (size_t x = 0; x + 1 < n; ++x)
+			{
+				const Index i = (Index)(y * n + x);
+				const Index quad[6] = { i, (Index)(i + 1), (Index)(i + n + 1), i, (Index)(i + n + 1), (Index)(i + n) };
+				indices.insert(indices.end(), quad, quad + 6);
+			}
+		}
+
+		core::Context<core::Color> ctx;
+		ctx.Viewport(raster_size, raster_size);
+		std::atomic<size_t> invocations{ 0 };
+		ShaderCountVS shader{ &invocations };
+		core::Renderer<ShaderCountVS, flag> renderer = { ctx, shader };
+		if (indexed)
+		{
+			renderer.DrawIndex(vertices.data(), indices.data(), indices.size());
+		}
+		else
+		{
+			std::vector<core::Vertex_Default> expanded;
+			for (Index i : indices)
+			{
+				expanded.push_back(vertices[i]);
+			}
+			renderer.DrawTriangles(expanded.data(), expanded.size());
+		}
+		EXPECT_EQ(renderer.GetStatistics().vs_invocations, invocations.load());
+		EXPECT_EQ(renderer.GetStatistics().vertices_submitted, indices.size());
+		return invocations;
+	}
+}
+
+//DrawIndex shades every referenced vertex exactly once, DrawTriangles shades every submitted vertex
+TEST(RASTER, DRAW_INDEX_VS_INVOCATIONS) {
+	constexpr size_t flag = core::RF_DEFAULT & ~core::RF_CULL_BACK;
+	EXPECT_EQ((CountGridVS<flag, core::uint32>(true)), 36u);
+	EXPECT_EQ((CountGridVS<flag, core::uint16>(true)), 36u);
+	EXPECT_EQ((CountGridVS<flag | core::RF_ENABLE_TILE_BINNING, core::uint32>(true)), 36u);
+	EXPECT_EQ((CountGridVS<flag, core::uint32>(false)), 150u);
+}
+
+namespace
+{
+	//writes the screen space derivatives of the vertex color: (ddx(color.x), ddy(color.y), |ddx(color.y)| + |ddy(color.x)|)
+	struct ShaderDerivatives
+	{
+		core::Vertex_Default VS(const core::Vertex_Default& v) const
+		{
+			return v;
+		}
+
+		core::Color FS(const core::Vertex_Default&) const
+		{
+			return core::Color{};
+		}
+
+		std::array<core::Color, 4> FSQuad(const core::fs_quad<core::Vertex_Default>& quad) const
+		{
+			std::array<core::Color, 4> fs_out{};
+			for (size_t i = 0; i < 4; ++i)
+			{
+				const core::Color ddx = quad.Ddx(&core::Vertex_Default::color, i);
+				const core::Color ddy = quad.Ddy(&core::Vertex_Default::color, i);
+				fs_out[i] = core::Color{ ddx.x, ddy.y, std::abs(ddx.y) + std::abs(ddy.x), 1.f };
+			}
+			return fs_out;
+		}
+	};
+}
+
+//Ddx/Ddy of an attribute that is linear in screen space give its slopes, including quads on the triangle edges
+TEST(RASTER, QUAD_DERIVATIVES) {
+	//color.x grows by 0.25 per pixel to the right, color.y by 0.5 per pixel down
+	const auto vertex = [](float px, float py) {
+		core::Vertex_Default v = PixelVertex(px, py);
+		v.color = core::Color{ px * 0.25f, py * 0.5f, 0.f, 1.f };
+		return v;
+	};
+	core::Vertex_Default triangle[3] = { vertex(3.3f, 2.1f), vertex(29.7f, 6.4f), vertex(9.2f, 28.8f) };
+
+	core::Context<core::Color> ctx;
+	ctx.Viewport(raster_size, raster_size);
+	ctx.Clear(core::Color{ -1.f, -1.f, -1.f, 1.f });
+	ShaderDerivatives shader{};
+	core::Renderer<ShaderDerivatives, (core::RF_DEFAULT & ~core::RF_CULL_BACK) | core::RF_ENABLE_QUAD_SHADING> renderer = { ctx, shader };
+	renderer.DrawTriangles(triangle, 3);
+	ctx.FlushClear();
+
+	size_t written = 0;
+	for (size_t i = 0; i < raster_size * raster_size; ++i)
+	{
+		const core::Color& c = ctx.back_buffer[i];
+		if (c.x == -1.f)
+		{
+			continue;
+		}
+		++written;
+		EXPECT_NEAR(c.x, 0.25f, 1e-4f) << "pixel " << i % raster_size << "," << i / raster_size;
+		EXPECT_NEAR(c.y, 0.5f, 1e-4f) << "pixel " << i % raster_size << "," << i / raster_size;
+		EXPECT_NEAR(c.z, 0.f, 1e-4f) << "pixel " << i % raster_size << "," << i / raster_size;
+	}
+	//roughly the area of the triangle (340 pixels)
+	EXPECT_GT(written, 320u);
+	EXPECT_LT(written, 360u);
+}
+
+namespace
+{
+	//writes the interpolated vertex color
+	struct ShaderVertexColor
+	{
+		core::Vertex_Default VS(const core::Vertex_Default& v) const
+		{
+			return v;
+		}
+
+		core::Color FS(const core::Vertex_Default& v) const
+		{
+			return v.color;
+		}
+	};
+}
+
+//plane equation interpolation gives the perspective correct barycentric interpolation at every pixel center
+TEST(RASTER, PLANE_EQUATION_INTERPOLATION) {
+	const float ndc[3][4] = { { -0.9f, -0.8f, 0.2f, 1.f }, { 0.95f, -0.3f, 0.9f, 4.f }, { -0.2f, 0.9f, 0.5f, 0.5f } };
+	const core::Color colors[3] = { { 1.f, 0.f, 0.25f, 1.f }, { 0.f, 1.f, 0.5f, 0.5f }, { 0.f, 0.f, 1.f, 0.f } };
+	core::Vertex_Default triangle[3];
+	float sx[3], sy[3];
+	for (int k = 0; k < 3; ++k)
+	{
+		triangle[k] = NdcVertex(ndc[k][0], ndc[k][1], ndc[k][2], ndc[k][3]);
+		triangle[k].color = colors[k];
+		//snapped to the 1/256 pixel grid of the rasterizer
+		sx[k] = std::floor((ndc[k][0] + 1.f) * 0.5f * raster_size * 256.f + 0.5f) / 256.f;
+		sy[k] = std::floor((ndc[k][1] + 1.f) * 0.5f * raster_size * 256.f + 0.5f) / 256.f;
+	}
+
+	core::Context<core::Color> ctx;
+	ctx.Viewport(raster_size, raster_size);
+	ctx.Clear(core::Color{ -1.f, -1.f, -1.f, -1.f });
+	ShaderVertexColor shader{};
+	core::Renderer<ShaderVertexColor, core::RF_DEFAULT & ~core::RF_CULL_BACK & ~core::RF_ENABLE_BLEND> renderer = { ctx, shader };
+	renderer.DrawTriangles(triangle, 3);
+	ctx.FlushClear();
+
+	//screen space barycentric coordinates, computed in double
+	const double area = (double)(sx[1] - sx[0]) * (sy[2] - sy[0]) - (double)(sx[2] - sx[0]) * (sy[1] - sy[0]);
+	size_t written = 0;
+	for (size_t y = 0; y < raster_size; ++y)
+	{
+		for (size_t x = 0; x < raster_size; ++x)
+		{
+			const core::Color& c = ctx.back_buffer[y * raster_size + x];
+			if (c.x == -1.f)
+			{
+				continue;
+			}
+			++written;
+			const double px = x + 0.5, py = y + 0.5;
+			double l[3];
+			for (int k = 0; k < 3; ++k)
+			{
+				const int a = (k + 1) % 3, b = (k + 2) % 3;
+				l[k] = ((sx[b] - sx[a]) * (py - sy[a]) - (px - sx[a]) * (sy[b] - sy[a])) / area;
+			}
+			double inv_w = 0.;
+			double expected[4] = {};
+			double depth = 0.;
+			for (int k = 0; k < 3; ++k)
+			{
+				const double lw = l[k] / ndc[k][3];
+				inv_w += lw;
+				expected[0] += lw * colors[k].x;
+				expected[1] += lw * colors[k].y;
+				expected[2] += lw * colors[k].z;
+				expected[3] += lw * colors[k].w;
+				depth += l[k] * ndc[k][2];
+			}
+			EXPECT_NEAR(c.x, expected[0] / inv_w, 1e-4) << "pixel " << x << "," << y;
+			EXPECT_NEAR(c.y, expected[1] / inv_w, 1e-4) << "pixel " << x << "," << y;
+			EXPECT_NEAR(c.z, expected[2] / inv_w, 1e-4) << "pixel " << x << "," << y;
+			EXPECT_NEAR(c.w, expected[3] / inv_w, 1e-4) << "pixel " << x << "," << y;
+			EXPECT_NEAR(ctx.depth_buffer[y * raster_size + x], depth, 1e-5) << "pixel " << x << "," << y;
+		}
+	}
+	EXPECT_GT(written, 200u);
+}
+
+namespace
+{
+	//two overlapping half transparent triangles at different depths, so both the depth test and blending read the cleared values
+	template<size_t flag>
+	void DrawOverClear(core::Context<core::Color>& ctx, float offset)
+	{
+		core::Vertex_Default triangles[6] = {
+			PixelVertex(3.f + offset, 2.f), PixelVertex(20.f + offset, 5.f), PixelVertex(6.f + offset, 19.f),
+			NdcVertex(-0.6f, -0.7f, 0.3f), NdcVertex(0.4f, -0.2f, 0.7f), NdcVertex(-0.3f, 0.3f, 0.7f),
+		};
+		ShaderFlatColor shader{ core::Color{ 0.9f, 0.3f, 0.1f, 0.5f } };
+		core::Renderer<ShaderFlatColor, flag> first = { ctx, shader };
+		first.DrawTriangles(triangles, 3);
+		shader.color = core::Color{ 0.1f, 0.6f, 0.8f, 0.75f };
+		core::Renderer<ShaderFlatColor, flag> second = { ctx, shader };
+		second.DrawTriangles(triangles + 3, 3);
+	}
+
+	//a previous frame, then a deferred Clear and a draw; compares every buffer with a context that was cleared eagerly
+	template<size_t flag>
+	void CheckDeferredClear(size_t samples)
+	{
+		const core::Color clear_color{ 0.2f, 0.3f, 0.4f, 1.f };
+
+		core::Context<core::Color> deferred;
+		deferred.Viewport(raster_size, raster_size, samples);
+		deferred.Clear(core::Color{ 1.f, 0.f, 1.f, 1.f });
+		DrawOverClear<flag>(deferred, 8.f);
+		deferred.Clear(clear_color);
+		DrawOverClear<flag>(deferred, 0.f);
+
+		//every buffer written by hand, nothing left pending
+		core::Context<core::Color> eager;
+		eager.Viewport(raster_size, raster_size, samples);
+		std::fill(eager.back_buffer.begin(), eager.back_buffer.end(), clear_color);
+		std::fill(eager.depth_buffer.begin(), eager.depth_buffer.end(), core::inf);
+		std::fill(eager.sample_buffer.begin(), eager.sample_buffer.end(), clear_color);
+		std::fill(eager.sample_depth_buffer.begin(), eager.sample_depth_buffer.end(), core::inf);
+		std::fill(eager.clear_pending.begin(), eager.clear_pending.end(), core::uint8(0));
+		DrawOverClear<flag>(eager, 0.f);
+
+		deferred.Resolve();
+		eager.Resolve();
+
+		//presenting straight from pending blocks gives the same pixels
+		std::vector<core::uint32> deferred_screen(raster_size * raster_size), eager_screen(raster_size * raster_size);
+		core::Buffer2DView<core::uint32> deferred_view{ deferred_screen.data(), raster_size, raster_size };
+		core::Buffer2DView<core::uint32> eager_view{ eager_screen.data(), raster_size, raster_size };
+		deferred.CopyToBuffer(deferred_view);
+		eager.CopyToBuffer(eager_view);
+		EXPECT_EQ(deferred_screen, eager_screen) << samples << " samples";
+
+		deferred.FlushClear();
+		EXPECT_TRUE(std::all_of(deferred.clear_pending.begin(), deferred.clear_pending.end(), [](core::uint8 p) { return p == 0; }));
+		for (size_t i = 0; i < raster_size * raster_size; ++i)
+		{
+			EXPECT_EQ(deferred.depth_buffer[i], eager.depth_buffer[i]) << "pixel " << i % raster_size << "," << i / raster_size;
+			if (samples == 1)
+			{
+				const core::Color& a = deferred.back_buffer[i];
+				const core::Color& b = eager.back_buffer[i];
+				EXPECT_TRUE(a.x == b.x && a.y == b.y && a.z == b.z && a.w == b.w) << "pixel " << i % raster_size << "," << i / raster_size;
+			}
+		}
+		for (size_t i = 0; i < deferred.sample_buffer.size(); ++i)
+		{
+			const core::Color& a = deferred.sample_buffer[i];
+			const core::Color& b = eager.sample_buffer[i];
+			EXPECT_TRUE(a.x == b.x && a.y == b.y && a.z == b.z && a.w == b.w) << "sample " << i;
+			EXPECT_EQ(deferred.sample_depth_buffer[i], eager.sample_depth_buffer[i]) << "sample " << i;
+		}
+	}
+}
+
+//clearing block by block on first write (and in FlushClear) ends up with the same buffers as clearing everything up front
+TEST(RASTER, DEFERRED_CLEAR_MATCHES_FULL_CLEAR) {
+	constexpr size_t flag = core::RF_DEFAULT & ~core::RF_CULL_BACK;
+	CheckDeferredClear<flag>(1);
+	CheckDeferredClear<flag>(4);
+	CheckDeferredClear<flag | core::RF_ENABLE_TILE_BINNING>(1);
+}
+
+namespace
+{
+	constexpr size_t oit_flag = core::RF_DEFAULT & ~core::RF_CULL_BACK;
+
+	const core::Color oit_background{ 0.2f, 0.4f, 0.6f, 1.f };
+	const core::Color oit_opaque{ 0.9f, 0.9f, 0.1f, 1.f };
+	const core::Color oit_colors[2] = { { 1.f, 0.2f, 0.f, 0.5f }, { 0.f, 0.5f, 1.f, 0.25f } };
+
+	//an opaque triangle in front, then two overlapping translucent triangles behind it drawn between BeginOIT and ResolveOIT
+	std::vector<core::Vertex_Default> OITTriangles()
+	{
+		return {
+			NdcVertex(-1.f, -1.f, 0.2f), NdcVertex(-0.4f, -1.f, 0.2f), NdcVertex(-1.f, 1.f, 0.2f),
+			NdcVertex(-0.9f, -0.8f, 0.5f), NdcVertex(0.7f, -0.6f, 0.5f), NdcVertex(-0.5f, 0.8f, 0.5f),
+			NdcVertex(-0.6f, 0.9f, 0.6f), NdcVertex(-0.3f, -0.9f, 0.6f), NdcVertex(0.9f, 0.6f, 0.6f),
+		};
+	}
+
+	core::Context<core::Color> DrawOIT(bool reverse)
+	{
+		std::vector<core::Vertex_Default> triangles = OITTriangles();
+		core::Context<core::Color> ctx;
+		ctx.Viewport(raster_size, raster_size);
+		ctx.Clear(oit_background);
+		ShaderFlatColor shader{ oit_opaque };
+		core::Renderer<ShaderFlatColor, oit_flag> opaque = { ctx, shader };
+		opaque.DrawTriangles(triangles.data(), 3);
+
+		ctx.BeginOIT();
+		for (int k = 0; k < 2; ++k)
+		{
+			const int t = reverse ? 1 - k : k;
+			shader.color = oit_colors[t];
+			core::Renderer<ShaderFlatColor, oit_flag> translucent = { ctx, shader };
+			translucent.DrawTriangles(&triangles[3 + t * 3], 3);
+		}
+		ctx.ResolveOIT();
+		ctx.FlushClear();
+		return ctx;
+	}
+}
+
+//the OIT resolve is independent of the draw order and composites the weighted average of the translucent layers over the background
+TEST(RASTER, OIT_RESOLVE) {
+	const core::Context<core::Color> forward = DrawOIT(false);
+	const core::Context<core::Color> backward = DrawOIT(true);
+
+	std::vector<core::Vertex_Default> triangles = OITTriangles();
+	const std::vector<bool> opaque = DrawCoverage<oit_flag>(&triangles[0], 3);
+	const std::vector<bool> first = DrawCoverage<oit_flag>(&triangles[3], 3);
+	const std::vector<bool> second = DrawCoverage<oit_flag>(&triangles[6], 3);
+
+	size_t both = 0;
+	for (size_t i = 0; i < raster_size * raster_size; ++i)
+	{
+		const core::Color& a = forward.back_buffer[i];
+		const core::Color& b = backward.back_buffer[i];
+		EXPECT_NEAR(a.x, b.x, 1e-6f) << "pixel " << i % raster_size << "," << i / raster_size;
+		EXPECT_NEAR(a.y, b.y, 1e-6f) << "pixel " << i % raster_size << "," << i / raster_size;
+		EXPECT_NEAR(a.z, b.z, 1e-6f) << "pixel " << i % raster_size << "," << i / raster_size;
+
+		//every fragment is at w = 1, so both layers get the same depth weight
+		core::Color expected = oit_background;
+		if (opaque[i])
+		{
+			//the translucent triangles are behind the opaque one and fail the depth test
+			expected = oit_opaque;
+		}
+		else if (first[i] || second[i])
+		{
+			float revealage = 1.f, weight = 0.f;
+			core::Color sum{ 0.f, 0.f, 0.f, 0.f };
+			for (int t = 0; t < 2; ++t)
+			{
+				if (t == 0 ? first[i] : second[i])
+				{
+					const core::Color& c = oit_colors[t];
+					sum += c * c.w;
+					weight += c.w;
+					revealage *= 1.f - c.w;
+				}
+			}
+			expected = oit_background * revealage + sum * ((1.f - revealage) / weight);
+			both += first[i] && second[i];
+		}
+		EXPECT_NEAR(a.x, expected.x, 1e-5f) << "pixel " << i % raster_size << "," << i / raster_size;
+		EXPECT_NEAR(a.y, expected.y, 1e-5f) << "pixel " << i % raster_size << "," << i / raster_size;
+		EXPECT_NEAR(a.z, expected.z, 1e-5f) << "pixel " << i % raster_size << "," << i / raster_size;
+	}
+	EXPECT_GT(both, 50u);
+}
+
+namespace
+{
+	//compares BVH queries with a linear scan over the fat AABBs of all live leaves; a query returns the leaves whose fat AABB touches the query volume
+	struct BVHChecker
+	{
+		framework::DynamicBVH bvh;
+		std::vector<core::BoundingSphere> spheres;
+		std::vector<int> leaves; //leaf of each object, null_node once removed
+		std::mt19937 rng{ 7 };
+		size_t hits = 0; //total leaves returned, so the queries are not all empty
+
+		float Uniform(float a, float b)
+		{
+			return std::uniform_real_distribution<float>{ a, b }(rng);
+		}
+
+		core::Vec3 RandomPoint(float range)
+		{
+			return core::Vec3{ Uniform(-range, range), Uniform(-range, range), Uniform(-range, range) };
+		}
+
+		template<typename Query, typename Test>
+		void Compare(Query&& query, Test&& test, const char* name)
+		{
+			std::multiset<size_t> result;
+			query([&](size_t i) { result.insert(i); });
+			std::multiset<size_t> expected;
+			for (size_t i = 0; i < leaves.size(); ++i)
+			{
+				if (leaves[i] != framework::DynamicBVH::null_node && test(bvh.GetFatAABB(leaves[i])))
+				{
+					expected.insert(i);
+				}
+			}
+			EXPECT_EQ(result, expected) << name;
+			hits += result.size();
+		}
+
+		void CheckQueries()
+		{
+			for (size_t i = 0; i < leaves.size(); ++i)
+			{
+				if (leaves[i] != framework::DynamicBVH::null_node)
+				{
+					ASSERT_EQ(bvh.GetUserData(leaves[i]), i);
+					ASSERT_TRUE(bvh.GetFatAABB(leaves[i]).Contains(spheres[i].GetAABB()));
+				}
+			}
+
+			for (int k = 0; k < 4; ++k)
+			{
+				using namespace gmath::utility;
+				const core::Vec3 eye = RandomPoint(50.f);
+				const core::Vec3 front = RandomPoint(1.f).Normalize();
+				const core::Mat pv = Projection(Uniform(0.5f, 1.5f), 1.5f, 0.1f, Uniform(20.f, 150.f)) * View(eye, front, core::Vec3{ 0.f, 1.f, 0.f });
+				const core::Frustum frustum = core::Frustum::FromMatrix(pv);
+				Compare([&](auto&& f) { bvh.QueryFrustum(frustum, f); },
+					[&](const core::AABB& box) { return frustum.Classify(box) != core::ECullResult::Outside; }, "frustum");
+			}
+
+			for (int k = 0; k < 8; ++k)
+			{
+				const core::Vec3 center = RandomPoint(100.f);
+				const float radius = Uniform(1.f, 30.f);
+				Compare([&](auto&& f) { bvh.QuerySphere(center, radius, f); },
+					[&](const core::AABB& box) { return box.Overlaps(center, radius); }, "sphere");
+			}
+
+			for (int k = 0; k < 8; ++k)
+			{
+				const core::Vec3 origin = RandomPoint(120.f);
+				const core::Vec3 dir = RandomPoint(1.f);
+				const float t_max = Uniform(10.f, 300.f);
+				const core::Vec3 inv_dir = 1.f / dir;
+				Compare([&](auto&& f) { bvh.QueryRay(origin, dir, t_max, [&](size_t i, float) { f(i); }); },
+					[&](const core::AABB& box) { float t; return box.Intersects(origin, inv_dir, t_max, t); }, "ray");
+			}
+		}
+	};
+}
+
+//after insert, move, remove and reinsert, frustum/sphere/ray queries match brute force
+TEST(BVH, QUERIES_MATCH_BRUTE_FORCE) {
+	BVHChecker c;
+	constexpr size_t n = 5000;
+	for (size_t i = 0; i < n; ++i)
+	{
+		c.spheres.push_back(core::BoundingSphere{ c.RandomPoint(100.f), c.Uniform(0.1f, 3.f) });
+		c.leaves.push_back(c.bvh.Insert(c.spheres[i].GetAABB(), i));
+	}
+	c.CheckQueries();
+
+	//small moves mostly stay inside the fat AABB, large ones reinsert and rotate
+	for (int pass = 0; pass < 3; ++pass)
+	{
+		for (size_t i = 0; i < n; i += 2)
+		{
+			const float step = (i % 10 == 0) ? 40.f : 0.3f;
+			c.spheres[i].center += c.RandomPoint(step);
+			c.bvh.Move(c.leaves[i], c.spheres[i].GetAABB());
+		}
+		c.CheckQueries();
+	}
+
+	//a much smaller bound is reinserted as well
+	for (size_t i = 1; i < n; i += 11)
+	{
+		c.spheres[i].radius *= 0.05f;
+		c.bvh.Move(c.leaves[i], c.spheres[i].GetAABB());
+	}
+	c.CheckQueries();
+
+	//removed objects no longer show up in any result
+	for (size_t i = 0; i < n; i += 3)
+	{
+		c.bvh.Remove(c.leaves[i]);
+		c.leaves[i] = framework::DynamicBVH::null_node;
+	}
+	c.CheckQueries();
+
+	//reinserting reuses the freed nodes
+	for (size_t i = 0; i < n; i += 6)
+	{
+		c.spheres[i].center = c.RandomPoint(100.f);
+		c.leaves[i] = c.bvh.Insert(c.spheres[i].GetAABB(), i);
+	}
+	c.CheckQueries();
+	EXPECT_GT(c.hits, 0u);
+}
+
+namespace
+{
+	struct SphereObject : framework::IRenderAble
+	{
+		core::BoundingSphere sphere;
+
+		void Render(framework::IRenderEngine&) const override
+		{
+		}
+
+		bool GetBoundingSphere(core::BoundingSphere& s) const override
+		{
+			s = sphere;
+			return sphere.IsValid();
+		}
+	};
+
+	struct BoundsScene : framework::Scene
+	{
+		using Scene::objects;
+		using Scene::UpdateBounds;
+
+		//objects whose bounding sphere touches a small sphere around p
+		std::vector<std::shared_ptr<framework::IRenderAble>> At(const core::Vec3& p) const
+		{
+			std::vector<std::shared_ptr<framework::IRenderAble>> result;
+			QuerySphere(p, 0.5f, result);
+			return result;
+		}
+	};
+}
+
+//the scene BVH follows its objects through reordering, erasing and moving
+TEST(BVH, SCENE_TRACKS_OBJECTS) {
+	BoundsScene scene;
+	std::vector<std::shared_ptr<SphereObject>> spheres;
+	for (int i = 0; i < 6; ++i)
+	{
+		spheres.push_back(scene.Spawn<SphereObject>());
+		spheres.back()->sphere = { core::Vec3{ i * 10.f, 0.f, 0.f }, 1.f };
+	}
+	scene.UpdateBounds();
+	for (int i = 0; i < 6; ++i)
+	{
+		const auto hit = scene.At(core::Vec3{ i * 10.f, 0.f, 0.f });
+		ASSERT_EQ(hit.size(), 1u);
+		EXPECT_EQ(hit[0], spheres[i]);
+	}
+
+	//reverse the order, erase object 2 and move object 4
+	std::reverse(scene.objects.begin(), scene.objects.end());
+	scene.objects.erase(std::find(scene.objects.begin(), scene.objects.end(), spheres[2]));
+	spheres[4]->sphere.center = core::Vec3{ 0.f, 50.f, 0.f };
+	scene.UpdateBounds();
+
+	EXPECT_TRUE(scene.At(core::Vec3{ 20.f, 0.f, 0.f }).empty());
+	EXPECT_TRUE(scene.At(core::Vec3{ 40.f, 0.f, 0.f }).empty());
+	for (int i : { 0, 1, 3, 5 })
+	{
+		const auto hit = scene.At(core::Vec3{ i * 10.f, 0.f, 0.f });
+		ASSERT_EQ(hit.size(), 1u);
+		EXPECT_EQ(hit[0], spheres[i]);
+	}
+	const auto moved = scene.At(core::Vec3{ 0.f, 50.f, 0.f });
+	ASSERT_EQ(moved.size(), 1u);
+	EXPECT_EQ(moved[0], spheres[4]);
+
+	float t = 0.f;
+	EXPECT_EQ(scene.Raycast(core::Vec3{ 100.f, 0.f, 0.f }, core::Vec3{ -1.f, 0.f, 0.f }, t), spheres[5]);
+	EXPECT_FLOAT_EQ(t, 49.f);
+}
+
+//two-channel normals: x,y stored as snorm8, z rebuilt from unit length; encode/decode both use n * 0.5 + 0.5
+TEST(TEXTURE_FORMAT, RG8_NORMAL) {
+	using traits = core::format_traits<core::Color, core::RG8_NORMAL>;
+	auto round_trip = [](core::Vec3 n) {
+		return core::Vec3(traits::Decode(traits::Encode(core::Color{ n * 0.5f + 0.5f, 1.f }))) * 2.f - 1.f;
+	};
+
+	//the facing normal and axis values are exact
+	const core::Vec3 up = round_trip({ 0.f, 0.f, 1.f });
+	EXPECT_FLOAT_EQ(up.x, 0.f);
+	EXPECT_FLOAT_EQ(up.y, 0.f);
+	EXPECT_FLOAT_EQ(up.z, 1.f);
+	EXPECT_EQ(traits::Encode(core::Color{ 0.f, 1.f, 0.5f, 1.f }).x, -127);
+	EXPECT_EQ(traits::Encode(core::Color{ 0.f, 1.f, 0.5f, 1.f }).y, 127);
+	EXPECT_FLOAT_EQ(traits::Decode(traits::Encode(core::Color{ 0.f, 1.f, 0.5f, 1.f })).w, 1.f);
+
+	//negative components stay within one snorm8 step
+	const core::Vec3 n = core::Vec3{ -0.48f, -0.6f, 0.64f }.Normalize();
+	const core::Vec3 m = round_trip(n);
+	EXPECT_NEAR(m.x, n.x, 1.f / 127);
+	EXPECT_NEAR(m.y, n.y, 1.f / 127);
+	EXPECT_NEAR(m.z, n.z, 0.02f);
+
+	//out-of-range input is clamped to [-1,1], -128 is never written, z is 0 when |x,y| > 1
+	EXPECT_EQ(traits::Encode(core::Color{ 2.f, -1.f, 0.5f, 1.f }).x, 127);
+	EXPECT_EQ(traits::Encode(core::Color{ 2.f, -1.f, 0.5f, 1.f }).y, -127);
+	EXPECT_FLOAT_EQ(traits::Decode(core::RG8_NORMAL{ -128, 0 }).x, 0.f);
+	EXPECT_FLOAT_EQ(traits::Decode(core::RG8_NORMAL{ 127, 127 }).z, 0.5f);
+
+	//NaN becomes -1, the decoded value is always finite
+	const float nan = std::numeric_limits<float>::quiet_NaN();
+	const core::Color c = traits::Decode(traits::Encode(core::Color{ nan, nan, nan, nan }));
+	EXPECT_FLOAT_EQ(c.x, 0.f);
+	EXPECT_FLOAT_EQ(c.y, 0.f);
+	EXPECT_TRUE(std::isfinite(c.z));
+}
+
+//single-channel half, decodes to (r,0,0,1)
+TEST(TEXTURE_FORMAT, R16F) {
+	using traits = core::format_traits<core::Color, core::R16F>;
+	auto round_trip = [](float r) {
+		return traits::Decode(traits::Encode(core::Color{ r, 5.f, 6.f, 7.f }));
+	};
+
+	EXPECT_EQ(round_trip(0.f).x, 0.f);
+	EXPECT_EQ(round_trip(1.f).x, 1.f);
+	EXPECT_EQ(round_trip(-2.5f).x, -2.5f);
+	EXPECT_EQ(round_trip(65504.f).x, 65504.f); //largest half
+	EXPECT_EQ(round_trip(std::ldexp(1.f, -24)).x, std::ldexp(1.f, -24)); //smallest denormal
+	EXPECT_EQ(round_trip(1e6f).x, std::numeric_limits<float>::infinity());
+	EXPECT_TRUE(std::isnan(round_trip(std::numeric_limits<float>::quiet_NaN()).x));
+
+	const core::Color c = round_trip(1.f);
+	EXPECT_EQ(c.y, 0.f);
+	EXPECT_EQ(c.z, 0.f);
+	EXPECT_EQ(c.w, 1.f);
+}
+
+namespace
+{
+	//non-power-of-two texture with mips; hdr adds values above 1
+	void CreateFormatTexture(core::Texture& tex, bool normal, bool hdr)
+	{
+		constexpr size_t w = 37;
+		constexpr size_t h = 23;
+		tex.Resize(w, h);
+		for (size_t y = 0; y < h; ++y)
+		{
+			for (size_t x = 0; x < w; ++x)
+			{
+				if (normal)
+				{
+					const core::Vec3 n = core::Vec3{ (float)x / w - 0.5f, (float)y / h - 0.5f, 1.f }.Normalize();
+					tex.GetRef(x, y) = core::Color{ n * 0.5f + 0.5f, 1.f };
+				}
+				else
+				{
+					tex.GetRef(x, y) = core::Color{ (float)x / w, (float)y / h * (hdr ? 4.f : 1.f), (float)((x * y) % 7) / 7.f, (float)((x + y) % 5) / 4.f };
+				}
+			}
+		}
+		tex.GenerateMips();
+	}
+}
+
+//converting to a compact format and back keeps every texel within the format precision, and memory shrinks by the texel size
+TEST(TEXTURE_FORMAT, CONVERT) {
+	struct Case
+	{
+		core::ETextureFormat format;
+		size_t texel_size;
+		float tolerance; //rgb tolerance, relative for the float formats
+		bool normal;
+		bool hdr;
+	};
+	const Case cases[] = {
+		{ core::ETextureFormat::RGBA8_SRGB, 4, 0.01f, false, false },
+		{ core::ETextureFormat::RGBA16F, 8, 1.f / 1024, false, true },
+		{ core::ETextureFormat::R16F, 2, 1.f / 1024, false, true },
+		{ core::ETextureFormat::RG8_NORMAL, 2, 1.f / 127, true, false },
+	};
+
+	for (const auto& c : cases)
+	{
+		core::Texture reference;
+		core::Texture tex;
+		CreateFormatTexture(reference, c.normal, c.hdr);
+		CreateFormatTexture(tex, c.normal, c.hdr);
+		const size_t float_size = tex.GetMemorySize();
+
+		tex.Convert(c.format);
+		EXPECT_EQ(tex.GetFormat(), c.format);
+		EXPECT_EQ(core::Texture::GetTexelSize(c.format), c.texel_size);
+		EXPECT_EQ(tex.GetMemorySize() * sizeof(core::Vec4), float_size * c.texel_size);
+		EXPECT_EQ(tex.GetMipCount(), reference.GetMipCount());
+
+		tex.Convert(core::ETextureFormat::RGBA32F);
+		EXPECT_EQ(tex.GetMemorySize(), float_size);
+		for (size_t level = 0; level < tex.GetMipCount(); ++level)
+		{
+			const core::Texture& a = reference.GetLevel(level);
+			const core::Texture& b = tex.GetLevel(level);
+			for (size_t y = 0; y < a.GetHeight(); ++y)
+			{
+				for (size_t x = 0; x < a.GetWidth(); ++x)
+				{
+					const core::Vec4 p = a.Get(x, y);
+					const core::Vec4 q = b.Get(x, y);
+					if (c.format == core::ETextureFormat::R16F)
+					{
+						EXPECT_NEAR(q.x, p.x, c.tolerance * (std::max)(p.x, 1.f));
+						EXPECT_EQ(q.y, 0.f);
+						EXPECT_EQ(q.w, 1.f);
+						continue;
+					}
+					const float scale = c.format == core::ETextureFormat::RGBA8_SRGB ? 1.f : (std::max)({ p.x, p.y, p.z, 1.f });
+					EXPECT_NEAR(q.x, p.x, c.tolerance * scale);
+					EXPECT_NEAR(q.y, p.y, c.tolerance * scale);
+					//averaged normals in the mips are shorter than unit length and their rebuilt z is larger, so z is only checked on level 0
+					if (!c.normal || level == 0)
+					{
+						EXPECT_NEAR(q.z, p.z, c.normal ? 0.02f : c.tolerance * scale);
+					}
+					EXPECT_NEAR(q.w, p.w, c.normal ? 0.f : 1.f / 255);
+				}
+			}
+		}
+	}
+}
+
+namespace
+{
+	//simulated set-associative LRU cache (64 sets x 8 ways x 64 bytes = 32KB, like a common L1D), counts hits only
+	struct CacheSim
+	{
+		static constexpr size_t line_size = 64;
+		static constexpr size_t sets = 64;
+		static constexpr size_t ways = 8;
+		std::vector<size_t> tags = std::vector<size_t>(sets * ways, ~0ULL);
+		std::vector<size_t> ages = std::vector<size_t>(sets * ways, 0);
+		size_t time = 0;
+		size_t hits = 0;
+		size_t accesses = 0;
+
+		void Access(const void* p)
+		{
+			const size_t line = reinterpret_cast<size_t>(p) / line_size;
+			size_t* tag = &tags[(line % sets) * ways];
+			size_t* age = &ages[(line % sets) * ways];
+			++accesses;
+			++time;
+			size_t victim = 0;
+			for (size_t i = 0; i < ways; ++i)
+			{
+				if (tag[i] == line)
+				{
+					++hits;
+					age[i] = time;
+					return;
+				}
+				if (age[i] < age[victim])
+				{
+					victim = i;
+				}
+			}
+			tag[victim] = line;
+			age[victim] = time;
+		}
+
+		double HitRate() const
+		{
+			return accesses ? (double)hits / accesses : 0.0;
+		}
+	};
+
+	//walks screen x screen pixels in scanline order with the uv rotated by angle; neighbouring pixels are about one texel apart
+	template<typename F>
+	void ForEachRotatedUV(size_t tex_size, size_t screen, float angle, F&& f)
+	{
+		const float c = cos(angle);
+		const float s = sin(angle);
+		for (size_t y = 0; y < screen; ++y)
+		{
+			for (size_t x = 0; x < screen; ++x)
+			{
+				const float px = x - screen * 0.5f;
+				const float py = y - screen * 0.5f;
+				f(core::Vec2{ (px * c - py * s) / tex_size + 0.5f, (px * s + py * c) / tex_size + 0.5f });
+			}
+		}
+	}
+
+	constexpr size_t layout_tex_size = 1024;
+	constexpr size_t layout_screen = 512;
+
+	//two textures with the same content and different layouts
+	void CreateLayoutTextures(core::Texture& linear, core::Texture& tiled)
+	{
+		linear.Resize(layout_tex_size, layout_tex_size);
+		for (size_t y = 0; y < layout_tex_size; ++y)
+		{
+			for (size_t x = 0; x < layout_tex_size; ++x)
+			{
+				linear.GetRef(x, y) = core::Vec4{ (float)x / layout_tex_size, (float)y / layout_tex_size, ((x ^ y) & 255) / 255.f, 1.f };
+			}
+		}
+		tiled.Resize(layout_tex_size, layout_tex_size);
+		tiled.GetData() = linear.GetCData();
+		tiled.SetLayout(core::ETextureLayout::Tiled);
+	}
+
+	//hit rate of the 4 bilinear taps in the simulated cache, rounded the same way as Texture::Sample
+	double BilinearHitRate(core::Texture& tex, float angle)
+	{
+		CacheSim cache;
+		ForEachRotatedUV(layout_tex_size, layout_screen, angle, [&](core::Vec2 uv) {
+			const float x = floor(uv.x * layout_tex_size - 0.5f);
+			const float y = floor(uv.y * layout_tex_size - 0.5f);
+			const size_t x0 = (size_t)gmath::utility::Clamp(x, 0.f, layout_tex_size - 1.f);
+			const size_t y0 = (size_t)gmath::utility::Clamp(y, 0.f, layout_tex_size - 1.f);
+			cache.Access(&tex.GetRef(x0, y0));
+			cache.Access(&tex.GetRef(x0 + 1, y0));
+			cache.Access(&tex.GetRef(x0, y0 + 1));
+			cache.Access(&tex.GetRef(x0 + 1, y0 + 1));
+			});
+		return cache.HitRate();
+	}
+
+	float SampleSum(core::Texture& tex, float angle)
+	{
+		float sum = 0.f;
+		ForEachRotatedUV(layout_tex_size, layout_screen, angle, [&](core::Vec2 uv) {
+			sum += core::Texture::Sample(&tex, uv).z;
+			});
+		return sum;
+	}
+}
+
+//with 4x4 tiles, bilinear sampling along a rotated uv hits the cache more often than with rows, and returns identical samples
+TEST(TEXTURE, TILED_LAYOUT) {
+	core::Texture linear;
+	core::Texture tiled;
+	CreateLayoutTextures(linear, tiled);
+
+	for (float angle : { 0.6f, 1.2f })
+	{
+		EXPECT_GT(BilinearHitRate(tiled, angle), BilinearHitRate(linear, angle));
+		EXPECT_EQ(SampleSum(linear, angle), SampleSum(tiled, angle));
+	}
+}
+
+//hit rate and sampling time of both layouts; run with --gtest_also_run_disabled_tests
+TEST(TEXTURE, DISABLED_TILED_LAYOUT_BENCHMARK) {
+	core::Texture linear;
+	core::Texture tiled;
+	CreateLayoutTextures(linear, tiled);
+
+	auto sample_time = [&](core::Texture& tex) {
+		float sum = 0.f;
+		const auto start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < 20; ++i)
+		{
+			sum += SampleSum(tex, i * 0.1f);
+		}
+		const auto end = std::chrono::high_resolution_clock::now();
+		EXPECT_NE(sum, 0.f);
+		return std::chrono::duration<double, std::milli>(end - start).count();
+	};
+
+	const double linear_ms = sample_time(linear);
+	const double tiled_ms = sample_time(tiled);
+	RecordProperty("linear_hit_rate", std::to_string(BilinearHitRate(linear, 0.6f)));
+	RecordProperty("linear_ms", std::to_string(linear_ms));
+	RecordProperty("tiled_hit_rate", std::to_string(BilinearHitRate(tiled, 0.6f)));
+	RecordProperty("tiled_ms", std::to_string(tiled_ms));
+}
+
+namespace
+{
+	constexpr core::uint32 grid_size = 16;
+	constexpr core::uint32 grid_seam = 8;
+
+	//a flat grid_size x grid_size grid of quads on z = 0, split by a uv seam at x = grid_seam: the seam column has one copy of each vertex per side
+	//the first returned index is where the right half's vertices start
+	core::uint32 CreateSeamGrid(std::vector<core::Model_Vertex>& vertices, std::vector<core::uint32>& indices)
+	{
+		const core::uint32 columns = grid_seam + 1;
+		auto add_half = [&](core::uint32 x0, float u0) {
+			const core::uint32 base = (core::uint32)vertices.size();
+			for (core::uint32 y = 0; y <= grid_size; ++y)
+			{
+				for (core::uint32 x = 0; x < columns; ++x)
+				{
+					const core::Vec3 p{ float(x0 + x), float(y), 0.f };
+					vertices.push_back({ p, { u0 + x * 0.05f, y * 0.05f }, { 0.f, 0.f, 1.f } });
+				}
+			}
+			for (core::uint32 y = 0; y < grid_size; ++y)
+			{
+				for (core::uint32 x = 0; x < grid_seam; ++x)
+				{
+					const core::uint32 i = base + y * columns + x;
+					indices.insert(indices.end(), { i, i + 1, i + columns + 1, i, i + columns + 1, i + columns });
+				}
+			}
+			return base;
+		};
+		add_half(0, 0.f);
+		return add_half(grid_seam, 0.5f);
+	}
+}
+
+//QEM simplification of a flat grid reaches the target count without moving the border or crossing the uv seam
+TEST(MESH, SIMPLIFY_KEEPS_SEAMS_AND_BORDERS) {
+	std::vector<core::Model_Vertex> vertices;
+	std::vector<core::uint32> indices;
+	const core::uint32 right_begin = CreateSeamGrid(vertices, indices);
+	ASSERT_EQ(indices.size(), grid_size * grid_size * 6);
+
+	const size_t target = 64;
+	float error = -1.f;
+	const std::vector<core::uint32> simplified = core::SimplifyMesh(vertices, indices, target, &error);
+	ASSERT_EQ(simplified.size() % 3, 0u);
+	EXPECT_LE(simplified.size() / 3, target);
+	EXPECT_GT(simplified.size() / 3, 0u);
+	EXPECT_NEAR(error, 0.f, 1e-3f);
+
+	//each half still tiles its own rectangle: no triangle mixes the two sides of the seam, none is flipped, and the areas add up
+	float area[2] = { 0.f, 0.f };
+	for (size_t t = 0; t < simplified.size(); t += 3)
+	{
+		const core::uint32 i0 = simplified[t], i1 = simplified[t + 1], i2 = simplified[t + 2];
+		const bool right = i0 >= right_begin;
+		EXPECT_EQ(i1 >= right_begin, right) << "triangle " << t / 3;
+		EXPECT_EQ(i2 >= right_begin, right) << "triangle " << t / 3;
+		const core::Vec3 p0 = vertices[i0].position, p1 = vertices[i1].position, p2 = vertices[i2].position;
+		const float z = (p1 - p0).Cross(p2 - p0).z * 0.5f;
+		EXPECT_GT(z, 0.f) << "triangle " << t / 3;
+		area[right] += z;
+	}
+	EXPECT_NEAR(area[0], float(grid_seam * grid_size), 1e-3f);
+	EXPECT_NEAR(area[1], float((grid_size - grid_seam) * grid_size), 1e-3f);
+}
+
+//faces share vertices that have the same position/uv/normal triple, quads are split into two triangles
+TEST(MESH, OBJ_DEDUPLICATES_VERTICES) {
+	loader::obj::ObjParser parser;
+	const core::Model quad = parser.ParseObjStr(
+		"v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\n"
+		"vt 0 0\nvt 1 0\nvt 1 1\nvt 0 1\n"
+		"vn 0 0 1\n"
+		"f 1/1/1 2/2/1 3/3/1 4/4/1\n");
+	ASSERT_EQ(quad.mesh.size(), 4u);
+	EXPECT_EQ(quad.indices, (std::vector<core::uint32>{ 0, 1, 2, 3, 0, 2 }));
+	for (size_t i = 0; i < 4; ++i)
+	{
+		//uv follows x and y, so the tangent is +x
+		EXPECT_NEAR(quad.mesh[i].tangent.x, 1.f, 1e-6f);
+		EXPECT_NEAR(quad.mesh[i].tangent.y, 0.f, 1e-6f);
+		EXPECT_NEAR(quad.mesh[i].tangent.z, 0.f, 1e-6f);
+	}
+	EXPECT_FLOAT_EQ(quad.aabb.max.x, 1.f);
+	EXPECT_FLOAT_EQ(quad.aabb.max.y, 1.f);
+
+	//the second quad shares the edge 2-3 with the first one, but the corner 3 has a different uv there and is stored twice
+	const core::Model strip = parser.ParseObjStr(
+		"v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nv 1 2 0\nv 0 2 0\n"
+		"vt 0 0\nvt 1 0\nvt 1 1\nvt 0 1\nvt 0 0.5\nvt 1 2\nvt 0 2\n"
+		"vn 0 0 1\n"
+		"f 1/1/1 2/2/1 3/3/1 4/4/1\n"
+		"f 4/5/1 3/3/1 5/6/1 6/7/1\n");
+	EXPECT_EQ(strip.mesh.size(), 7u);
+	EXPECT_EQ(strip.indices, (std::vector<core::uint32>{ 0, 1, 2, 3, 0, 2, 4, 2, 5, 6, 4, 5 }));
+}
+
+namespace
+{
+	//triangles of a size x size grid of quads in random order, the worst case for a vertex cache
+	std::vector<core::uint32> ShuffledGridIndices(core::uint32 size)
+	{
+		std::vector<std::array<core::uint32, 3>> triangles;
+		const core::uint32 columns = size + 1;
+		for (core::uint32 y = 0; y < size; ++y)
+		{
+			for (core::uint32 x = 0; x < size; ++x)
+			{
+				const core::uint32 i = y * columns + x;
+				triangles.push_back({ i, i + 1, i + columns + 1 });
+				triangles.push_back({ i, i + columns + 1, i + columns });
+			}
+		}
+		std::mt19937 rng{ 7 };
+		std::shuffle(triangles.begin(), triangles.end(), rng);
+		std::vector<core::uint32> indices;
+		for (const auto& t : triangles)
+		{
+			indices.insert(indices.end(), t.begin(), t.end());
+		}
+		return indices;
+	}
+
+	//triangles rotated so the smallest index comes first, sorted: equal for two index buffers with the same triangles and winding
+	std::vector<std::array<core::uint32, 3>> CanonicalTriangles(const std::vector<core::uint32>& indices)
+	{
+		std::vector<std::array<core::uint32, 3>> triangles;
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			std::array<core::uint32, 3> t = { indices[i], indices[i + 1], indices[i + 2] };
+			std::rotate(t.begin(), std::min_element(t.begin(), t.end()), t.end());
+			triangles.push_back(t);
+		}
+		std::sort(triangles.begin(), triangles.end());
+		return triangles;
+	}
+}
+
+//reordering keeps every triangle and its winding, and brings the ACMR of a shuffled grid close to the ideal 0.5
+TEST(MESH, OPTIMIZE_VERTEX_CACHE_REDUCES_ACMR) {
+	const core::uint32 size = 64;
+	const size_t vertex_count = (size + 1) * (size + 1);
+	const std::vector<core::uint32> indices = ShuffledGridIndices(size);
+
+	std::vector<core::uint32> clusters;
+	const std::vector<core::uint32> optimized = core::OptimizeVertexCache(indices, vertex_count, 16, &clusters);
+	EXPECT_EQ(CanonicalTriangles(optimized), CanonicalTriangles(indices));
+	ASSERT_FALSE(clusters.empty());
+	EXPECT_EQ(clusters.front(), 0u);
+	EXPECT_TRUE(std::is_sorted(clusters.begin(), clusters.end()));
+	EXPECT_LT(clusters.back(), indices.size() / 3);
+
+	const core::VertexCacheStatistics before = core::AnalyzeVertexCache(indices, vertex_count);
+	const core::VertexCacheStatistics after = core::AnalyzeVertexCache(optimized, vertex_count);
+	RecordProperty("acmr_before", std::to_string(before.acmr));
+	RecordProperty("acmr_after", std::to_string(after.acmr));
+	EXPECT_GT(before.acmr, 2.5f);
+	EXPECT_LT(after.acmr, 0.8f);
+	EXPECT_LT(after.atvr, 1.6f);
+}
+
+//normal and tangent survive the QTangent round trip; the tangent comes back orthogonalized against the normal
+TEST(MESH, QTANGENT_ROUND_TRIP) {
+	std::vector<std::pair<core::Vec3, core::Vec3>> frames = {
+		{ { 0.f, 0.f, 1.f }, { 1.f, 0.f, 0.f } }, //identity
+		{ { 0.f, 0.f, -1.f }, { 1.f, 0.f, 0.f } }, //half turn, trace -1
+		{ { 0.f, 1.f, 0.f }, { 0.f, 0.f, -1.f } },
+		{ { -1.f, 0.f, 0.f }, { 0.f, -1.f, 0.f } },
+		{ { 0.f, 0.f, 1.f }, { 1.f, 0.f, 0.5f } }, //tangent not orthogonal
+		{ { 0.f, 1.f, 0.f }, { 0.f, 2.f, 0.f } }, //tangent parallel to the normal, any perpendicular direction will do
+	};
+	std::mt19937 rng{ 3 };
+	std::normal_distribution<float> dist;
+	for (int i = 0; i < 1000; ++i)
+	{
+		frames.push_back({ { dist(rng), dist(rng), dist(rng) }, { dist(rng), dist(rng), dist(rng) } });
+	}
+
+	for (size_t i = 0; i < frames.size(); ++i)
+	{
+		const core::Vec3 n = frames[i].first.Normalize();
+		const core::Vec3 t = frames[i].second - n * n.Dot(frames[i].second);
+		core::int16 q[4];
+		core::vertex_detail::PackQTangent(frames[i].first, frames[i].second, q);
+		EXPECT_GE(q[3], 0) << "frame " << i;
+		core::Vec3 normal, tangent;
+		core::vertex_detail::UnpackQTangent(q, normal, tangent);
+
+		EXPECT_NEAR((normal - n).Length(), 0.f, 1e-3f) << "frame " << i;
+		EXPECT_NEAR(tangent.Length(), 1.f, 1e-4f) << "frame " << i;
+		EXPECT_NEAR(tangent.Dot(normal), 0.f, 1e-4f) << "frame " << i;
+		if (t.Length() > 1e-3f)
+		{
+			EXPECT_NEAR((tangent - t.Normalize()).Length(), 0.f, 1e-3f) << "frame " << i;
+		}
+	}
+}
+
+//the packed mesh decodes to the source vertices within its quantization steps
+TEST(MESH, PACKED_MESH_FETCH) {
+	std::vector<core::Model_Vertex> mesh;
+	std::mt19937 rng{ 5 };
+	std::uniform_real_distribution<float> dist{ -4.f, 4.f };
+	for (int i = 0; i < 100; ++i)
+	{
+		core::Model_Vertex v{ { dist(rng), dist(rng) * 0.5f, dist(rng) * 0.1f }, { dist(rng), dist(rng) }, core::Vec3{ dist(rng), dist(rng), dist(rng) }.Normalize() };
+		v.tangent = v.normal.Cross(core::Vec3{ dist(rng), dist(rng), dist(rng) }).Normalize();
+		mesh.push_back(v);
+	}
+	core::Model model;
+	model.mesh = mesh;
+	model.ComputeBounds();
+	model.Pack(true);
+	ASSERT_TRUE(model.IsPacked());
+	EXPECT_TRUE(model.mesh.empty());
+	EXPECT_EQ(sizeof(core::Model_Vertex_Packed), 18u);
+
+	const core::Vec3 step = model.packed.position_scale;
+	for (size_t i = 0; i < mesh.size(); ++i)
+	{
+		const core::Model_Vertex v = model.packed.Fetch(i);
+		EXPECT_NEAR(v.position.x, mesh[i].position.x, step.x * 0.501f) << "vertex " << i;
+		EXPECT_NEAR(v.position.y, mesh[i].position.y, step.y * 0.501f) << "vertex " << i;
+		EXPECT_NEAR(v.position.z, mesh[i].position.z, step.z * 0.501f) << "vertex " << i;
+		//half floats keep 11 significant bits
+		EXPECT_NEAR(v.uv.x, mesh[i].uv.x, std::abs(mesh[i].uv.x) / 2048.f) << "vertex " << i;
+		EXPECT_NEAR(v.uv.y, mesh[i].uv.y, std::abs(mesh[i].uv.y) / 2048.f) << "vertex " << i;
+		EXPECT_NEAR((v.normal - mesh[i].normal).Length(), 0.f, 1e-3f) << "vertex " << i;
+		EXPECT_NEAR((v.tangent - mesh[i].tangent).Length(), 0.f, 1e-3f) << "vertex " << i;
+	}
+}
@@ -0,0 +1,209 @@
+﻿#pragma once
+
+#include "types_and_defs.hpp"
+#include <cmath>
+#include <algorithm>
+
+namespace core
+{
+	//轴对齐包围盒
+	struct AABB
+	{
+		Vec3 min = { 0,0,0 };
+		Vec3 max = { 0,0,0 };
+
+		Vec3 Center() const
+		{
+			return (min + max) * 0.5f;
+		}
+
+		//半长
+		Vec3 Extent() const
+		{
+			return (max - min) * 0.5f;
+		}
+
+		//同时包住两个盒子的最小包围盒
+		AABB Union(const AABB& other) const
+		{
+			return { Vec3(_mm_min_ps(min, other.min)), Vec3(_mm_max_ps(max, other.max)) };
+		}
+
+		//向外扩大margin
+		AABB Expand(float margin) const
+		{
+			return { min - margin, max + margin };
+		}
+
+		bool Contains(const AABB& other) const
+		{
+			return min.x <= other.min.x && min.y <= other.min.y && min.z <= other.min.z &&
+				max.x >= other.max.x && max.y >= other.max.y && max.z >= other.max.z;
+		}
+
+		bool Overlaps(const AABB& other) const
+		{
+			return min.x <= other.max.x && min.y <= other.max.y && min.z <= other.max.z &&
+				max.x >= other.min.x && max.y >= other.min.y && max.z >= other.min.z;
+		}
+
+		//表面积(的一半)，BVH用它估计遍历的代价
+		float SurfaceArea() const
+		{
+			const Vec3 d = max - min;
+			return d.x * d.y + d.y * d.z + d.z * d.x;
+		}
+
+		//和球是否相交，用盒子上离球心最近的点判断
+		bool Overlaps(const Vec3& center, float radius) const
+		{
+			const Vec3 closest = Vec3(_mm_min_ps(_mm_max_ps(center, min), max));
+			const Vec3 d = closest - center;
+			return d.Dot(d) <= radius * radius;
+		}
+
+		//射线和盒子相交的参数区间(slab方法)，inv_dir是方向的倒数，相交时t_near是进入盒子的位置
+		bool Intersects(const Vec3& origin, const Vec3& inv_dir, float t_max, float& t_near) const
+		{
+			const Vec3 t0 = (min - origin) * inv_dir;
+			const Vec3 t1 = (max - origin) * inv_dir;
+			const Vec3 t_min = Vec3(_mm_min_ps(t0, t1));
+			const Vec3 t_far = Vec3(_mm_max_ps(t0, t1));
+			const float enter = (std::max)({ t_min.x, t_min.y, t_min.z, 0.f });
+			const float exit = (std::min)({ t_far.x, t_far.y, t_far.z, t_max });
+			t_near = enter;
+			return enter <= exit;
+		}
+	};
+
+	//包围球
+	struct BoundingSphere
+	{
+		Vec3 center = { 0,0,0 };
+		float radius = -1.f; //小于0表示没有包围球
+
+		bool IsValid() const noexcept
+		{
+			return radius >= 0.f;
+		}
+
+		AABB GetAABB() const
+		{
+			return { center - radius, center + radius };
+		}
+
+		//合并两个包围球，结果同时包住两者
+		BoundingSphere Merge(const BoundingSphere& other) const
+		{
+			if (!other.IsValid())
+			{
+				return *this;
+			}
+			if (!IsValid())
+			{
+				return other;
+			}
+			const Vec3 d = other.center - center;
+			const float dist = d.Length();
+			if (dist + other.radius <= radius)
+			{
+				return *this;
+			}
+			if (dist + radius <= other.radius)
+			{
+				return other;
+			}
+			const float r = (dist + radius + other.radius) * 0.5f;
+			return { center + d * ((r - radius) / dist), r };
+		}
+
+		//经过变换矩阵后的包围球，半径按三个轴里最大的缩放放大，所以对非均匀缩放也是保守的
+		BoundingSphere Transform(const Mat& m) const
+		{
+			const Mat t = m.Transpose();
+			const float sx = Vec3(Vec4(t.column[0])).Length();
+			const float sy = Vec3(Vec4(t.column[1])).Length();
+			const float sz = Vec3(Vec4(t.column[2])).Length();
+			return { Vec3(m * Vec4(center, 1.f)), radius * (std::max)({ sx, sy, sz }) };
+		}
+	};
+
+	//包围体和视锥的关系
+	enum class ECullResult
+	{
+		Outside,
+		Intersect,
+		Inside,
+	};
+
+	//视锥体，6个平面的法线都朝内，ax+by+cz+d>=0在平面内侧
+	struct Frustum
+	{
+		Vec4 planes[6];
+
+		//从投影*视图矩阵中提取平面(Gribb-Hartmann)，裁剪空间是 -w<=x<=w, -w<=y<=w, 0<=z<=w
+		static Frustum FromMatrix(const Mat& pv)
+		{
+			//Mat按列储存，转置之后的每一列就是原矩阵的一行
+			const Mat t = pv.Transpose();
+			const Vec4 r0 = t.column[0];
+			const Vec4 r1 = t.column[1];
+			const Vec4 r2 = t.column[2];
+			const Vec4 r3 = t.column[3];
+
+			Frustum f;
+			f.planes[0] = r3 + r0; //x>-w
+			f.planes[1] = r3 - r0; //x<w
+			f.planes[2] = r3 + r1; //y>-w
+			f.planes[3] = r3 - r1; //y<w
+			f.planes[4] = r2;      //z>0
+			f.planes[5] = r3 - r2; //z<w
+			for (auto& p : f.planes)
+			{
+				const float len = Vec3(p).Length();
+				if (len > 0.f)
+				{
+					p /= len;
+				}
+			}
+			return f;
+		}
+
+		//包围球是否有一部分在视锥内，保守的判断，在视锥角落外面的球可能会被当成可见
+		bool Intersects(const BoundingSphere& s) const
+		{
+			const Vec4 c = Vec4(s.center, 1.f);
+			for (const auto& p : planes)
+			{
+				if (p.Dot(c) < -s.radius)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		//包围盒和视锥的关系，同样是保守的，Inside表示完全在视锥内，里面的东西都不用再测试了
+		ECullResult Classify(const AABB& box) const
+		{
+			const Vec4 c = Vec4(box.Center(), 1.f);
+			const Vec3 e = box.Extent();
+			ECullResult result = ECullResult::Inside;
+			for (const auto& p : planes)
+			{
+				//盒子在平面法线上的投影半径
+				const float r = std::abs(p.x) * e.x + std::abs(p.y) * e.y + std::abs(p.z) * e.z;
+				const float d = p.Dot(c);
+				if (d < -r)
+				{
+					return ECullResult::Outside;
+				}
+				if (d < r)
+				{
+					result = ECullResult::Intersect;
+				}
+			}
+			return result;
+		}
+	};
+}
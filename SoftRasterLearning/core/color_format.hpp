@@ -0,0 +1,299 @@
+﻿#pragma once
+
+#include "types_and_defs.hpp"
+#include <array>
+#include <cmath>
+#include <cstring>
+
+namespace core
+{
+	//颜色缓冲的储存格式，作为Context的第二个模板参数，着色器输出的还是线性的Color，写入和混合时再编码/解码
+	//不指定格式时储存的就是FsOut本身(Color是每像素16字节的float4)
+
+	//8位的sRGB，储存的是做过gamma校正的颜色，内存中按b,g,r,a排列，和窗口的帧缓冲一样，输出到屏幕时直接拷贝
+	//gamma曲线和CopyToBuffer一样用的是core::gamma，用来近似sRGB
+	struct RGBA8_SRGB
+	{
+		uint8 b;
+		uint8 g;
+		uint8 r;
+		uint8 a;
+	};
+
+	//半精度浮点，用于HDR
+	struct RGBA16F
+	{
+		uint16 r;
+		uint16 g;
+		uint16 b;
+		uint16 a;
+	};
+
+	//打包的无符号浮点，r,g各11位，b10位，没有alpha(解码出来是1)，用于不需要透明度的HDR光照累加
+	struct R11G11B10F
+	{
+		uint32 bits;
+	};
+
+	//以下两种只用于贴图(core::Texture)
+
+	//两通道的有符号8位法线贴图，只存切线空间法线的x,y，z由单位长度重建(切线空间的法线z总是正的)
+	//编码/解码的Color和普通的法线贴图一样是 n * 0.5 + 0.5，着色器里的解码方式不用改
+	struct RG8_NORMAL
+	{
+		int8 x;
+		int8 y;
+	};
+
+	//单通道半精度浮点，解码出来是(r,0,0,1)
+	struct R16F
+	{
+		uint16 r;
+	};
+
+	namespace format_detail
+	{
+		//右移s位，就近舍入，正好在中间时舍入到偶数
+		inline uint32 ShiftRoundEven(uint32 v, int s) noexcept
+		{
+			const uint32 r = v >> s;
+			const uint32 rem = v & ((1u << s) - 1);
+			const uint32 half = 1u << (s - 1);
+			return r + ((rem > half || (rem == half && (r & 1))) ? 1 : 0);
+		}
+
+		//把非负的float转成5位指数(偏移15)、mantissa_bits位尾数的小浮点数，半精度和R11G11B10的三个通道都是这种格式
+		//x是float的位(不含符号位)，超出范围的变成inf
+		template<int mantissa_bits>
+		uint32 PackSmallFloat(uint32 x) noexcept
+		{
+			constexpr int shift = 23 - mantissa_bits;
+			constexpr uint32 inf_bits = 0x1fu << mantissa_bits;
+			if (x > 0x7f800000)
+			{
+				return inf_bits | 1; //NaN
+			}
+			const int exp = (int)(x >> 23) - 127 + 15;
+			if (exp >= 31)
+			{
+				return inf_bits;
+			}
+			if (exp <= 0)
+			{
+				//非规格化数
+				if (exp < -mantissa_bits)
+				{
+					return 0;
+				}
+				return ShiftRoundEven((x & 0x7fffff) | 0x800000, shift + 1 - exp);
+			}
+			//指数和尾数一起舍入，尾数进位会自然地进到指数上
+			return ShiftRoundEven(((uint32)exp << 23) | (x & 0x7fffff), shift);
+		}
+
+		template<int mantissa_bits>
+		float UnpackSmallFloat(uint32 h) noexcept
+		{
+			const uint32 exp = h >> mantissa_bits;
+			const uint32 mant = h & ((1u << mantissa_bits) - 1);
+			if (exp == 0)
+			{
+				return std::ldexp((float)mant, -14 - mantissa_bits);
+			}
+			const uint32 x = exp == 31 ?
+				0x7f800000 | (mant << (23 - mantissa_bits)) :
+				((exp - 15 + 127) << 23) | (mant << (23 - mantissa_bits));
+			float f;
+			memcpy(&f, &x, sizeof(f));
+			return f;
+		}
+
+		inline uint32 FloatBits(float f) noexcept
+		{
+			uint32 x;
+			memcpy(&x, &f, sizeof(x));
+			return x;
+		}
+
+		inline uint16 FloatToHalf(float f) noexcept
+		{
+			const uint32 x = FloatBits(f);
+			return (uint16)(((x >> 16) & 0x8000) | PackSmallFloat<10>(x & 0x7fffffff));
+		}
+
+		inline float HalfToFloat(uint16 h) noexcept
+		{
+			const float f = UnpackSmallFloat<10>(h & 0x7fffu);
+			return (h & 0x8000) ? -f : f;
+		}
+
+		//无符号的小浮点，负数变成0
+		template<int mantissa_bits>
+		uint32 FloatToUFloat(float f) noexcept
+		{
+			const uint32 x = FloatBits(f);
+			return (x & 0x80000000) ? 0 : PackSmallFloat<mantissa_bits>(x);
+		}
+
+		//gamma编码的查找表，用sqrt(线性值)做下标，暗部的精度比直接用线性值做下标高得多
+		static constexpr size_t gamma_lut_size = 4096;
+
+		inline const std::array<uint8, gamma_lut_size + 1>& GammaEncodeLut()
+		{
+			static const auto lut = [] {
+				std::array<uint8, gamma_lut_size + 1> t{};
+				for (size_t i = 0; i <= gamma_lut_size; ++i)
+				{
+					const float s = (float)i / gamma_lut_size;
+					t[i] = (uint8)(std::pow(s * s, 1.f / gamma) * 255.f + 0.5f);
+				}
+				return t;
+			}();
+			return lut;
+		}
+
+		inline const std::array<float, 256>& GammaDecodeLut()
+		{
+			static const auto lut = [] {
+				std::array<float, 256> t{};
+				for (size_t i = 0; i < 256; ++i)
+				{
+					t[i] = std::pow(i / 255.f, gamma);
+				}
+				return t;
+			}();
+			return lut;
+		}
+
+		inline uint8 GammaEncode(float v) noexcept
+		{
+			//!(v > 0)顺便把NaN也变成0
+			const float s = !(v > 0.f) ? 0.f : v >= 1.f ? 1.f : std::sqrt(v);
+			return GammaEncodeLut()[(size_t)(s * gamma_lut_size + 0.5f)];
+		}
+
+		inline uint8 UnormEncode(float v) noexcept
+		{
+			const float c = !(v > 0.f) ? 0.f : v >= 1.f ? 1.f : v;
+			return (uint8)(c * 255.f + 0.5f);
+		}
+
+		//[-1,1]映射到[-127,127]，-128不使用
+		inline int8 SnormEncode(float v) noexcept
+		{
+			const float c = !(v > -1.f) ? -1.f : v >= 1.f ? 1.f : v;
+			return (int8)std::lround(c * 127.f);
+		}
+
+		inline float SnormDecode(int8 v) noexcept
+		{
+			return v < -127 ? -1.f : v / 127.f;
+		}
+	}
+
+	//储存格式的编码/解码，Encode把着色器的输出转成储存格式，Decode反过来
+	//默认储存的就是FsOut本身，不做转换
+	template<typename FsOut, typename Format>
+	struct format_traits
+	{
+		static_assert(std::is_same_v<FsOut, Format>, "Error: 不支持的颜色储存格式");
+
+		static const Format& Encode(const FsOut& v) noexcept
+		{
+			return v;
+		}
+
+		static const FsOut& Decode(const Format& v) noexcept
+		{
+			return v;
+		}
+	};
+
+	template<>
+	struct format_traits<Color, RGBA8_SRGB>
+	{
+		//alpha不做gamma校正
+		static RGBA8_SRGB Encode(const Color& c) noexcept
+		{
+			using namespace format_detail;
+			return { GammaEncode(c.b), GammaEncode(c.g), GammaEncode(c.r), UnormEncode(c.a) };
+		}
+
+		static Color Decode(const RGBA8_SRGB& c) noexcept
+		{
+			const auto& lut = format_detail::GammaDecodeLut();
+			return { lut[c.r], lut[c.g], lut[c.b], c.a / 255.f };
+		}
+	};
+
+	template<>
+	struct format_traits<Color, RGBA16F>
+	{
+		static RGBA16F Encode(const Color& c) noexcept
+		{
+			using format_detail::FloatToHalf;
+			return { FloatToHalf(c.r), FloatToHalf(c.g), FloatToHalf(c.b), FloatToHalf(c.a) };
+		}
+
+		static Color Decode(const RGBA16F& c) noexcept
+		{
+			using format_detail::HalfToFloat;
+			return { HalfToFloat(c.r), HalfToFloat(c.g), HalfToFloat(c.b), HalfToFloat(c.a) };
+		}
+	};
+
+	template<>
+	struct format_traits<Color, R11G11B10F>
+	{
+		static R11G11B10F Encode(const Color& c) noexcept
+		{
+			using format_detail::FloatToUFloat;
+			return { FloatToUFloat<6>(c.r) | (FloatToUFloat<6>(c.g) << 11) | (FloatToUFloat<5>(c.b) << 22) };
+		}
+
+		static Color Decode(const R11G11B10F& c) noexcept
+		{
+			using format_detail::UnpackSmallFloat;
+			return {
+				UnpackSmallFloat<6>(c.bits & 0x7ff),
+				UnpackSmallFloat<6>((c.bits >> 11) & 0x7ff),
+				UnpackSmallFloat<5>(c.bits >> 22),
+				1.f
+			};
+		}
+	};
+
+	template<>
+	struct format_traits<Color, RG8_NORMAL>
+	{
+		static RG8_NORMAL Encode(const Color& c) noexcept
+		{
+			using format_detail::SnormEncode;
+			return { SnormEncode(c.r * 2.f - 1.f), SnormEncode(c.g * 2.f - 1.f) };
+		}
+
+		static Color Decode(const RG8_NORMAL& c) noexcept
+		{
+			using format_detail::SnormDecode;
+			const float x = SnormDecode(c.x);
+			const float y = SnormDecode(c.y);
+			const float zz = 1.f - x * x - y * y;
+			const float z = zz > 0.f ? std::sqrt(zz) : 0.f;
+			return { x * 0.5f + 0.5f, y * 0.5f + 0.5f, z * 0.5f + 0.5f, 1.f };
+		}
+	};
+
+	template<>
+	struct format_traits<Color, R16F>
+	{
+		static R16F Encode(const Color& c) noexcept
+		{
+			return { format_detail::FloatToHalf(c.r) };
+		}
+
+		static Color Decode(const R16F& c) noexcept
+		{
+			return { format_detail::HalfToFloat(c.r), 0.f, 0.f, 1.f };
+		}
+	};
+}
@@ -0,0 +1,115 @@
+﻿#pragma once
+
+#include "software_renderer.hpp"
+#include <functional>
+
+namespace core
+{
+	//命令列表，绘制命令可以在任意线程中录制，之后在渲染线程中按录制的顺序回放
+	//录制的时候只保存shader(按值)和顶点数据的地址，回放之前顶点数据要一直有效
+	class CommandList
+	{
+	public:
+		//录制一个任意的命令
+		template<typename F>
+		void Record(F&& command)
+		{
+			commands.emplace_back(std::forward<F>(command));
+		}
+
+		//录制一次清屏
+		template<typename FsOut, typename Format>
+		void Clear(Context<FsOut, Format>& ctx, const FsOut& fs_out)
+		{
+			Record([&ctx, fs_out] { ctx.Clear(fs_out); });
+		}
+
+		//录制一次DrawTriangles，shader会被复制，录制之后再修改shader不影响这次绘制
+		template<size_t render_flag = RF_DEFAULT, typename Shader, typename FsOut, typename Format>
+		void DrawTriangles(Context<FsOut, Format>& ctx, const Shader& shader, typename Renderer<Shader, render_flag, Format>::vs_in_t* data, size_t n)
+		{
+			Record([&ctx, shader, data, n] {
+				Renderer<Shader, render_flag, Format> renderer = { ctx, shader };
+				renderer.DrawTriangles(data, n);
+			});
+		}
+
+		//录制一次DrawIndex
+		template<size_t render_flag = RF_DEFAULT, typename Shader, typename FsOut, typename Format, typename Index>
+		void DrawIndex(Context<FsOut, Format>& ctx, const Shader& shader, typename Renderer<Shader, render_flag, Format>::vs_in_t* data, const Index* index, size_t n)
+		{
+			Record([&ctx, shader, data, index, n] {
+				Renderer<Shader, render_flag, Format> renderer = { ctx, shader };
+				renderer.DrawIndex(data, index, n);
+			});
+		}
+
+		//从顶点流中录制一次DrawIndex，回放之前stream要一直有效
+		template<size_t render_flag = RF_DEFAULT, typename Shader, typename FsOut, typename Format, typename Stream, typename Index, typename = decltype(std::declval<const Stream&>().Fetch(size_t{}))>
+		void DrawIndex(Context<FsOut, Format>& ctx, const Shader& shader, const Stream& stream, const Index* index, size_t n)
+		{
+			Record([&ctx, shader, &stream, index, n] {
+				Renderer<Shader, render_flag, Format> renderer = { ctx, shader };
+				renderer.DrawIndex(stream, index, n);
+			});
+		}
+
+		//录制一次DrawInstanced，实例数据会被移动到命令里
+		template<size_t render_flag = RF_DEFAULT, typename Shader, typename FsOut, typename Format, typename Instance>
+		void DrawInstanced(Context<FsOut, Format>& ctx, const Shader& shader, typename Renderer<Shader, render_flag, Format>::vs_in_t* data, size_t n, std::vector<Instance> instances)
+		{
+			Record([&ctx, shader, data, n, instances = std::move(instances)] {
+				Renderer<Shader, render_flag, Format> renderer = { ctx, shader };
+				renderer.DrawInstanced(data, n, instances.data(), instances.size());
+			});
+		}
+
+		//录制一次DrawIndexedInstanced
+		template<size_t render_flag = RF_DEFAULT, typename Shader, typename FsOut, typename Format, typename Index, typename Instance>
+		void DrawIndexedInstanced(Context<FsOut, Format>& ctx, const Shader& shader, typename Renderer<Shader, render_flag, Format>::vs_in_t* data, const Index* index, size_t n, std::vector<Instance> instances)
+		{
+			Record([&ctx, shader, data, index, n, instances = std::move(instances)] {
+				Renderer<Shader, render_flag, Format> renderer = { ctx, shader };
+				renderer.DrawIndexedInstanced(data, index, n, instances.data(), instances.size());
+			});
+		}
+
+		//从顶点流中录制一次DrawIndexedInstanced
+		template<size_t render_flag = RF_DEFAULT, typename Shader, typename FsOut, typename Format, typename Stream, typename Index, typename Instance, typename = decltype(std::declval<const Stream&>().Fetch(size_t{}))>
+		void DrawIndexedInstanced(Context<FsOut, Format>& ctx, const Shader& shader, const Stream& stream, const Index* index, size_t n, std::vector<Instance> instances)
+		{
+			Record([&ctx, shader, &stream, index, n, instances = std::move(instances)] {
+				Renderer<Shader, render_flag, Format> renderer = { ctx, shader };
+				renderer.DrawIndexedInstanced(stream, index, n, instances.data(), instances.size());
+			});
+		}
+
+		//按录制的顺序执行所有命令，然后清空
+		void Execute()
+		{
+			for (auto& command : commands)
+			{
+				command();
+			}
+			commands.clear();
+		}
+
+		void Reset() noexcept
+		{
+			commands.clear();
+		}
+
+		bool Empty() const noexcept
+		{
+			return commands.empty();
+		}
+
+		size_t Size() const noexcept
+		{
+			return commands.size();
+		}
+
+	private:
+		std::vector<std::function<void()>> commands;
+	};
+}
@@ -4,39 +4,237 @@
 #include "buffer_view.hpp"
 #include "game_math.hpp"
 #include "types_and_defs.hpp"
+#include "color_format.hpp"
 #include "omp.h"
+#include <numeric>
 
 namespace core
 {
-	//渲染上下文
-	template<typename FsOut = Color>
+	//只有深度的Context的FsOut，不会分配颜色buffer，配合只有VS没有FS的shader使用，比如生成阴影贴图
+	struct DepthOnly {};
+
+	//用流式写入(non-temporal store)把n个v写到dst，不经过缓存，适合整块清除这种写完之后不会马上读的情况
+	template<typename T>
+	void StreamFill(T* dst, size_t n, const T& v)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		//period个元素正好是16字节的整数倍，按这个周期重复写入16字节的向量
+		constexpr size_t period = 16 / std::gcd(sizeof(T), (size_t)16);
+		constexpr size_t vectors = period * sizeof(T) / 16;
+
+		//先逐个写到16字节对齐的位置，对不齐就直接用普通的写入
+		size_t head = 0;
+		while (head < n && head < period && (reinterpret_cast<uintptr_t>(dst + head) & 15))
+		{
+			++head;
+		}
+		if (head == n || (reinterpret_cast<uintptr_t>(dst + head) & 15))
+		{
+			std::fill_n(dst, n, v);
+			return;
+		}
+		std::fill_n(dst, head, v);
+
+		alignas(16) unsigned char pattern[period * sizeof(T)];
+		for (size_t i = 0; i < period; ++i)
+		{
+			memcpy(pattern + i * sizeof(T), &v, sizeof(T));
+		}
+		__m128i vec[vectors];
+		for (size_t k = 0; k < vectors; ++k)
+		{
+			vec[k] = _mm_load_si128(reinterpret_cast<const __m128i*>(pattern) + k);
+		}
+
+		const size_t count = (n - head) / period;
+		__m128i* out = reinterpret_cast<__m128i*>(dst + head);
+		for (size_t i = 0; i < count; ++i)
+		{
+			for (size_t k = 0; k < vectors; ++k)
+			{
+				_mm_stream_si128(out++, vec[k]);
+			}
+		}
+		_mm_sfence();
+		std::fill_n(dst + head + count * period, n - head - count * period, v);
+	}
+
+	//输出到屏幕时的色调映射
+	enum class ETonemap
+	{
+		None,		//直接截断到[0,1]
+		Reinhard,	//c / (1 + c)
+		ACES		//ACES的拟合曲线(Narkowicz 2015)
+	};
+
+	//CopyToBuffer的设置，颜色先乘上曝光度，再做色调映射和gamma校正，alpha不受影响
+	struct PresentSettings
+	{
+		float exposure = 1.f;
+		ETonemap tonemap = ETonemap::None;
+	};
+
+	//色调映射，输入是乘过曝光度的线性颜色，一次处理4个像素的同一个通道
+	template<ETonemap tonemap>
+	__m128 Tonemap(__m128 c)
+	{
+		if constexpr (tonemap == ETonemap::Reinhard)
+		{
+			return _mm_div_ps(c, _mm_add_ps(_mm_set_ps1(1.f), _mm_max_ps(c, _mm_setzero_ps())));
+		}
+		else if constexpr (tonemap == ETonemap::ACES)
+		{
+			//(c * (2.51c + 0.03)) / (c * (2.43c + 0.59) + 0.14)
+			const __m128 num = _mm_mul_ps(c, _mm_add_ps(_mm_mul_ps(c, _mm_set_ps1(2.51f)), _mm_set_ps1(0.03f)));
+			const __m128 den = _mm_add_ps(_mm_mul_ps(c, _mm_add_ps(_mm_mul_ps(c, _mm_set_ps1(2.43f)), _mm_set_ps1(0.59f))), _mm_set_ps1(0.14f));
+			return _mm_div_ps(num, den);
+		}
+		else
+		{
+			return c;
+		}
+	}
+
+	//把一行n个线性颜色(r,g,b,a)转成窗口帧缓冲的BGRA8，rgb先乘上exposure再做色调映射，alpha不受影响
+	//每次处理4个像素: 先转置成rrrr/gggg/bbbb/aaaa，算完之后用饱和的pack打包回bgra，只用到SSE2
+	//gamma校正用的是color_format.hpp中的查找表，以sqrt(c)为下标，避免逐通道调用pow，只有查表是标量的
+	template<ETonemap tonemap>
+	void PresentRow(uint32* dst, const Color* src, size_t n, float exposure)
+	{
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set_ps1(1.f);
+		const __m128 e = _mm_set_ps1(exposure);
+		const __m128 lut_scale = _mm_set_ps1((float)format_detail::gamma_lut_size);
+		const auto& lut = format_detail::GammaEncodeLut();
+
+		//截断到[0,1]，max的第一个参数是NaN时返回0
+		const auto saturate = [&](__m128 v) {
+			return _mm_min_ps(_mm_max_ps(v, zero), one);
+		};
+		const auto gamma_encode = [&](__m128 v) {
+			alignas(16) int i[4];
+			_mm_store_si128(reinterpret_cast<__m128i*>(i), _mm_cvtps_epi32(_mm_mul_ps(_mm_sqrt_ps(saturate(v)), lut_scale)));
+			return _mm_setr_epi32(lut[i[0]], lut[i[1]], lut[i[2]], lut[i[3]]);
+		};
+		const auto present4 = [&](uint32* out, const Color* in) {
+			__m128 r = _mm_loadu_ps(&in[0].x);
+			__m128 g = _mm_loadu_ps(&in[1].x);
+			__m128 b = _mm_loadu_ps(&in[2].x);
+			__m128 a = _mm_loadu_ps(&in[3].x);
+			_MM_TRANSPOSE4_PS(r, g, b, a);
+			const __m128i ri = gamma_encode(Tonemap<tonemap>(_mm_mul_ps(r, e)));
+			const __m128i gi = gamma_encode(Tonemap<tonemap>(_mm_mul_ps(g, e)));
+			const __m128i bi = gamma_encode(Tonemap<tonemap>(_mm_mul_ps(b, e)));
+			const __m128i ai = _mm_cvtps_epi32(_mm_mul_ps(saturate(a), _mm_set_ps1(255.f)));
+			//各通道都在[0,255]内，有符号的pack不会截断: br = b0..b3 r0..r3, ga = g0..g3 a0..a3
+			const __m128i br = _mm_packs_epi32(bi, ri);
+			const __m128i ga = _mm_packs_epi32(gi, ai);
+			//交错成 b0 g0 b1 g1 b2 g2 b3 g3 和 r0 a0 r1 a1 r2 a2 r3 a3
+			const __m128i bg = _mm_unpacklo_epi16(br, ga);
+			const __m128i ra = _mm_unpackhi_epi16(br, ga);
+			//再按32位交错成每个像素的bgra，最后压成8位
+			const __m128i packed = _mm_packus_epi16(_mm_unpacklo_epi32(bg, ra), _mm_unpackhi_epi32(bg, ra));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), packed);
+		};
+
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4)
+		{
+			present4(dst + i, src + i);
+		}
+		//不足4个的部分补0之后再算
+		if (i < n)
+		{
+			Color in[4];
+			uint32 out[4];
+			std::copy(src + i, src + n, in);
+			present4(out, in);
+			std::copy(out, out + (n - i), dst + i);
+		}
+	}
+
+	//渲染上下文，Format是颜色缓冲的储存格式(见color_format.hpp)，默认直接储存FsOut
+	template<typename FsOut = Color, typename Format = FsOut>
 	class Context
 	{
 	public:
-		std::vector<FsOut> back_buffer;
+		using format_t = Format;
+		using format = format_traits<FsOut, Format>;
+
+		std::vector<Format> back_buffer;
 		std::vector<float> depth_buffer;
-		Buffer2DView<FsOut> back_buffer_view;
+		std::vector<float> hiz_buffer; //层次深度(Hi-Z)，每个8x8块中深度的最大值，只会偏大不会偏小，光栅化时用来整块剔除被挡住的像素
+		std::vector<uint8> hiz_dirty;  //块中的深度被写过，Hi-Z的值可能已经偏大了，用到的时候再重新计算
+		std::vector<uint8> clear_pending; //块(和Hi-Z的块一样)还没真正写入清除值，Clear只做标记，块第一次被写的时候(PrepareBlock)才清除
+		std::vector<Format> sample_buffer; //MSAA时每个采样点的颜色，同一个像素的采样点是连续存放的，Resolve之后平均到back_buffer
+		std::vector<float> sample_depth_buffer; //MSAA时每个采样点的深度
+		Buffer2DView<Format> back_buffer_view;
 		Buffer2DView<float> depth_buffer_view;
+		Buffer2DView<float> hiz_buffer_view;
+		size_t sample_count; //每个像素的采样点数量，1表示不开MSAA
+		Format clear_value; //上一次Clear的颜色(已编码)
+		std::vector<Color> oit_accum; //加权混合OIT(weighted blended OIT)的累加值，rgb是sum(c.rgb * a * weight)，a是sum(a * weight)
+		std::vector<float> oit_revealage; //OIT中背景还能透过多少，prod(1 - a)
+		std::vector<uint8> oit_pending; //块的OIT缓冲还没初始化，也就是还没有半透明的片元
+		bool oit_active; //在BeginOIT和ResolveOIT之间，开了混合的半透明片元会累加到OIT缓冲，不再按提交顺序混合
+
+		//clear_pending中的标记
+		static constexpr uint8 clear_color = 1;
+		static constexpr uint8 clear_depth = 2;
 
-		Context() : back_buffer{}, depth_buffer{}, back_buffer_view{ nullptr }, depth_buffer_view{ nullptr }{};
+		//Hi-Z块的边长(像素)
+		static constexpr size_t hiz_block_size = 8;
+
+		//采样点相对像素中心的偏移，单位是1/16像素，和D3D的标准采样模式一样
+		static constexpr int sample_pattern_1x[1][2] = { { 0, 0 } };
+		static constexpr int sample_pattern_4x[4][2] = { { -2, -6 }, { 6, -2 }, { -6, 2 }, { 2, 6 } };
+		static constexpr int sample_pattern_8x[8][2] = { { 1, -3 }, { -1, 3 }, { 5, 1 }, { -3, -5 }, { -5, 5 }, { -7, -1 }, { 3, 7 }, { 7, -7 } };
+
+		Context() : back_buffer{}, depth_buffer{}, hiz_buffer{}, hiz_dirty{}, clear_pending{}, sample_buffer{}, sample_depth_buffer{}, back_buffer_view{ nullptr }, depth_buffer_view{ nullptr }, hiz_buffer_view{ nullptr }, sample_count{ 1 }, clear_value{}, oit_accum{}, oit_revealage{}, oit_pending{}, oit_active{ false } {};
 		Context(const Context&) = default;
 		Context& operator=(const Context&) noexcept = default;
 		Context(Context&& other) noexcept :
 			back_buffer{ std::move(other.back_buffer) },
 			depth_buffer{ std::move(other.depth_buffer) },
+			hiz_buffer{ std::move(other.hiz_buffer) },
+			hiz_dirty{ std::move(other.hiz_dirty) },
+			clear_pending{ std::move(other.clear_pending) },
+			sample_buffer{ std::move(other.sample_buffer) },
+			sample_depth_buffer{ std::move(other.sample_depth_buffer) },
 			back_buffer_view{ std::move(other.back_buffer_view) },
-			depth_buffer_view{ std::move(other.depth_buffer_view) }
+			depth_buffer_view{ std::move(other.depth_buffer_view) },
+			hiz_buffer_view{ std::move(other.hiz_buffer_view) },
+			sample_count{ other.sample_count },
+			clear_value{ other.clear_value },
+			oit_accum{ std::move(other.oit_accum) },
+			oit_revealage{ std::move(other.oit_revealage) },
+			oit_pending{ std::move(other.oit_pending) },
+			oit_active{ other.oit_active }
 		{}
 		Context& operator=(Context&& other) noexcept
 		{
 			if (this == &other) return *this;
 			back_buffer = std::move(other.back_buffer);
 			depth_buffer = std::move(other.depth_buffer);
+			hiz_buffer = std::move(other.hiz_buffer);
+			hiz_dirty = std::move(other.hiz_dirty);
+			clear_pending = std::move(other.clear_pending);
+			sample_buffer = std::move(other.sample_buffer);
+			sample_depth_buffer = std::move(other.sample_depth_buffer);
 			back_buffer_view = std::move(other.back_buffer_view);
 			depth_buffer_view = std::move(other.depth_buffer_view);
+			hiz_buffer_view = std::move(other.hiz_buffer_view);
+			sample_count = other.sample_count;
+			clear_value = other.clear_value;
+			oit_accum = std::move(other.oit_accum);
+			oit_revealage = std::move(other.oit_revealage);
+			oit_pending = std::move(other.oit_pending);
+			oit_active = other.oit_active;
+			return *this;
 		}
 
-		void CopyToBuffer(Buffer2DView<uint32>& screen_buffer_view)
+		//输出到窗口的帧缓冲，8位sRGB格式已经是最终的颜色了，曝光度为1并且不做色调映射时直接拷贝，否则先解码再和其他格式一样处理
+		void CopyToBuffer(Buffer2DView<uint32>& screen_buffer_view, const PresentSettings& settings = {})
 		{
 			static_assert(std::is_same_v<FsOut, Color>, "Error: 只有颜色buffer能输出到屏幕");
 
@@ -45,37 +243,495 @@ namespace core
 				return;
 			}
 
-			size_t w = screen_buffer_view.w;
-			size_t h = screen_buffer_view.h;
+			switch (settings.tonemap)
+			{
+			case ETonemap::Reinhard:
+				Present<ETonemap::Reinhard>(screen_buffer_view, settings.exposure);
+				break;
+			case ETonemap::ACES:
+				Present<ETonemap::ACES>(screen_buffer_view, settings.exposure);
+				break;
+			default:
+				Present<ETonemap::None>(screen_buffer_view, settings.exposure);
+				break;
+			}
+		}
+
+		template<ETonemap tonemap>
+		void Present(Buffer2DView<uint32>& screen_buffer_view, float exposure)
+		{
+			const size_t w = (std::min)(screen_buffer_view.w, back_buffer_view.w);
+			const int h = narrow_cast<int>((std::min)(screen_buffer_view.h, back_buffer_view.h));
+			const Color clear_color_linear = format::Decode(clear_value);
+			uint32 clear_pixel = 0;
+			PresentRow<tonemap>(&clear_pixel, &clear_color_linear, 1, exposure);
+			//8位sRGB的内存布局和窗口一样，不需要改变颜色时可以直接拷贝
+			bool copy_srgb = false;
+			if constexpr (std::is_same_v<Format, RGBA8_SRGB>)
+			{
+				copy_srgb = tonemap == ETonemap::None && exposure == 1.f;
+				if (copy_srgb)
+				{
+					memcpy(&clear_pixel, &clear_value, sizeof(uint32));
+				}
+			}
 
 #pragma omp parallel for num_threads(8)
 			for (int y = 0; y < h; ++y)
 			{
-				for (int x = 0; x < w; ++x)
+				uint32* dst = &screen_buffer_view.buffer[y * screen_buffer_view.w];
+				const uint8* pending = &clear_pending[(y / hiz_block_size) * hiz_buffer_view.w];
+				for (size_t x0 = 0; x0 < w; x0 += hiz_block_size)
 				{
-					screen_buffer_view.Set((size_t)x, y, TransFloat4colorToUint32color(back_buffer_view.Get(x, y).Pow(1.f / gamma)).color);
+					//还没清除的块直接输出清除的颜色
+					const size_t n = (std::min)(hiz_block_size, w - x0);
+					const bool cleared = pending[x0 / hiz_block_size] & clear_color;
+					const Format* src = &back_buffer[y * back_buffer_view.w + x0];
+					if (cleared)
+					{
+						std::fill_n(dst + x0, n, clear_pixel);
+					}
+					else if (copy_srgb)
+					{
+						//已经是做过gamma校正的8位颜色了，直接拷贝
+						memcpy(dst + x0, src, n * sizeof(uint32));
+					}
+					else if constexpr (std::is_same_v<Format, Color>)
+					{
+						PresentRow<tonemap>(dst + x0, src, n, exposure);
+					}
+					else
+					{
+						//其他格式先解码到栈上，再按行输出
+						Color decoded[hiz_block_size];
+						std::transform(src, src + n, decoded, format::Decode);
+						PresentRow<tonemap>(dst + x0, decoded, n, exposure);
+					}
 				}
 			}
 		}
 
-		void Viewport(size_t w, size_t h)
+		//设置视口大小，samples是每个像素的采样点数量，支持1(不开MSAA)、4、8
+		void Viewport(size_t w, size_t h, size_t samples = 1)
 		{
 			depth_buffer.resize(w * h, inf);
-			back_buffer.resize(w * h);
+			if constexpr (!std::is_same_v<FsOut, DepthOnly>)
+			{
+				back_buffer.resize(w * h);
+			}
+			//只有深度时back_buffer是空的，这个view只用来记录视口大小
 			back_buffer_view = { back_buffer.data(), w , h };
 			depth_buffer_view = { depth_buffer.data(), w , h };
+
+			sample_count = samples >= 8 ? 8 : samples >= 4 ? 4 : 1;
+			if (sample_count > 1)
+			{
+				if constexpr (!std::is_same_v<FsOut, DepthOnly>)
+				{
+					sample_buffer.resize(w * h * sample_count);
+				}
+				sample_depth_buffer.resize(w * h * sample_count, inf);
+			}
+			else
+			{
+				sample_buffer.clear();
+				sample_depth_buffer.clear();
+			}
+
+			const size_t hiz_w = (w + hiz_block_size - 1) / hiz_block_size;
+			const size_t hiz_h = (h + hiz_block_size - 1) / hiz_block_size;
+			hiz_buffer.resize(hiz_w * hiz_h, inf);
+			hiz_dirty.resize(hiz_w * hiz_h, 0);
+			clear_pending.resize(hiz_w * hiz_h, 0);
+			hiz_buffer_view = { hiz_buffer.data(), hiz_w, hiz_h };
+		}
+
+		//采样点的偏移
+		const int(*GetSamplePattern() const)[2]
+		{
+			switch (sample_count)
+			{
+			case 4: return sample_pattern_4x;
+			case 8: return sample_pattern_8x;
+			}
+			return sample_pattern_1x;
+		}
+
+		//像素(x,y)的第一个采样点的颜色，后面sample_count-1个是同一个像素的其他采样点
+		//GetSamples和GetSampleDepths直接访问buffer，像素所在的块要先PrepareBlock
+		Format* GetSamples(size_t x, size_t y)
+		{
+			const size_t i = y * back_buffer_view.w + x;
+			return sample_count > 1 ? &sample_buffer[i * sample_count] : &back_buffer[i];
+		}
+
+		//像素(x,y)的第一个采样点的深度
+		float* GetSampleDepths(size_t x, size_t y)
+		{
+			const size_t i = y * depth_buffer_view.w + x;
+			return sample_count > 1 ? &sample_depth_buffer[i * sample_count] : &depth_buffer[i];
+		}
+
+		//把像素的所有采样点都设置成同一个值，多线程调用时不同线程不能写同一个块
+		void SetPixel(size_t x, size_t y, const FsOut& v)
+		{
+			PrepareBlock(x / hiz_block_size, y / hiz_block_size);
+			const Format encoded = format::Encode(v);
+			Format* samples = GetSamples(x, y);
+			for (size_t s = 0; s < sample_count; ++s)
+			{
+				samples[s] = encoded;
+			}
+		}
+
+		//从另一个同样大小、不开MSAA的Context中复制深度，并重新计算Hi-Z
+		//other中还没清除的块不用复制，标记成深度待清除就行
+		template<typename T, typename F>
+		void CopyDepth(const Context<T, F>& other)
+		{
+			const int hiz_h = narrow_cast<int>(hiz_buffer_view.h);
+			const size_t w = depth_buffer_view.w;
+#pragma omp parallel for num_threads(8)
+			for (int by = 0; by < hiz_h; ++by)
+			{
+				const size_t y0 = by * hiz_block_size;
+				const size_t y1 = (std::min)(y0 + hiz_block_size, depth_buffer_view.h);
+				for (size_t bx = 0; bx < hiz_buffer_view.w; ++bx)
+				{
+					const size_t i = by * hiz_buffer_view.w + bx;
+					if (other.clear_pending[i] & clear_depth)
+					{
+						clear_pending[i] |= clear_depth;
+						continue;
+					}
+					//颜色还没清除的话继续等着，只有深度被覆盖了
+					clear_pending[i] &= ~clear_depth;
+					const size_t x0 = bx * hiz_block_size;
+					const size_t x1 = (std::min)(x0 + hiz_block_size, w);
+					for (size_t y = y0; y < y1; ++y)
+					{
+						const float* src = &other.depth_buffer[y * w];
+						if (sample_count > 1)
+						{
+							for (size_t x = x0; x < x1; ++x)
+							{
+								std::fill_n(GetSampleDepths(x, y), sample_count, src[x]);
+							}
+						}
+						else
+						{
+							std::copy(src + x0, src + x1, &depth_buffer[y * w + x0]);
+						}
+					}
+				}
+			}
+			RebuildHiZ();
+		}
+
+		//把每个像素的采样点平均到back_buffer中，MSAA时在CopyToBuffer之前调用，深度不做resolve
+		void Resolve()
+		{
+			static_assert(std::is_same_v<FsOut, Color>, "Error: 只有颜色buffer能resolve");
+
+			if (sample_count == 1)
+			{
+				return;
+			}
+
+			const int h = narrow_cast<int>(back_buffer_view.h);
+			const size_t w = back_buffer_view.w;
+			const float inv_count = 1.f / sample_count;
+#pragma omp parallel for num_threads(8)
+			for (int y = 0; y < h; ++y)
+			{
+				const uint8* pending = &clear_pending[(y / hiz_block_size) * hiz_buffer_view.w];
+				for (size_t x = 0; x < w; ++x)
+				{
+					//还没清除的块，CopyToBuffer会直接输出清除的颜色
+					if (pending[x / hiz_block_size] & clear_color)
+					{
+						continue;
+					}
+					const Format* samples = GetSamples(x, y);
+					FsOut sum = format::Decode(samples[0]);
+					for (size_t s = 1; s < sample_count; ++s)
+					{
+						sum += format::Decode(samples[s]);
+					}
+					back_buffer[y * w + x] = format::Encode(sum * inv_count);
+				}
+			}
+		}
+
+		//Hi-Z中某个块的深度最大值, bx,by是块的坐标；如果块被标记过，先重新计算
+		float GetHiZ(size_t bx, size_t by)
+		{
+			const size_t i = by * hiz_buffer_view.w + bx;
+			if (hiz_dirty[i])
+			{
+				UpdateHiZ(bx, by);
+			}
+			return hiz_buffer[i];
 		}
 
-		void Clear(FsOut fs_out)
+		//块中的深度被写过，标记一下，等用到的时候再更新
+		void MarkHiZDirty(size_t bx, size_t by)
 		{
-			std::for_each(back_buffer.begin(), back_buffer.end(), [&fs_out](auto& v) { v = fs_out; });
-			std::for_each(depth_buffer.begin(), depth_buffer.end(), [](auto& v) { v = inf; });
+			hiz_dirty[by * hiz_buffer_view.w + bx] = 1;
+		}
+
+		//重新计算某个块的Hi-Z值, bx,by是块的坐标
+		void UpdateHiZ(size_t bx, size_t by)
+		{
+			if (clear_pending[by * hiz_buffer_view.w + bx] & clear_depth)
+			{
+				hiz_buffer_view.Set(bx, by, inf);
+				hiz_dirty[by * hiz_buffer_view.w + bx] = 0;
+				return;
+			}
+			const size_t x0 = bx * hiz_block_size;
+			const size_t y0 = by * hiz_block_size;
+			const size_t x1 = (std::min)(x0 + hiz_block_size, depth_buffer_view.w);
+			const size_t y1 = (std::min)(y0 + hiz_block_size, depth_buffer_view.h);
+			float z_max = 0;
+			for (size_t y = y0; y < y1; ++y)
+			{
+				//同一行像素的采样点是连续的
+				const float* row = GetSampleDepths(x0, y);
+				const size_t row_size = (x1 - x0) * sample_count;
+				for (size_t i = 0; i < row_size; ++i)
+				{
+					z_max = (std::max)(z_max, row[i]);
+				}
+				//块中还有没被写过的像素，不可能更小了
+				if (z_max >= inf)
+				{
+					break;
+				}
+			}
+			hiz_buffer_view.Set(bx, by, z_max);
+			hiz_dirty[by * hiz_buffer_view.w + bx] = 0;
+		}
+
+		//深度缓存被直接修改过(比如拷贝)之后，要重新计算整个Hi-Z
+		void RebuildHiZ()
+		{
+			const int hiz_h = narrow_cast<int>(hiz_buffer_view.h);
+#pragma omp parallel for num_threads(8)
+			for (int by = 0; by < hiz_h; ++by)
+			{
+				for (size_t bx = 0; bx < hiz_buffer_view.w; ++bx)
+				{
+					UpdateHiZ(bx, by);
+				}
+			}
+		}
+
+		//清除只是把所有块标记一下，块第一次被写的时候才真正写入清除值
+		void Clear(const FsOut& fs_out)
+		{
+			clear_value = format::Encode(fs_out);
+			std::fill(clear_pending.begin(), clear_pending.end(), uint8(clear_color | clear_depth));
+			std::fill(hiz_buffer.begin(), hiz_buffer.end(), inf);
+			std::fill(hiz_dirty.begin(), hiz_dirty.end(), uint8(0));
 		}
 
 		void Clear()
 		{
-			std::for_each(back_buffer.begin(), back_buffer.end(), [](auto& v) { v = {}; });
-			std::for_each(depth_buffer.begin(), depth_buffer.end(), [](auto& v) { v = inf; });
+			Clear(FsOut{});
+		}
+
+		//块(bx,by)被写之前调用，如果块还没清除，先写入清除值
+		void PrepareBlock(size_t bx, size_t by)
+		{
+			uint8& pending = clear_pending[by * hiz_buffer_view.w + bx];
+			if (pending)
+			{
+				ClearBlocks(bx, bx + 1, by, pending, false);
+				pending = 0;
+			}
+		}
+
+		//块(bx,by)的颜色是不是还没清除(没有被写过)
+		bool IsBlockCleared(size_t bx, size_t by) const
+		{
+			return clear_pending[by * hiz_buffer_view.w + bx] & clear_color;
+		}
+
+		//开始一组半透明物体的绘制，之间提交的半透明片元可以是任意顺序，ResolveOIT时一起合成到颜色缓冲上
+		//不透明的物体应该在BeginOIT之前画完，半透明物体中完全不透明的片元还是直接写入(并写深度)
+		//OIT缓冲是按像素而不是按采样点累加的，MSAA下覆盖率折算到alpha里，ResolveOIT时同一个像素的所有采样点合成同样的颜色，半透明物体的边缘没有MSAA的效果
+		void BeginOIT()
+		{
+			static_assert(std::is_same_v<FsOut, Color>, "Error: 只有颜色buffer能用OIT");
+			const size_t size = back_buffer_view.w * back_buffer_view.h;
+			if (oit_accum.size() != size)
+			{
+				oit_accum.resize(size);
+				oit_revealage.resize(size);
+			}
+			//和Clear一样只做标记，块第一次有半透明片元时才初始化
+			oit_pending.assign(hiz_buffer.size(), 1);
+			oit_active = true;
+		}
+
+		//块(bx,by)第一次有半透明片元之前调用
+		void PrepareOITBlock(size_t bx, size_t by)
+		{
+			uint8& pending = oit_pending[by * hiz_buffer_view.w + bx];
+			if (pending)
+			{
+				const size_t w = back_buffer_view.w;
+				const size_t x0 = bx * hiz_block_size;
+				const size_t x1 = (std::min)(x0 + hiz_block_size, w);
+				const size_t y1 = (std::min)((by + 1) * hiz_block_size, back_buffer_view.h);
+				for (size_t y = by * hiz_block_size; y < y1; ++y)
+				{
+					std::fill(&oit_accum[y * w + x0], &oit_accum[y * w + x1], Color{ 0.f, 0.f, 0.f, 0.f });
+					std::fill(&oit_revealage[y * w + x0], &oit_revealage[y * w + x1], 1.f);
+				}
+				pending = 0;
+			}
+		}
+
+		//累加一个半透明片元，view_z是观察空间的深度(裁剪空间的w)，coverage是像素被覆盖的比例(MSAA)
+		void AccumulateOIT(size_t x, size_t y, const Color& c, float view_z, float coverage)
+		{
+			//深度权重，近处的片元权重更大 (McGuire & Bavoil 2013, 式7)
+			using gmath::utility::Clamp;
+			const float z5 = view_z / 5.f;
+			const float z200 = view_z / 200.f;
+			const float z200_2 = z200 * z200;
+			const float weight = Clamp(10.f / (1e-5f + z5 * z5 + z200_2 * z200_2 * z200_2), 1e-2f, 3e3f);
+			const float a = c.a * coverage;
+			const float aw = a * weight;
+
+			const size_t i = y * back_buffer_view.w + x;
+			Color& accum = oit_accum[i];
+			accum.x += c.x * aw;
+			accum.y += c.y * aw;
+			accum.z += c.z * aw;
+			accum.w += aw;
+			oit_revealage[i] *= 1.f - a;
+		}
+
+		//把OIT缓冲合成到颜色缓冲上: dst * revealage + 加权平均的颜色 * (1 - revealage)
+		void ResolveOIT()
+		{
+			static_assert(std::is_same_v<FsOut, Color>, "Error: 只有颜色buffer能用OIT");
+			oit_active = false;
+
+			const int hiz_h = narrow_cast<int>(hiz_buffer_view.h);
+			const size_t w = back_buffer_view.w;
+#pragma omp parallel for num_threads(8)
+			for (int by = 0; by < hiz_h; ++by)
+			{
+				const size_t y0 = by * hiz_block_size;
+				const size_t y1 = (std::min)(y0 + hiz_block_size, back_buffer_view.h);
+				for (size_t bx = 0; bx < hiz_buffer_view.w; ++bx)
+				{
+					//没有半透明片元的块
+					if (oit_pending[by * hiz_buffer_view.w + bx])
+					{
+						continue;
+					}
+					PrepareBlock(bx, by);
+					const size_t x0 = bx * hiz_block_size;
+					const size_t x1 = (std::min)(x0 + hiz_block_size, w);
+					for (size_t y = y0; y < y1; ++y)
+					{
+						for (size_t x = x0; x < x1; ++x)
+						{
+							const size_t i = y * w + x;
+							const float revealage = oit_revealage[i];
+							if (revealage >= 1.f)
+							{
+								continue;
+							}
+							const Color& accum = oit_accum[i];
+							const float inv = 1.f / (std::max)(accum.w, 1e-5f);
+							const float t = 1.f - revealage;
+							Format* samples = GetSamples(x, y);
+							for (size_t s = 0; s < sample_count; ++s)
+							{
+								Color dst = format::Decode(samples[s]);
+								dst.x = dst.x * revealage + accum.x * inv * t;
+								dst.y = dst.y * revealage + accum.y * inv * t;
+								dst.z = dst.z * revealage + accum.z * inv * t;
+								samples[s] = format::Encode(dst);
+							}
+						}
+					}
+				}
+			}
+		}
+
+		//把所有还没清除的块都写上清除值，之后可以直接读各个buffer，比如把深度当作贴图用之前
+		//同一行中连续的块合并起来，用流式写入
+		void FlushClear()
+		{
+			const int hiz_h = narrow_cast<int>(hiz_buffer_view.h);
+			const size_t hiz_w = hiz_buffer_view.w;
+#pragma omp parallel for num_threads(8)
+			for (int by = 0; by < hiz_h; ++by)
+			{
+				uint8* pending = &clear_pending[by * hiz_w];
+				size_t bx = 0;
+				while (bx < hiz_w)
+				{
+					if (!pending[bx])
+					{
+						++bx;
+						continue;
+					}
+					size_t end = bx + 1;
+					while (end < hiz_w && pending[end] == pending[bx])
+					{
+						++end;
+					}
+					ClearBlocks(bx, end, by, pending[bx], true);
+					std::fill(pending + bx, pending + end, uint8(0));
+					bx = end;
+				}
+			}
+		}
+
+		//把第by行中[bx0, bx1)的块写入清除值，flags表示要清除颜色还是深度，stream表示用流式写入
+		void ClearBlocks(size_t bx0, size_t bx1, size_t by, uint8 flags, bool stream)
+		{
+			const size_t w = depth_buffer_view.w;
+			const size_t x0 = bx0 * hiz_block_size;
+			const size_t x1 = (std::min)(bx1 * hiz_block_size, w);
+			const size_t y0 = by * hiz_block_size;
+			const size_t y1 = (std::min)(y0 + hiz_block_size, depth_buffer_view.h);
+			const size_t n = (x1 - x0) * sample_count;
+			auto fill = [stream](auto* dst, size_t count, const auto& v) {
+				if (stream)
+				{
+					StreamFill(dst, count, v);
+				}
+				else
+				{
+					std::fill_n(dst, count, v);
+				}
+			};
+
+			for (size_t y = y0; y < y1; ++y)
+			{
+				if ((flags & clear_color) && !back_buffer.empty())
+				{
+					fill(GetSamples(x0, y), n, clear_value);
+					if (sample_count > 1)
+					{
+						//resolve的目标也要清除
+						fill(&back_buffer[y * w + x0], x1 - x0, clear_value);
+					}
+				}
+				if (flags & clear_depth)
+				{
+					fill(GetSampleDepths(x0, y), n, inf);
+				}
+			}
 		}
 
 		static Color32 TransFloat4colorToUint32color(const Color& color)
@@ -1,7 +1,10 @@
 ﻿#pragma once
 
 #include"software_renderer.hpp"
+#include"command_list.hpp"
 #include"model.hpp"
+#include "mesh_simplifier.hpp"
+#include "mesh_optimizer.hpp"
 #include"texture.hpp"
 #include "cube_map.hpp"
 #include "pbr.hpp"
@@ -36,6 +36,15 @@ namespace core
 			return (&front)[max(min(id, 5ULL), 0ULL)].get();
 		}
 
+		//转换6个面的储存格式
+		void Convert(ETextureFormat format)
+		{
+			for (size_t i = 0; i < 6; ++i)
+			{
+				GetTexture(i)->Convert(format);
+			}
+		}
+
 		core::Vec4 Sample(core::Vec3 dir) const
 		{
 			//3个分量中绝对值最大的,决定采样哪个面
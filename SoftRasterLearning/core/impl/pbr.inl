@@ -142,6 +142,16 @@
 		}
 	}
 
+	inline void IBL::Convert(ETextureFormat format)
+	{
+		brdf_map->Convert(format);
+		irradiance_map->Convert(format);
+		for (auto& specular_map : specular_maps)
+		{
+			specular_map->Convert(format);
+		}
+	}
+
 	inline IBL::IBL()
 	{
 		brdf_map = std::make_shared<Texture>(512, 512);
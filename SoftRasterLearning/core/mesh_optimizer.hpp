@@ -0,0 +1,323 @@
+﻿#pragma once
+
+#include "model.hpp"
+#include <algorithm>
+#include <vector>
+
+namespace core
+{
+	//顶点缓存的统计，模拟一个FIFO的顶点缓存(post-transform cache)
+	struct VertexCacheStatistics
+	{
+		size_t vertices_transformed = 0; //缓存未命中，需要执行顶点着色器的次数
+		float acmr = 0.f; //平均每个三角形的未命中次数，最好是0.5左右，最差是3
+		float atvr = 0.f; //未命中次数/顶点数，最好是1
+	};
+
+	inline VertexCacheStatistics AnalyzeVertexCache(const std::vector<uint32>& indices, size_t vertex_count, size_t cache_size = 16)
+	{
+		VertexCacheStatistics result;
+		if (indices.empty() || vertex_count == 0)
+		{
+			return result;
+		}
+		//用时间戳模拟FIFO，顶点进入缓存的时间比当前早cache_size以上就已经被挤出去了
+		std::vector<size_t> timestamp(vertex_count, 0);
+		size_t time = cache_size + 1;
+		for (uint32 i : indices)
+		{
+			if (time - timestamp[i] > cache_size)
+			{
+				timestamp[i] = time++;
+				++result.vertices_transformed;
+			}
+		}
+		result.acmr = (float)result.vertices_transformed / (indices.size() / 3);
+		result.atvr = (float)result.vertices_transformed / vertex_count;
+		return result;
+	}
+
+	namespace optimize_detail
+	{
+		//顶点 -> 用到它的三角形，CSR格式
+		struct TriangleAdjacency
+		{
+			std::vector<uint32> offset;
+			std::vector<uint32> triangles;
+
+			TriangleAdjacency(const std::vector<uint32>& indices, size_t vertex_count) :
+				offset(vertex_count + 1, 0),
+				triangles(indices.size())
+			{
+				for (uint32 i : indices)
+				{
+					++offset[i + 1];
+				}
+				for (size_t v = 0; v < vertex_count; ++v)
+				{
+					offset[v + 1] += offset[v];
+				}
+				std::vector<uint32> fill(offset.begin(), offset.end() - 1);
+				for (size_t i = 0; i < indices.size(); ++i)
+				{
+					triangles[fill[indices[i]]++] = (uint32)(i / 3);
+				}
+			}
+
+			uint32 Count(uint32 v) const noexcept
+			{
+				return offset[v + 1] - offset[v];
+			}
+		};
+	}
+
+	//用Tipsify算法重排三角形，提高顶点缓存的命中率，线性时间
+	//以一个顶点为中心把它周围的三角形都输出(扇形)，下一个中心从刚输出的顶点里选还在缓存中的那个
+	//clusters不为空时输出簇的起始三角形，从死路跳出来(缓存里的顶点都用完了)的地方是一个新簇的开始，用于之后按遮挡排序
+	inline std::vector<uint32> OptimizeVertexCache(const std::vector<uint32>& indices, size_t vertex_count, size_t cache_size = 16, std::vector<uint32>* clusters = nullptr)
+	{
+		using namespace optimize_detail;
+
+		const size_t triangle_count = indices.size() / 3;
+		std::vector<uint32> result;
+		result.reserve(triangle_count * 3);
+		if (clusters)
+		{
+			clusters->clear();
+		}
+		if (triangle_count == 0)
+		{
+			return result;
+		}
+
+		const TriangleAdjacency adjacency{ indices, vertex_count };
+		std::vector<uint32> live(vertex_count); //顶点还没输出的三角形数
+		for (size_t v = 0; v < vertex_count; ++v)
+		{
+			live[v] = adjacency.Count((uint32)v);
+		}
+		std::vector<size_t> timestamp(vertex_count, 0);
+		std::vector<char> emitted(triangle_count, 0);
+		std::vector<uint32> dead_end; //最近输出的顶点，找不到下一个中心时从这里往回找
+		std::vector<uint32> candidates;
+		size_t time = cache_size + 1;
+		size_t cursor = 0; //死路栈也空了时，按顺序找还有三角形的顶点
+
+		int fanning = (int)indices[0];
+		bool new_cluster = true;
+		while (fanning >= 0)
+		{
+			candidates.clear();
+			const uint32 f = (uint32)fanning;
+			for (uint32 k = adjacency.offset[f]; k < adjacency.offset[f + 1]; ++k)
+			{
+				const uint32 t = adjacency.triangles[k];
+				if (emitted[t])
+				{
+					continue;
+				}
+				emitted[t] = 1;
+				if (new_cluster && clusters)
+				{
+					clusters->push_back((uint32)(result.size() / 3));
+				}
+				new_cluster = false;
+				for (int c = 0; c < 3; ++c)
+				{
+					const uint32 v = indices[t * 3 + c];
+					result.push_back(v);
+					dead_end.push_back(v);
+					candidates.push_back(v);
+					--live[v];
+					if (time - timestamp[v] > cache_size)
+					{
+						timestamp[v] = time++;
+					}
+				}
+			}
+
+			//从刚输出的顶点里选下一个中心：优先选输出它剩下的三角形之后还在缓存里、并且在缓存里待得最久的
+			fanning = -1;
+			int best = -1;
+			for (uint32 v : candidates)
+			{
+				if (live[v] == 0)
+				{
+					continue;
+				}
+				int priority = 0;
+				if (time - timestamp[v] + 2 * live[v] <= cache_size)
+				{
+					priority = (int)(time - timestamp[v]);
+				}
+				if (priority > best)
+				{
+					best = priority;
+					fanning = (int)v;
+				}
+			}
+
+			if (fanning < 0)
+			{
+				//死路，从最近输出的顶点往回找，再找不到就按顺序找
+				while (!dead_end.empty())
+				{
+					const uint32 d = dead_end.back();
+					dead_end.pop_back();
+					if (live[d] > 0)
+					{
+						fanning = (int)d;
+						break;
+					}
+				}
+				while (fanning < 0 && cursor < vertex_count)
+				{
+					if (live[cursor] > 0)
+					{
+						fanning = (int)cursor;
+					}
+					++cursor;
+				}
+				new_cluster = true;
+			}
+		}
+		return result;
+	}
+
+	//按簇重排三角形以减少overdraw，clusters是每个簇的起始三角形(OptimizeVertexCache输出的)
+	//朝外并且离模型中心远的簇更可能挡住别的簇，先画它们，后面被挡住的像素在深度测试时就会被丢掉，簇内的顺序不变，所以缓存命中率基本不受影响
+	inline std::vector<uint32> OptimizeOverdraw(const std::vector<uint32>& indices, const std::vector<Model_Vertex>& vertices, const std::vector<uint32>& clusters)
+	{
+		const size_t triangle_count = indices.size() / 3;
+		if (clusters.size() <= 1)
+		{
+			return indices;
+		}
+
+		//模型的中心(按面积加权)
+		Vec3 mesh_center = { 0,0,0 };
+		float mesh_area = 0.f;
+		auto triangle = [&](size_t t, Vec3& center, Vec3& normal) {
+			const Vec3 a = vertices[indices[t * 3]].position;
+			const Vec3 b = vertices[indices[t * 3 + 1]].position;
+			const Vec3 c = vertices[indices[t * 3 + 2]].position;
+			normal = (b - a).Cross(c - a); //长度是面积的2倍
+			center = (a + b + c) / 3.f;
+		};
+		for (size_t t = 0; t < triangle_count; ++t)
+		{
+			Vec3 center, normal;
+			triangle(t, center, normal);
+			const float area = normal.Length();
+			mesh_center += center * area;
+			mesh_area += area;
+		}
+		if (mesh_area > 0.f)
+		{
+			mesh_center = mesh_center / mesh_area;
+		}
+
+		struct Cluster
+		{
+			uint32 begin;
+			uint32 end;
+			float key;
+		};
+		std::vector<Cluster> sorted(clusters.size());
+		for (size_t i = 0; i < clusters.size(); ++i)
+		{
+			const uint32 begin = clusters[i];
+			const uint32 end = i + 1 < clusters.size() ? clusters[i + 1] : (uint32)triangle_count;
+			Vec3 cluster_center = { 0,0,0 };
+			Vec3 cluster_normal = { 0,0,0 };
+			float cluster_area = 0.f;
+			for (uint32 t = begin; t < end; ++t)
+			{
+				Vec3 center, normal;
+				triangle(t, center, normal);
+				const float area = normal.Length();
+				cluster_center += center * area;
+				cluster_normal += normal;
+				cluster_area += area;
+			}
+			const float normal_length = cluster_normal.Length();
+			float key = 0.f;
+			if (cluster_area > 0.f && normal_length > 0.f)
+			{
+				key = (cluster_center / cluster_area - mesh_center).Dot(cluster_normal / normal_length);
+			}
+			sorted[i] = { begin, end, key };
+		}
+		std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster& a, const Cluster& b) { return a.key > b.key; });
+
+		std::vector<uint32> result;
+		result.reserve(indices.size());
+		for (const auto& c : sorted)
+		{
+			result.insert(result.end(), indices.begin() + c.begin * 3, indices.begin() + c.end * 3);
+		}
+		return result;
+	}
+
+	//按索引中第一次用到的顺序重排顶点，顶点着色和图元装配时读顶点的顺序就接近线性的了
+	//返回旧顶点下标 -> 新顶点下标，没用到的顶点放在最后
+	inline std::vector<uint32> OptimizeVertexFetch(std::vector<Model_Vertex>& vertices, const std::vector<uint32>& indices)
+	{
+		constexpr uint32 unused = ~0u;
+		std::vector<uint32> remap(vertices.size(), unused);
+		uint32 next = 0;
+		for (uint32 i : indices)
+		{
+			if (remap[i] == unused)
+			{
+				remap[i] = next++;
+			}
+		}
+		for (auto& r : remap)
+		{
+			if (r == unused)
+			{
+				r = next++;
+			}
+		}
+
+		std::vector<Model_Vertex> reordered(vertices.size());
+		for (size_t i = 0; i < vertices.size(); ++i)
+		{
+			reordered[remap[i]] = vertices[i];
+		}
+		vertices = std::move(reordered);
+		return remap;
+	}
+
+	//加载之后优化模型(包括它的LOD)的三角形和顶点顺序：先为顶点缓存排序，再按簇重排减少overdraw，最后按用到的顺序重排顶点
+	inline void OptimizeModel(Model& model, size_t cache_size = 16)
+	{
+		const size_t vertex_count = model.mesh.size();
+		std::vector<uint32> clusters;
+		auto optimize = [&](std::vector<uint32>& indices) {
+			indices = OptimizeVertexCache(indices, vertex_count, cache_size, &clusters);
+			indices = OptimizeOverdraw(indices, model.mesh, clusters);
+		};
+
+		optimize(model.indices);
+		for (auto& lod : model.lods)
+		{
+			optimize(lod.indices);
+		}
+
+		//LOD用到的顶点都是原模型顶点的子集，按原模型的顺序排就行
+		const std::vector<uint32> remap = OptimizeVertexFetch(model.mesh, model.indices);
+		for (uint32& i : model.indices)
+		{
+			i = remap[i];
+		}
+		for (auto& lod : model.lods)
+		{
+			for (uint32& i : lod.indices)
+			{
+				i = remap[i];
+			}
+		}
+	}
+}
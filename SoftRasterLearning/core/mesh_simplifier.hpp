@@ -0,0 +1,433 @@
+﻿#pragma once
+
+#include "model.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+namespace core
+{
+	namespace simplify_detail
+	{
+		struct PositionHash
+		{
+			size_t operator()(const Vec3& p) const noexcept
+			{
+				uint32 bits[3];
+				const float v[3] = { p.x, p.y, p.z };
+				memcpy(bits, v, sizeof(bits));
+				return ((size_t)bits[0] * 73856093) ^ ((size_t)bits[1] * 19349663) ^ ((size_t)bits[2] * 83492791);
+			}
+		};
+
+		struct PositionEqual
+		{
+			bool operator()(const Vec3& a, const Vec3& b) const noexcept
+			{
+				return a.x == b.x && a.y == b.y && a.z == b.z;
+			}
+		};
+
+		//误差二次型，Q(p) = p^T A p + 2 b^T p + c，表示点到一组平面距离的平方和
+		struct Quadric
+		{
+			double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+			double b0 = 0, b1 = 0, b2 = 0;
+			double c = 0;
+
+			//平面 n·p + d = 0，n是单位向量
+			static Quadric FromPlane(double nx, double ny, double nz, double d)
+			{
+				return { nx * nx, nx * ny, nx * nz, ny * ny, ny * nz, nz * nz, nx * d, ny * d, nz * d, d * d };
+			}
+
+			Quadric& operator+=(const Quadric& q)
+			{
+				a00 += q.a00; a01 += q.a01; a02 += q.a02; a11 += q.a11; a12 += q.a12; a22 += q.a22;
+				b0 += q.b0; b1 += q.b1; b2 += q.b2;
+				c += q.c;
+				return *this;
+			}
+
+			double Evaluate(const Vec3& p) const
+			{
+				const double x = p.x, y = p.y, z = p.z;
+				const double r = a00 * x * x + a11 * y * y + a22 * z * z +
+					2 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+					2 * (b0 * x + b1 * y + b2 * z) + c;
+				return r > 0 ? r : 0;
+			}
+		};
+
+		//一次塌缩的候选：把位置u合并到位置v上
+		struct Collapse
+		{
+			float cost;
+			uint32 u;
+			uint32 v;
+			uint32 version_u;
+			uint32 version_v;
+
+			bool operator>(const Collapse& rhs) const noexcept
+			{
+				return cost > rhs.cost;
+			}
+		};
+	}
+
+	//用二次误差度量(QEM)简化带索引的三角形网格，简化到不超过target_triangles个三角形(或者不能再简化为止)，返回新的索引，顶点不变
+	//用的是半边塌缩，保留下来的顶点位置和属性都不变，所以不需要重新插值uv和法线，简化后的网格可以和原来共用顶点
+	//uv、法线不连续的接缝上的顶点只能沿着接缝塌缩，网格的边界只能沿着边界塌缩，会导致三角形翻转的塌缩不做
+	//error返回塌缩中最大的几何误差(到原来平面的距离，和模型的单位一样)
+	inline std::vector<uint32> SimplifyMesh(const std::vector<Model_Vertex>& vertices, const std::vector<uint32>& source_indices, size_t target_triangles, float* error = nullptr)
+	{
+		using namespace simplify_detail;
+
+		//相同位置的顶点(接缝两边的顶点)归到一起，拓扑关系和误差都按位置计算
+		std::vector<uint32> indices = source_indices;
+		std::vector<uint32> vertex_pos(vertices.size()); //顶点所在的位置编号
+		std::vector<Vec3> positions;
+		{
+			std::unordered_map<Vec3, uint32, PositionHash, PositionEqual> pos_map;
+			pos_map.reserve(vertices.size());
+			for (size_t i = 0; i < vertices.size(); ++i)
+			{
+				auto [it, inserted] = pos_map.try_emplace(vertices[i].position, (uint32)positions.size());
+				if (inserted)
+				{
+					positions.push_back(vertices[i].position);
+				}
+				vertex_pos[i] = it->second;
+			}
+		}
+
+		const size_t tri_count = indices.size() / 3;
+		const size_t pos_count = positions.size();
+		std::vector<char> tri_alive(tri_count, 1);
+		std::vector<std::vector<uint32>> pos_tris(pos_count); //每个位置周围的三角形，塌缩之后会有已经删除的三角形，用的时候跳过
+		std::vector<Quadric> quadrics(pos_count);
+		size_t alive_count = 0;
+
+		auto pos_of = [&](size_t tri, int corner) { return vertex_pos[indices[tri * 3 + corner]]; };
+
+		for (size_t t = 0; t < tri_count; ++t)
+		{
+			const uint32 p0 = pos_of(t, 0), p1 = pos_of(t, 1), p2 = pos_of(t, 2);
+			if (p0 == p1 || p1 == p2 || p2 == p0)
+			{
+				tri_alive[t] = 0;
+				continue;
+			}
+			++alive_count;
+			pos_tris[p0].push_back((uint32)t);
+			pos_tris[p1].push_back((uint32)t);
+			pos_tris[p2].push_back((uint32)t);
+
+			const Vec3 n = (positions[p1] - positions[p0]).Cross(positions[p2] - positions[p0]);
+			const float len = n.Length();
+			if (len > 0.f)
+			{
+				const Vec3 un = n / len;
+				const Quadric q = Quadric::FromPlane(un.x, un.y, un.z, -un.Dot(positions[p0]));
+				quadrics[p0] += q;
+				quadrics[p1] += q;
+				quadrics[p2] += q;
+			}
+		}
+
+		//只属于一个三角形的边是边界
+		std::vector<char> is_border(pos_count, 0);
+		{
+			std::unordered_map<unsigned long long, int> edge_count;
+			edge_count.reserve(alive_count * 3);
+			for (size_t t = 0; t < tri_count; ++t)
+			{
+				if (!tri_alive[t]) continue;
+				for (int k = 0; k < 3; ++k)
+				{
+					const uint32 a = pos_of(t, k), b = pos_of(t, (k + 1) % 3);
+					++edge_count[((unsigned long long)(std::min)(a, b) << 32) | (std::max)(a, b)];
+				}
+			}
+			for (const auto& [edge, count] : edge_count)
+			{
+				if (count == 1)
+				{
+					is_border[edge >> 32] = 1;
+					is_border[edge & 0xffffffff] = 1;
+				}
+			}
+		}
+
+		//只有面的二次型时，沿着边界或接缝把角上的点塌缩掉代价是0，轮廓和接缝会被切掉一块
+		//所以给边界和接缝上的边加一个过这条边、垂直于三角形的平面，偏离这条线的塌缩就有代价了
+		//按顶点编号只出现一次的边是边界或者接缝(同一个位置两边的顶点不同)
+		{
+			std::unordered_map<unsigned long long, int> edge_count;
+			edge_count.reserve(alive_count * 3);
+			auto vertex_edge = [&](size_t t, int k) {
+				const uint32 a = indices[t * 3 + k], b = indices[t * 3 + (k + 1) % 3];
+				return ((unsigned long long)(std::min)(a, b) << 32) | (std::max)(a, b);
+			};
+			for (size_t t = 0; t < tri_count; ++t)
+			{
+				if (!tri_alive[t]) continue;
+				for (int k = 0; k < 3; ++k)
+				{
+					++edge_count[vertex_edge(t, k)];
+				}
+			}
+			for (size_t t = 0; t < tri_count; ++t)
+			{
+				if (!tri_alive[t]) continue;
+				const Vec3 n = (positions[pos_of(t, 1)] - positions[pos_of(t, 0)]).Cross(positions[pos_of(t, 2)] - positions[pos_of(t, 0)]);
+				for (int k = 0; k < 3; ++k)
+				{
+					if (edge_count[vertex_edge(t, k)] != 1) continue;
+					const uint32 a = pos_of(t, k), b = pos_of(t, (k + 1) % 3);
+					const Vec3 side = (positions[b] - positions[a]).Cross(n);
+					const float len = side.Length();
+					if (len > 0.f)
+					{
+						const Vec3 un = side / len;
+						const Quadric q = Quadric::FromPlane(un.x, un.y, un.z, -un.Dot(positions[a]));
+						quadrics[a] += q;
+						quadrics[b] += q;
+					}
+				}
+			}
+		}
+
+		std::vector<char> pos_alive(pos_count, 1);
+		std::vector<uint32> version(pos_count, 0);
+		std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+
+		auto push = [&](uint32 u, uint32 v) {
+			Quadric q = quadrics[u];
+			q += quadrics[v];
+			heap.push({ (float)q.Evaluate(positions[v]), u, v, version[u], version[v] });
+		};
+
+		for (size_t t = 0; t < tri_count; ++t)
+		{
+			if (!tri_alive[t]) continue;
+			for (int k = 0; k < 3; ++k)
+			{
+				const uint32 a = pos_of(t, k), b = pos_of(t, (k + 1) % 3);
+				push(a, b);
+				push(b, a);
+			}
+		}
+
+		float max_error = 0.f;
+		std::vector<std::pair<uint32, uint32>> remap; //u上的顶点 -> v上的顶点
+		std::vector<uint32> neighbors_u, neighbors_v;
+
+		while (alive_count > target_triangles && !heap.empty())
+		{
+			const Collapse c = heap.top();
+			heap.pop();
+			const uint32 u = c.u, v = c.v;
+			if (!pos_alive[u] || !pos_alive[v] || c.version_u != version[u] || c.version_v != version[v])
+			{
+				continue;
+			}
+
+			//u的每个顶点都要在共边的三角形里找到v上对应的顶点，找不到说明这条边不在接缝上，塌缩会扯坏uv或法线
+			remap.clear();
+			neighbors_u.clear();
+			neighbors_v.clear();
+			int shared = 0;
+			bool is_edge_border = false;
+			for (uint32 t : pos_tris[u])
+			{
+				if (!tri_alive[t]) continue;
+				int cu = -1, cv = -1;
+				for (int k = 0; k < 3; ++k)
+				{
+					const uint32 p = pos_of(t, k);
+					if (p == u) cu = k;
+					else if (p == v) cv = k;
+					else neighbors_u.push_back(p);
+				}
+				if (cv >= 0)
+				{
+					++shared;
+					const uint32 a = indices[t * 3 + cu];
+					const uint32 b = indices[t * 3 + cv];
+					if (std::find_if(remap.begin(), remap.end(), [a](auto& r) { return r.first == a; }) == remap.end())
+					{
+						remap.push_back({ a, b });
+					}
+				}
+			}
+			if (shared == 0)
+			{
+				continue; //这条边已经不存在了
+			}
+			is_edge_border = shared == 1;
+
+			//边界上的点只能沿着边界塌缩
+			if (is_border[u] && !(is_border[v] && is_edge_border))
+			{
+				continue;
+			}
+
+			bool valid = true;
+			for (uint32 t : pos_tris[u])
+			{
+				if (!tri_alive[t]) continue;
+				const uint32 a = indices[t * 3 + (pos_of(t, 0) == u ? 0 : pos_of(t, 1) == u ? 1 : 2)];
+				if (std::find_if(remap.begin(), remap.end(), [a](auto& r) { return r.first == a; }) == remap.end())
+				{
+					valid = false;
+					break;
+				}
+			}
+			if (!valid)
+			{
+				continue;
+			}
+
+			//u和v共同的邻居只能是共边三角形的第三个顶点，否则塌缩后会出现非流形的边
+			for (uint32 t : pos_tris[v])
+			{
+				if (!tri_alive[t]) continue;
+				for (int k = 0; k < 3; ++k)
+				{
+					const uint32 p = pos_of(t, k);
+					if (p != u && p != v) neighbors_v.push_back(p);
+				}
+			}
+			std::sort(neighbors_u.begin(), neighbors_u.end());
+			neighbors_u.erase(std::unique(neighbors_u.begin(), neighbors_u.end()), neighbors_u.end());
+			std::sort(neighbors_v.begin(), neighbors_v.end());
+			neighbors_v.erase(std::unique(neighbors_v.begin(), neighbors_v.end()), neighbors_v.end());
+			int common = 0;
+			for (uint32 p : neighbors_u)
+			{
+				common += std::binary_search(neighbors_v.begin(), neighbors_v.end(), p) ? 1 : 0;
+			}
+			if (common > shared)
+			{
+				continue;
+			}
+
+			//u移动到v之后，周围剩下的三角形不能翻转，也不能退化
+			for (uint32 t : pos_tris[u])
+			{
+				if (!tri_alive[t]) continue;
+				const uint32 p0 = pos_of(t, 0), p1 = pos_of(t, 1), p2 = pos_of(t, 2);
+				if (p0 == v || p1 == v || p2 == v) continue;
+				const Vec3 a = positions[p0], b = positions[p1], d = positions[p2];
+				const Vec3 n0 = (b - a).Cross(d - a);
+				const Vec3 na = p0 == u ? positions[v] : a;
+				const Vec3 nb = p1 == u ? positions[v] : b;
+				const Vec3 nd = p2 == u ? positions[v] : d;
+				const Vec3 n1 = (nb - na).Cross(nd - na);
+				const float l0 = n0.Length(), l1 = n1.Length();
+				if (l1 <= 1e-4f * l0 || n0.Dot(n1) < 0.2f * l0 * l1)
+				{
+					valid = false;
+					break;
+				}
+			}
+			if (!valid)
+			{
+				continue;
+			}
+
+			//执行塌缩
+			for (uint32 t : pos_tris[u])
+			{
+				if (!tri_alive[t]) continue;
+				bool has_v = false;
+				for (int k = 0; k < 3; ++k)
+				{
+					has_v |= pos_of(t, k) == v;
+				}
+				if (has_v)
+				{
+					tri_alive[t] = 0;
+					--alive_count;
+					continue;
+				}
+				for (int k = 0; k < 3; ++k)
+				{
+					uint32& index = indices[t * 3 + k];
+					if (vertex_pos[index] == u)
+					{
+						index = std::find_if(remap.begin(), remap.end(), [index](auto& r) { return r.first == index; })->second;
+					}
+				}
+				pos_tris[v].push_back(t);
+			}
+			pos_tris[u].clear();
+			pos_tris[u].shrink_to_fit();
+			pos_alive[u] = 0;
+			quadrics[v] += quadrics[u];
+			++version[v];
+			max_error = (std::max)(max_error, std::sqrt(c.cost));
+
+			//v周围的边的代价都变了
+			std::vector<uint32>& tris_v = pos_tris[v];
+			tris_v.erase(std::remove_if(tris_v.begin(), tris_v.end(), [&](uint32 t) { return !tri_alive[t]; }), tris_v.end());
+			neighbors_v.clear();
+			for (uint32 t : tris_v)
+			{
+				for (int k = 0; k < 3; ++k)
+				{
+					const uint32 p = pos_of(t, k);
+					if (p != v) neighbors_v.push_back(p);
+				}
+			}
+			std::sort(neighbors_v.begin(), neighbors_v.end());
+			neighbors_v.erase(std::unique(neighbors_v.begin(), neighbors_v.end()), neighbors_v.end());
+			for (uint32 p : neighbors_v)
+			{
+				push(v, p);
+				push(p, v);
+			}
+		}
+
+		std::vector<uint32> result;
+		result.reserve(alive_count * 3);
+		for (size_t t = 0; t < tri_count; ++t)
+		{
+			if (!tri_alive[t]) continue;
+			result.insert(result.end(), &indices[t * 3], &indices[t * 3] + 3);
+		}
+		if (error)
+		{
+			*error = max_error;
+		}
+		return result;
+	}
+
+	//为模型生成LOD链，每一级的三角形数量是上一级的ratio倍，从上一级简化而来
+	//简化不动(比如已经是最简单的形状)时停止，最多生成max_levels级
+	inline void GenerateLods(Model& model, size_t max_levels = 4, float ratio = 0.5f)
+	{
+		model.lods.clear();
+		float error = 0.f;
+		for (size_t i = 0; i < max_levels; ++i)
+		{
+			const std::vector<uint32>& source = model.GetLodIndices(model.lods.size());
+			const size_t source_triangles = source.size() / 3;
+			const size_t target = (size_t)(source_triangles * ratio);
+			float lod_error = 0.f;
+			std::vector<uint32> lod = SimplifyMesh(model.mesh, source, target, &lod_error);
+			//少于一成的简化不值得多存一级
+			if (lod.size() / 3 > source_triangles * 9 / 10)
+			{
+				break;
+			}
+			//误差是相对上一级的，累加起来得到相对原始模型误差的上界
+			error += lod_error;
+			model.lods.push_back({ std::move(lod), error });
+		}
+	}
+}
@@ -1,32 +1,35 @@
 ﻿#pragma once
 
 #include "types_and_defs.hpp"
+#include "bounds.hpp"
+#include "vertex_format.hpp"
 
 namespace core
 {
-	struct Model_Vertex
+	//模型的一级LOD，和原始模型共用顶点，只有索引不同
+	struct ModelLod
 	{
-		Vec3 position;
-		Vec2 uv;
-		Vec3 normal;
-		Vec3 tangent;
-
-		Model_Vertex() = default;
-		Model_Vertex(Vec3 p, Vec2 t, Vec3 n) :
-			position(p),
-			uv(t),
-			normal(n)
-		{
-		}
+		std::vector<uint32> indices;
+		float error; //和原始模型相比的几何误差(模型空间的距离)
 	};
 
 	struct Model
 	{
-		std::vector<Model_Vertex> mesh;
+		std::vector<Model_Vertex> mesh; //不重复的顶点
+		std::vector<uint32> indices; //每3个索引组成一个三角形
+		std::vector<ModelLod> lods; //简化过的模型，越往后越简单，由GenerateLods生成
+		PackedMesh packed; //压缩过的顶点，由Pack生成，不为空时绘制用它代替mesh
+		AABB aabb;
+		BoundingSphere bounding_sphere; //模型空间的包围球
 
 		Model() = default;
 		Model(Model&& other) noexcept :
-			mesh{ std::move(other.mesh) }
+			mesh{ std::move(other.mesh) },
+			indices{ std::move(other.indices) },
+			lods{ std::move(other.lods) },
+			packed{ std::move(other.packed) },
+			aabb{ other.aabb },
+			bounding_sphere{ other.bounding_sphere }
 		{}
 		Model& operator=(Model&& other) noexcept
 		{
@@ -35,6 +38,74 @@ namespace core
 				return *this;
 			}
 			this->mesh = std::move(other.mesh);
+			this->indices = std::move(other.indices);
+			this->lods = std::move(other.lods);
+			this->packed = std::move(other.packed);
+			this->aabb = other.aabb;
+			this->bounding_sphere = other.bounding_sphere;
+			return *this;
+		}
+
+		//把顶点压缩成Model_Vertex_Packed，release_mesh为true时释放原来的顶点，之后就不能再简化或优化模型了
+		//要在ComputeBounds之后调用，位置是相对包围盒量化的
+		void Pack(bool release_mesh = false)
+		{
+			packed = PackedMesh{ mesh, aabb };
+			if (release_mesh)
+			{
+				mesh.clear();
+				mesh.shrink_to_fit();
+			}
+		}
+
+		bool IsPacked() const noexcept
+		{
+			return !packed.empty();
+		}
+
+		//LOD的数量，第0级是模型本身
+		size_t GetLodCount() const noexcept
+		{
+			return lods.size() + 1;
+		}
+
+		const std::vector<uint32>& GetLodIndices(size_t level) const noexcept
+		{
+			return level == 0 ? indices : lods[level - 1].indices;
+		}
+
+		float GetLodError(size_t level) const noexcept
+		{
+			return level == 0 ? 0.f : lods[level - 1].error;
+		}
+
+		//根据顶点计算包围盒和包围球，修改mesh之后要重新调用
+		//包围球的球心取包围盒的中心，半径是到最远顶点的距离，比最小包围球稍大，但足够紧而且算起来简单
+		void ComputeBounds()
+		{
+			if (mesh.empty())
+			{
+				aabb = {};
+				bounding_sphere = {};
+				return;
+			}
+			Vec3 min = mesh[0].position;
+			Vec3 max = mesh[0].position;
+			for (const auto& v : mesh)
+			{
+				min = { (std::min)(min.x, v.position.x), (std::min)(min.y, v.position.y), (std::min)(min.z, v.position.z) };
+				max = { (std::max)(max.x, v.position.x), (std::max)(max.y, v.position.y), (std::max)(max.z, v.position.z) };
+			}
+			aabb = { min, max };
+
+			const Vec3 center = aabb.Center();
+			float r2 = 0.f;
+			for (const auto& v : mesh)
+			{
+				const Vec3 d = v.position - center;
+				r2 = (std::max)(r2, d.Dot(d));
+			}
+			bounding_sphere = { center, std::sqrt(r2) };
 		}
 		//...
 	};
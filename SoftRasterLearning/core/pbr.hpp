@@ -62,6 +62,8 @@ namespace core::pbr
 
 		void Save(const wchar_t* filename);
 		void Load(const wchar_t* filename);
+		//转换所有贴图的储存格式，Save只支持RGBA32F
+		void Convert(ETextureFormat format);
 		IBL();
 		void Init(const CubeMap& env);
 		Vec2 IntegrateBRDF(float NdotV, float roughness);
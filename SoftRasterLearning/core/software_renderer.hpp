@@ -1,6 +1,7 @@
 ﻿#pragma once
 
 #include "context.hpp"
+#include <array>
 
 namespace core
 {
@@ -26,17 +27,19 @@ namespace core
 		RF_CULL_BACK = 2,  //剔除反面 逆时针
 		RF_CULL_CVV_SIMPLE = 4, //简单的CVV剔除，三角形的顶点只要有一个在CVV之外就全部丢弃掉
 		RF_CULL_CVV_CLIP = 8,   //三角形3个顶点都在CVV外面的情况，全部丢弃
-		//RF_ENABLE_MULTI_THREAD = 16,
-		RF_ENABLE_SIMPLE_AA = 32, //简单的抗锯齿，不带采样点深度缓存的，建议不要用
-		RF_ENABLE_BLEND = 64,     //打开透明度混合，
+		RF_ENABLE_TILE_BINNING = 16, //分块光栅化，先把整个draw call的三角形分到屏幕上64x64的tile中，再由多个线程各自负责一个tile
+		RF_ENABLE_SIMPLE_AA = 32, //简单的抗锯齿，不带采样点深度缓存的，建议不要用，用Context的MSAA(Viewport时指定采样点数量)，Context开了MSAA时这个标志会被忽略
+		RF_ENABLE_BLEND = 64,     //打开透明度混合，Context在BeginOIT和ResolveOIT之间时，半透明的片元改用加权混合OIT，和提交顺序无关
 		RF_ENABLE_DEPTH_TEST = 128, //打开深度测试
+		RF_ENABLE_QUAD_SHADING = 256, //以2x2的quad为单位着色，可以求导数(ddx/ddy)，shader可以提供FSQuad一次处理整个quad，不支持简单抗锯齿
+		RF_CULL_CVV_GUARD_BAND = 512, //配合RF_CULL_CVV_CLIP使用，x,y方向只用很大的保护带(guard band)做裁剪，视口外的部分交给光栅化时的包围盒去裁，只有穿过近/远平面或保护带的三角形才需要做几何裁剪。不开CVV裁剪时总是会用保护带裁剪
 		//...
-		RF_DEFAULT = RF_CULL_BACK | RF_CULL_CVV_CLIP /*| RF_ENABLE_MULTI_THREAD */ | RF_ENABLE_BLEND | RF_ENABLE_DEPTH_TEST,
+		RF_DEFAULT = RF_CULL_BACK | RF_CULL_CVV_CLIP | RF_ENABLE_BLEND | RF_ENABLE_DEPTH_TEST,
 		RF_DEFAULT_AA = RF_DEFAULT | RF_ENABLE_SIMPLE_AA
 	};
 
-	//渲染器类
-	template<typename Shader = ShaderDefault, size_t render_flag = RF_DEFAULT>
+	//渲染器类，Format是目标Context的颜色储存格式，void表示直接储存fs_out_t
+	template<typename Shader = ShaderDefault, size_t render_flag = RF_DEFAULT, typename Format = void>
 	class Renderer
 	{
 	private:
@@ -58,109 +61,392 @@ namespace core
 		template <typename T, typename R, typename In>
 		static R get_out_type(R(T::* f)(In)) {}
 
+		//像素着色器的输入、输出类型，只有VS没有FS的shader只输出深度
+		template <typename S, typename VsOut, typename = void>
+		struct fs_types
+		{
+			using in_t = VsOut;
+			using out_t = DepthOnly;
+		};
+		template <typename S, typename VsOut>
+		struct fs_types<S, VsOut, std::void_t<decltype(&S::FS)>>
+		{
+			using in_t = std::decay_t<decltype(get_in_type<>(std::declval<decltype(&S::FS)>()))>;
+			using out_t = std::decay_t<decltype(get_out_type<>(std::declval<decltype(&S::FS)>()))>;
+		};
+
+		//检查shader有没有提供 std::array<fs_out_t, 4> FSQuad(const fs_quad<vs_out_t>&) const
+		template <typename S, typename Q, typename = void>
+		struct has_fs_quad : std::false_type {};
+		template <typename S, typename Q>
+		struct has_fs_quad<S, Q, std::void_t<decltype(std::declval<const S&>().FSQuad(std::declval<const Q&>()))>> : std::true_type {};
+
+		//检查shader有没有提供 vs_out_t VSInstanced(const vs_in_t&, const Instance&, uint32) const
+		template <typename S, typename In, typename Instance, typename = void>
+		struct has_vs_instanced : std::false_type {};
+		template <typename S, typename In, typename Instance>
+		struct has_vs_instanced<S, In, Instance, std::void_t<decltype(std::declval<const S&>().VSInstanced(
+			std::declval<const In&>(), std::declval<const Instance&>(), uint32{}))>> : std::true_type {};
+
+		//检查Stream是不是顶点流：提供 vs_in_t Fetch(size_t) const，在取顶点时把第i个顶点解码出来
+		template <typename Stream, typename In, typename = void>
+		struct is_vertex_stream : std::false_type {};
+		template <typename Stream, typename In>
+		struct is_vertex_stream<Stream, In, std::enable_if_t<std::is_convertible_v<decltype(std::declval<const Stream&>().Fetch(size_t{})), In>>> : std::true_type {};
+
 	public:
 		using vs_in_t = std::decay_t<decltype(get_in_type<>(std::declval<decltype(&Shader::VS)>()))>; //declval是一个没有被实现的函数，它的返回值是一个T类型的引用，它仅仅应该出现在decltype中参与编译器类型推导
 		using vs_out_t = std::decay_t<decltype(get_out_type<>(std::declval<decltype(&Shader::VS)>()))>;
-		using fs_in_t = std::decay_t<decltype(get_in_type<>(std::declval<decltype(&Shader::FS)>()))>;
-		using fs_out_t = std::decay_t<decltype(get_out_type<>(std::declval<decltype(&Shader::FS)>()))>;
+		using fs_in_t = typename fs_types<Shader, vs_out_t>::in_t;
+		using fs_out_t = typename fs_types<Shader, vs_out_t>::out_t;
+		using format_t = std::conditional_t<std::is_void_v<Format>, fs_out_t, Format>;
+		using context_t = Context<fs_out_t, format_t>;
+		using format = typename context_t::format;
 
 		//断言shader的合法性,顶点着色器的输入类型必须与像素着色器的输出类型相同(可以被const修饰，可以为引用)，而且顶点着色器的输出类型必须CRTP得继承自vs_out_base，这个模板类重载了+和*，并使用sse做了加速（不过编译器好像本来就能加速这个）
 		static_assert(std::is_base_of_v<vs_out_base<vs_out_t>, vs_out_t>, "the output type of vs_shader must be inherited from vs_out_base");
 		static_assert(std::is_same_v<vs_out_t, fs_in_t>, "the output type of vs_shader must be the same as the input type of the fs_shader");
 
-		Renderer(Context<fs_out_t>& ctx, const Shader& m) :
+		Renderer(context_t& ctx, const Shader& m) :
 			context{ ctx },
-			shader{ m }
+			shader{ m },
+			batches(1)
 		{
 		}
 
 		// 通过顶点数组和索引数组绘制三角形，n为索引数组长度
-		void DrawIndex(vs_in_t* data, size_t* index, size_t n)
+		// 每个被用到的顶点只做一次顶点着色，着色结果被共享这个顶点的三角形复用
+		template<typename Index>
+		void DrawIndex(vs_in_t* data, const Index* index, size_t n)
 		{
-			for (size_t i = 0; i < n; i += 3)
-			{
-				DrawTriangle(data + index[i], data + index[i + 1], data + index[i + 2]);
-			}
+			ShadeIndexed(index, n, 1, [&](size_t i, size_t) {
+				return shader.VS(data[i]);
+			});
+			Flush();
+		}
+
+		// 从顶点流(比如压缩过的顶点)中绘制，顶点在取顶点的阶段由stream.Fetch(i)解码，解码的结果直接交给顶点着色器
+		template<typename Stream, typename Index, typename = std::enable_if_t<is_vertex_stream<Stream, vs_in_t>::value>>
+		void DrawIndex(const Stream& stream, const Index* index, size_t n)
+		{
+			ShadeIndexed(index, n, 1, [&](size_t i, size_t) {
+				return shader.VS(stream.Fetch(i));
+			});
+			Flush();
 		}
 
 		// 绘制n/3个三角形
 		void DrawTriangles(vs_in_t* data, size_t n)
 		{
-			for (size_t i = 0; i < n; i += 3)
-			{
-				DrawTriangle(data + i, data + i + 1, data + i + 2);
-			}
+			ShadeTriangles(n, 1, [&](size_t i, size_t) {
+				return shader.VS(data[i]);
+			});
+			Flush();
+		}
+
+		// 实例化绘制，同一组三角形画instance_count次，第i个实例的顶点由 shader.VSInstanced(vertex, instances[i], i) 着色
+		// 所有实例的顶点着色、图元装配和分箱都在一次draw call里完成
+		template<typename Instance>
+		void DrawInstanced(vs_in_t* data, size_t n, const Instance* instances, size_t instance_count)
+		{
+			static_assert(has_vs_instanced<Shader, vs_in_t, Instance>::value, "the shader must provide vs_out_t VSInstanced(const vs_in_t&, const Instance&, uint32) const");
+			ShadeTriangles(n, instance_count, [&](size_t i, size_t instance) {
+				return shader.VSInstanced(data[i], instances[instance], narrow_cast<uint32>(instance));
+			});
+			Flush();
+		}
+
+		// 带索引的实例化绘制
+		template<typename Index, typename Instance>
+		void DrawIndexedInstanced(vs_in_t* data, const Index* index, size_t n, const Instance* instances, size_t instance_count)
+		{
+			static_assert(has_vs_instanced<Shader, vs_in_t, Instance>::value, "the shader must provide vs_out_t VSInstanced(const vs_in_t&, const Instance&, uint32) const");
+			ShadeIndexed(index, n, instance_count, [&](size_t i, size_t instance) {
+				return shader.VSInstanced(data[i], instances[instance], narrow_cast<uint32>(instance));
+			});
+			Flush();
+		}
+
+		// 从顶点流中做带索引的实例化绘制
+		template<typename Stream, typename Index, typename Instance, typename = std::enable_if_t<is_vertex_stream<Stream, vs_in_t>::value>>
+		void DrawIndexedInstanced(const Stream& stream, const Index* index, size_t n, const Instance* instances, size_t instance_count)
+		{
+			static_assert(has_vs_instanced<Shader, vs_in_t, Instance>::value, "the shader must provide vs_out_t VSInstanced(const vs_in_t&, const Instance&, uint32) const");
+			ShadeIndexed(index, n, instance_count, [&](size_t i, size_t instance) {
+				return shader.VSInstanced(stream.Fetch(i), instances[instance], narrow_cast<uint32>(instance));
+			});
+			Flush();
 		}
 
 		// 绘制一个三角形
 		void DrawTriangle(vs_in_t* p0, vs_in_t* p1, vs_in_t* p2)
 		{
-			if constexpr (bool(render_flag & RF_CULL_CVV_SIMPLE))
+			ProcessTriangle(batches[0], p0, p1, p2);
+			Flush();
+		}
+
+		//统计信息(在Renderer的生命周期内累计)，用来观察顶点复用的情况
+		struct Statistics
+		{
+			size_t vertices_submitted = 0;	//提交的顶点(索引)数
+			size_t vs_invocations = 0;		//顶点着色器的调用次数
+			size_t triangles_submitted = 0;	//提交的三角形数
+			size_t triangles_clipped = 0;	//需要做几何裁剪的三角形数
+			size_t triangles_setup = 0;		//经过裁剪和剔除之后进入光栅化的三角形数
+		};
+
+		const Statistics& GetStatistics() const noexcept
+		{
+			return statistics;
+		}
+
+		void ResetStatistics() noexcept
+		{
+			statistics = {};
+		}
+
+	protected:
+		//索引绘制的顶点着色 => 图元装配，vs(i, instance)是第instance个实例的第i个顶点的着色结果
+		template<typename Index, typename VertexShader>
+		void ShadeIndexed(const Index* index, size_t n, size_t instance_count, VertexShader&& vs)
+		{
+			if (n < 3 || instance_count == 0)
 			{
-				//本地空间 => 裁剪空间 clip space
-				vs_out_t triangle[3] = {
-					{ shader.VS(*p0) },
-					{ shader.VS(*p1) },
-					{ shader.VS(*p2) }
-				};
-				//简单CVV剔除
-				if (SimpleCull(triangle)) return;
-				RasterizeTriangle(triangle, triangle + 1, triangle + 2);
+				return;
 			}
-			else if constexpr (bool(render_flag & RF_CULL_CVV_CLIP)) {
-				//本地空间 => 裁剪空间 clip space
-				vs_out_t triangle[8] = {
-					{ shader.VS(*p0) },
-					{ shader.VS(*p1) },
-					{ shader.VS(*p2) }
-				};
-				//CVV剔除
-				if (CVVCull(triangle)) return;
-				//CVV裁剪
-				vs_out_t polygon[8] = {};
-				size_t len = CVVClip(triangle, polygon);
-				if (len < 3)
+
+			//找出用到的顶点范围
+			size_t first = index[0];
+			size_t last = index[0];
+			for (size_t i = 1; i < n; ++i)
+			{
+				first = (std::min)(first, (size_t)index[i]);
+				last = (std::max)(last, (size_t)index[i]);
+			}
+
+			//标记用到的顶点
+			const size_t count = last - first + 1;
+			size_t used_count = 0;
+			vertex_used.assign(count, 0);
+			for (size_t i = 0; i < n; ++i)
+			{
+				uint8& used = vertex_used[index[i] - first];
+				used_count += !used;
+				used = 1;
+			}
+
+			//本地空间 => 裁剪空间 clip space, 每个实例的每个顶点只算一次
+			vertex_cache.resize(count * instance_count);
+			const int vertex_count = narrow_cast<int>(count * instance_count);
+#pragma omp parallel for
+			for (int k = 0; k < vertex_count; ++k)
+			{
+				const size_t i = k % count;
+				if (vertex_used[i])
 				{
-					return;
+					vertex_cache[k] = vs(first + i, k / count);
 				}
+			}
+			statistics.vs_invocations += used_count * instance_count;
+			statistics.vertices_submitted += n * instance_count;
+
+			const size_t triangle_count = n / 3;
+			AssembleTriangles(triangle_count * instance_count, [&](size_t t, vs_out_t** v) {
+				const size_t i = t % triangle_count * 3;
+				const size_t base = t / triangle_count * count;
+				v[0] = &vertex_cache[base + (index[i] - first)];
+				v[1] = &vertex_cache[base + (index[i + 1] - first)];
+				v[2] = &vertex_cache[base + (index[i + 2] - first)];
+			});
+		}
 
-				//渲染第一个三角形
-				RasterizeTriangle(polygon, polygon + 1, polygon + 2);
+		//非索引绘制的顶点着色 => 图元装配，整个draw call的顶点先并行地算完，放到连续的数组里
+		template<typename VertexShader>
+		void ShadeTriangles(size_t n, size_t instance_count, VertexShader&& vs)
+		{
+			n -= n % 3;
+
+			//本地空间 => 裁剪空间 clip space
+			vertex_cache.resize(n * instance_count);
+			const int vertex_count = narrow_cast<int>(n * instance_count);
+#pragma omp parallel for
+			for (int k = 0; k < vertex_count; ++k)
+			{
+				vertex_cache[k] = vs(k % n, k / n);
+			}
+			statistics.vs_invocations += n * instance_count;
+			statistics.vertices_submitted += n * instance_count;
+
+			AssembleTriangles(n / 3 * instance_count, [&](size_t t, vs_out_t** v) {
+				v[0] = &vertex_cache[t * 3];
+				v[1] = &vertex_cache[t * 3 + 1];
+				v[2] = &vertex_cache[t * 3 + 2];
+			});
+		}
 
-				//渲染后面的三角形
-				for (size_t i = 3; i < len; ++i)
+		//是否只输出深度(shader没有FS)，只做深度测试和写入，不调用FS，也没有颜色buffer
+		static constexpr bool is_depth_only = std::is_same_v<fs_out_t, DepthOnly>;
+		//是否使用简单抗锯齿(只支持颜色buffer)
+		static constexpr bool is_aa = bool(render_flag & RF_ENABLE_SIMPLE_AA) && std::is_same_v<Color, fs_out_t>;
+		//是否以quad为单位着色
+		static constexpr bool is_quad = bool(render_flag & RF_ENABLE_QUAD_SHADING) && !is_aa && !is_depth_only;
+		//tile的边长(像素)
+		static constexpr int tile_size = 64;
+
+		//屏幕上的一个矩形区域[x0, x1) x [y0, y1)
+		struct TileRect
+		{
+			int x0;
+			int y0;
+			int x1;
+			int y1;
+		};
+
+		//已经完成裁剪、剔除和屏幕映射，等待光栅化的三角形
+		struct ScreenTriangle
+		{
+			Vec2 p[3];			//屏幕坐标
+			size_t vertex;		//三个顶点在所在批的vertex_pool中的起始位置
+			vs_out_t* v;		//三个顶点的地址，Flush时所有的批都装配完了才填
+			TileRect bbox;		//屏幕上的包围盒（已经被视口裁剪）
+		};
+
+		//一批三角形经过图元装配、裁剪、三角形设置之后的结果，分块模式下不同的批在不同的线程中处理
+		struct Batch
+		{
+			std::vector<vs_out_t> vertex_pool; //等待光栅化的三角形的顶点
+			std::vector<ScreenTriangle> triangles; //等待光栅化的三角形
+			Statistics statistics; //这一批的统计信息，Flush时合并
+		};
+
+		//每批的三角形数量
+		static constexpr size_t batch_size = 1024;
+
+		//图元装配 => CVV剔除/裁剪 => 三角形设置，fetch(i, v)取出第i个三角形的三个顶点
+		//分块模式下按批并行，每批的结果单独保存，Flush时按批的顺序分箱，所以光栅化的顺序和提交的顺序一致
+		template<typename Fetch>
+		void AssembleTriangles(size_t triangle_count, Fetch&& fetch)
+		{
+			if constexpr (bool(render_flag & RF_ENABLE_TILE_BINNING))
+			{
+				const size_t batch_count = (triangle_count + batch_size - 1) / batch_size;
+				if (batches.size() < batch_count)
+				{
+					batches.resize(batch_count);
+				}
+
+				const int count = narrow_cast<int>(batch_count);
+#pragma omp parallel for schedule(dynamic)
+				for (int b = 0; b < count; ++b)
+				{
+					Batch& batch = batches[b];
+					const size_t end = (std::min)((b + 1) * batch_size, triangle_count);
+					for (size_t i = b * batch_size; i < end; ++i)
+					{
+						vs_out_t* v[3];
+						fetch(i, v);
+						ClipTriangle(batch, v[0], v[1], v[2]);
+					}
+				}
+			}
+			else
+			{
+				//非分块模式下三角形设置完马上就光栅化，只能按顺序来
+				for (size_t i = 0; i < triangle_count; ++i)
 				{
-					RasterizeTriangle(polygon, polygon + i - 1, polygon + i);
+					vs_out_t* v[3];
+					fetch(i, v);
+					ClipTriangle(batches[0], v[0], v[1], v[2]);
 				}
 			}
+		}
+
+		//顶点着色 => CVV剔除/裁剪 => 三角形设置
+		void ProcessTriangle(Batch& out, vs_in_t* p0, vs_in_t* p1, vs_in_t* p2)
+		{
+			//本地空间 => 裁剪空间 clip space
+			vs_out_t triangle[3] = {
+				{ shader.VS(*p0) },
+				{ shader.VS(*p1) },
+				{ shader.VS(*p2) }
+			};
+			statistics.vs_invocations += 3;
+			statistics.vertices_submitted += 3;
+			ClipTriangle(out, triangle, triangle + 1, triangle + 2);
+		}
+
+		//CVV剔除/裁剪 => 三角形设置
+		void ClipTriangle(Batch& out, vs_out_t* p0, vs_out_t* p1, vs_out_t* p2)
+		{
+			++out.statistics.triangles_submitted;
+			if constexpr (bool(render_flag & RF_CULL_CVV_SIMPLE))
+			{
+				vs_out_t* triangle[3] = { p0, p1, p2 };
+				//简单CVV剔除
+				if (SimpleCull(triangle)) return;
+				SetupTriangle(out, p0, p1, p2);
+			}
+			else if constexpr (bool(render_flag & RF_CULL_CVV_CLIP)) {
+				vs_out_t* const vertices[3] = { p0, p1, p2 };
+				//CVV剔除
+				if (CVVCull(vertices)) return;
+
+				//只需要和三个顶点中至少有一个在外侧的平面做裁剪，都在内侧的话直接光栅化
+				ClipAndSetupTriangle(out, p0, p1, p2, GetOutCode(p0) | GetOutCode(p1) | GetOutCode(p2));
+			}
 			else {
-				//本地空间 => 裁剪空间 clip space
-				vs_out_t triangle[3] = {
-					{ shader.VS(*p0) },
-					{ shader.VS(*p1) },
-					{ shader.VS(*p2) }
-				};
-				RasterizeTriangle(triangle, triangle + 1, triangle + 2);
+				//不做CVV裁剪时也要保证顶点在定点数光栅化能表示的范围内，w太小或者超出保护带的三角形还是要裁剪
+				ClipAndSetupTriangle(out, p0, p1, p2, (GetOutCode(p0) | GetOutCode(p1) | GetOutCode(p2)) & raster_range_planes);
 			}
 		}
-	protected:
 
-		void RasterizeTriangle(vs_out_t* p0, vs_out_t* p1, vs_out_t* p2)
+		//和planes中标记的平面做裁剪，再对裁剪出来的多边形做三角形设置，planes为0时直接做三角形设置
+		void ClipAndSetupTriangle(Batch& out, vs_out_t* p0, vs_out_t* p1, vs_out_t* p2, int planes)
 		{
+			if (planes == 0)
+			{
+				SetupTriangle(out, p0, p1, p2);
+				return;
+			}
+			++out.statistics.triangles_clipped;
+
+			//CVV裁剪，每个平面最多增加一个顶点
+			vs_out_t triangle[10] = { *p0, *p1, *p2 };
+			vs_out_t temp[10];
+			size_t len = 3;
+			vs_out_t* polygon = CVVClip(triangle, temp, len, planes);
+			if (len < 3)
+			{
+				return;
+			}
+
+			//第一个三角形
+			SetupTriangle(out, polygon, polygon + 1, polygon + 2);
+
+			//后面的三角形
+			for (size_t i = 3; i < len; ++i)
+			{
+				SetupTriangle(out, polygon, polygon + i - 1, polygon + i);
+			}
+		}
+
+		//三角形设置：屏幕映射、背面剔除、计算包围盒；分块模式下把三角形存起来等Flush，否则直接光栅化
+		void SetupTriangle(Batch& out, vs_out_t* p0, vs_out_t* p1, vs_out_t* p2)
+		{
+			ScreenTriangle tri{};
+
 			//获得ndc下的三角形三个顶点 (clip space => ndc)
-			Vec2 p[3] = {
-				p0->position / p0->position.w,
-				p1->position / p1->position.w,
-				p2->position / p2->position.w,
-			};
+			tri.p[0] = p0->position / p0->position.w;
+			tri.p[1] = p1->position / p1->position.w;
+			tri.p[2] = p2->position / p2->position.w;
 
 			//转化为屏幕坐标 screen space
-			NDCToScreenSpace(p, 3);
+			NDCToScreenSpace(tri.p, 3);
 
 			if constexpr (bool(render_flag & RF_CULL_BACK))
 			{
 				//剔除背面
-				if (IsBackface(p))
+				if (IsBackface(tri.p))
 				{
 					return;
 				}
@@ -168,7 +454,7 @@ namespace core
 			if constexpr (bool(render_flag & RF_CULL_FRONT))
 			{
 				//剔除前面
-				if (!IsBackface(p))
+				if (!IsBackface(tri.p))
 				{
 					return;
 				}
@@ -177,7 +463,7 @@ namespace core
 			//生成AABB包围盒
 			float left = inf, right = -inf, top = -inf, bottom = inf;
 
-			for (const auto& q : p) {
+			for (const auto& q : tri.p) {
 				if (left > q.x)
 				{
 					left = q.x;
@@ -197,74 +483,776 @@ namespace core
 				}
 			}
 
-			//对三个顶点按y坐标从高到底进行排序
+			using gmath::utility::Clamp;
+			const float w = (float)context.back_buffer_view.w;
+			const float h = (float)context.back_buffer_view.h;
+			tri.bbox.x0 = (int)Clamp(left, 0.f, w);
+			tri.bbox.x1 = (int)Clamp(right + 1.f, 0.f, w);
+			tri.bbox.y0 = (int)Clamp(bottom, 0.f, h);
+			tri.bbox.y1 = (int)Clamp(top + 1.f, 0.f, h);
+
+			if (tri.bbox.x0 >= tri.bbox.x1 || tri.bbox.y0 >= tri.bbox.y1)
+			{
+				return;
+			}
+			++out.statistics.triangles_setup;
+
+			if constexpr (bool(render_flag & RF_ENABLE_TILE_BINNING))
+			{
+				//顶点复制到顶点池中，等Flush的时候再光栅化
+				tri.vertex = out.vertex_pool.size();
+				out.vertex_pool.push_back(*p0);
+				out.vertex_pool.push_back(*p1);
+				out.vertex_pool.push_back(*p2);
+				out.triangles.push_back(tri);
+			}
+			else
+			{
+				RasterizeTriangle(tri.p, p0, p1, p2, tri.bbox);
+			}
+		}
 
-			Vec2 q[3] = { p[0],p[1],p[2] };
+		//分块模式下，把draw call中的三角形分到tile里，每个线程负责一个tile，tile内按提交顺序光栅化，所以混合和深度测试的结果是确定的
+		void Flush()
+		{
+			//合并每一批的统计信息
+			bool empty = true;
+			for (Batch& batch : batches)
+			{
+				statistics.triangles_submitted += batch.statistics.triangles_submitted;
+				statistics.triangles_clipped += batch.statistics.triangles_clipped;
+				statistics.triangles_setup += batch.statistics.triangles_setup;
+				batch.statistics = {};
+				empty = empty && batch.triangles.empty();
+			}
 
-			for (size_t i = 0; i < 2; ++i)
+			if constexpr (bool(render_flag & RF_ENABLE_TILE_BINNING))
 			{
-				for (size_t j = i; j < 3; ++j)
+				if (empty)
+				{
+					return;
+				}
+
+				const int tile_nx = narrow_cast<int>((context.back_buffer_view.w + tile_size - 1) / tile_size);
+				const int tile_ny = narrow_cast<int>((context.back_buffer_view.h + tile_size - 1) / tile_size);
+				bins.resize((size_t)tile_nx * tile_ny);
+
+				//分箱(binning)，按批的顺序遍历，每个bin中三角形的顺序就是提交的顺序
+				for (Batch& batch : batches)
 				{
-					if (q[i].y < q[j].y)
+					for (ScreenTriangle& tri : batch.triangles)
 					{
-						Vec2 temq = q[j];
-						q[j] = q[i];
-						q[i] = temq;
+						tri.v = &batch.vertex_pool[tri.vertex];
+						const TileRect& bbox = tri.bbox;
+						const int tx0 = bbox.x0 / tile_size;
+						const int tx1 = (bbox.x1 - 1) / tile_size;
+						const int ty0 = bbox.y0 / tile_size;
+						const int ty1 = (bbox.y1 - 1) / tile_size;
+						for (int ty = ty0; ty <= ty1; ++ty)
+						{
+							for (int tx = tx0; tx <= tx1; ++tx)
+							{
+								bins[(size_t)ty * tile_nx + tx].push_back(&tri);
+							}
+						}
 					}
 				}
+
+				//每个tile只会被一个线程访问，不需要加锁
+				const int tile_count = tile_nx * tile_ny;
+#pragma omp parallel for schedule(dynamic)
+				for (int t = 0; t < tile_count; ++t)
+				{
+					auto& bin = bins[t];
+					if (bin.empty())
+					{
+						continue;
+					}
+
+					const int tx = t % tile_nx;
+					const int ty = t / tile_nx;
+					const TileRect tile = {
+						tx * tile_size,
+						ty * tile_size,
+						(std::min)((tx + 1) * tile_size, (int)context.back_buffer_view.w),
+						(std::min)((ty + 1) * tile_size, (int)context.back_buffer_view.h)
+					};
+
+					for (ScreenTriangle* tri : bin)
+					{
+						vs_out_t* v = tri->v;
+						RasterizeTriangle(tri->p, v, v + 1, v + 2, Intersect(tri->bbox, tile));
+					}
+					bin.clear();
+				}
+
+				for (Batch& batch : batches)
+				{
+					batch.triangles.clear();
+					batch.vertex_pool.clear();
+				}
 			}
-			using gmath::utility::Clamp;
-			int y1 = (int)Clamp(q[2].y, 1.f, context.back_buffer_view.h - 1.f);
-			int y2 = (int)Clamp(q[0].y, 1.f, context.back_buffer_view.h - 1.f);
+		}
 
-			//其实仔细想想，用一次循环来扫描行，并不是很高效，用标准做法分解成上下2个3角形效率更高一点，因为不用再循环里判断点到底与那条直线相交了，不过好歹是我自己想出来的，所以保留了
-			//从上到下扫描
-#pragma omp parallel for num_threads(6)
-			for (int y = y2; y >= y1; --y)
+		static TileRect Intersect(const TileRect& a, const TileRect& b)
+		{
+			return {
+				(std::max)(a.x0, b.x0),
+				(std::max)(a.y0, b.y0),
+				(std::min)(a.x1, b.x1),
+				(std::min)(a.y1, b.y1)
+			};
+		}
+
+		//定点数的小数位数，顶点坐标会被吸附到1/256像素的网格上
+		static constexpr int subpixel_bits = 8;
+		//定点数下顶点坐标允许的最大绝对值(像素)，防止边函数溢出int64
+		//CVV裁剪和保护带保证了顶点不会超出这个范围(视口小于65536像素时)，只有坐标是NaN的三角形会在光栅化时被丢弃
+		static constexpr float max_raster_coord = float(1 << 19);
+		//块的边长(像素)，光栅化以块为单位做整体的接受/拒绝，和Hi-Z的块大小一致
+		static constexpr int block_size = (int)context_t::hiz_block_size;
+
+		//三角形三条边的边函数(edge function), E_i(x,y) = e[i] + x * dx[i] + y * dy[i], x,y是像素坐标，第i条边是顶点i的对边
+		struct EdgeSetup
+		{
+			int64 e[3];	//像素(0,0)中心处的值
+			int64 dx[3];	//x方向步进一个像素的增量
+			int64 dy[3];	//y方向步进一个像素的增量
+			Vec3 inv_w;		//三个顶点的1/w，用来做透视修复
+			float z_min;	//三角形上最小的深度，用来和Hi-Z比较
+			int samples;	//每个像素的采样点数量
+			int64 sample_e[8][3];	//采样点相对像素中心的边函数增量
+			float sample_z[8];	//采样点相对像素中心的深度增量
+			Vec3 z_plane;	//深度 = E_0 * z_plane.x + E_1 * z_plane.y + E_2 * z_plane.z
+			vs_out_t attr;	//属性/w的平面方程: 像素(ref_x,ref_y)中心处的值
+			vs_out_t attr_dx;	//属性/w在x方向步进一个像素的增量
+			vs_out_t attr_dy;	//属性/w在y方向步进一个像素的增量
+			Vec3 rcp_w;	//1/w的平面方程: (像素(ref_x,ref_y)中心处的值, x方向增量, y方向增量)
+			int ref_x;	//平面方程的原点，取顶点0所在的像素，原点离三角形太远的话，细长三角形的平面方程外推过去会丢失精度
+			int ref_y;
+		};
+
+		static int64 ToFixed(float v)
+		{
+			return (int64)floor(v * (1 << subpixel_bits) + 0.5f);
+		}
+
+		//光栅化三角形，只处理rect以内的像素
+		//用定点数边函数判断覆盖，以8x8的块为单位分类：整块在三角形外直接跳过，整块在三角形内则跳过逐像素的覆盖测试
+		//Context开了MSAA时，每个采样点单独判断覆盖和做深度测试，但每个像素只着色一次
+		void RasterizeTriangle(Vec2* p, vs_out_t* p0, vs_out_t* p1, vs_out_t* p2, const TileRect& rect)
+		{
+			for (size_t i = 0; i < 3; ++i)
 			{
-				//隔行扫描，就是奇数帧扫描奇数行，偶数帧扫描偶数行，按理说能节省一半着色开销
-				//if (((size_t)y & 1) == context.interlaced_scanning_flag) continue;
+				if (!(fabs(p[i].x) < max_raster_coord && fabs(p[i].y) < max_raster_coord))
+				{
+					return;
+				}
+			}
 
-				//计算出直线 y = y 与 三角形相交2点的x坐标
-				//float k = (q[2].y - q[0].y) / (q[2].x - q[0].x);
-				//float b = q[0].y - k * q[0].x;
-				//float x1 = ((float)y - b) / k;
+			Vec2 tri[3] = { p[0], p[1], p[2] };
+			vs_out_t* v[3] = { p0, p1, p2 };
+			int64 fx[3] = { ToFixed(tri[0].x), ToFixed(tri[1].x), ToFixed(tri[2].x) };
+			int64 fy[3] = { ToFixed(tri[0].y), ToFixed(tri[1].y), ToFixed(tri[2].y) };
 
-				//直接把点带入直线方程
-				float x1 = ((float)y + 0.5f - q[0].y) * (q[2].x - q[0].x) / (q[2].y - q[0].y) + q[0].x;
-				float x2 = 0;
+			//统一成逆时针，这样三角形内部的边函数都是正的
+			int64 area = (fx[1] - fx[0]) * (fy[2] - fy[0]) - (fy[1] - fy[0]) * (fx[2] - fx[0]);
+			if (area == 0)
+			{
+				return;
+			}
+			if (area < 0)
+			{
+				std::swap(fx[1], fx[2]);
+				std::swap(fy[1], fy[2]);
+				std::swap(tri[1], tri[2]);
+				std::swap(v[1], v[2]);
+			}
 
-				if (y > q[1].y - 0.5f)
+			EdgeSetup es{};
+			es.samples = (int)context.sample_count;
+			const bool msaa = es.samples > 1;
+			constexpr int64 half = 1LL << (subpixel_bits - 1);
+			for (size_t i = 0; i < 3; ++i)
+			{
+				const size_t a = (i + 1) % 3;
+				const size_t b = (i + 2) % 3;
+				const int64 ex = fx[b] - fx[a];
+				const int64 ey = fy[b] - fy[a];
+				//E(P) = ex * (P.y - a.y) - ey * (P.x - a.x)
+				es.dx[i] = -ey << subpixel_bits;
+				es.dy[i] = ex << subpixel_bits;
+				es.e[i] = ex * (half - fy[a]) - ey * (half - fx[a]);
+
+				if (is_aa && !msaa)
 				{
-					x2 = ((float)y + 0.5f - q[0].y) * (q[1].x - q[0].x) / (q[1].y - q[0].y) + q[0].x;
+					//抗锯齿需要处理中心不在三角形内、但被部分覆盖的像素，所以把边向外推半个像素
+					es.e[i] += (std::abs(es.dx[i]) + std::abs(es.dy[i])) / 2;
 				}
 				else
 				{
-					x2 = ((float)y + 0.5f - q[1].y) * (q[2].x - q[1].x) / (q[2].y - q[1].y) + q[1].x;
+					//top-left规则：落在边上的像素中心，只有在左边或上边时才算在三角形内，保证相邻三角形的公共边不重复也不遗漏
+					const bool top_left = ey < 0 || (ey == 0 && ex < 0);
+					if (!top_left)
+					{
+						es.e[i] -= 1;
+					}
 				}
+			}
+			es.inv_w = { 1.f / v[0]->position.w, 1.f / v[1]->position.w, 1.f / v[2]->position.w };
 
-				x1 = Clamp(x1, 1.f, (float)context.back_buffer_view.w - 2.f);
-				x2 = Clamp(x2, 1.f, (float)context.back_buffer_view.w - 2.f);
+			//z/w在屏幕空间是线性的，所以三角形上的最小深度就是三个顶点里最小的
+			es.z_min = -inf;
+			if (v[0]->position.w > 0 && v[1]->position.w > 0 && v[2]->position.w > 0)
+			{
+				es.z_min = (std::min)({
+					v[0]->position.z * es.inv_w.x,
+					v[1]->position.z * es.inv_w.y,
+					v[2]->position.z * es.inv_w.z
+					});
+			}
 
-				if (x1 > x2)
+			//采样点的边函数和深度相对像素中心的增量，边函数和z/w在屏幕空间都是线性的
+			const int(*pattern)[2] = context.GetSamplePattern();
+			const double edge_sum = (double)(es.e[0] + es.e[1] + es.e[2]); //三个边函数之和是常数(两倍的面积)
+			const float vertex_z[3] = {
+				v[0]->position.z * es.inv_w.x,
+				v[1]->position.z * es.inv_w.y,
+				v[2]->position.z * es.inv_w.z
+			};
+			for (int s = 0; s < es.samples; ++s)
+			{
+				double z = 0;
+				for (size_t i = 0; i < 3; ++i)
+				{
+					//偏移的单位是1/16像素，dx,dy是一个像素的增量，可以被16整除
+					es.sample_e[s][i] = (es.dx[i] * pattern[s][0] + es.dy[i] * pattern[s][1]) / 16;
+					z += (double)es.sample_e[s][i] * vertex_z[i];
+				}
+				es.sample_z[s] = es.z_min > -inf ? (float)(z / edge_sum) : 0.f;
+			}
+			es.z_plane = {
+				(float)(vertex_z[0] / edge_sum),
+				(float)(vertex_z[1] / edge_sum),
+				(float)(vertex_z[2] / edge_sum)
+			};
+
+			if constexpr (!is_depth_only)
+			{
+				//属性/w和1/w在屏幕空间都是线性的，在这里求出它们的平面方程，
+				//逐像素只需要沿着扫描线增量计算再乘上w，不用每个像素都对三个顶点的vs_out_t做插值
+				const float inv_w[3] = { es.inv_w.x, es.inv_w.y, es.inv_w.z };
+				es.ref_x = (int)floor(tri[0].x);
+				es.ref_y = (int)floor(tri[0].y);
+				for (size_t i = 0; i < 3; ++i)
+				{
+					const double k = inv_w[i] / edge_sum;
+					const int64 e_ref = es.e[i] + es.ref_x * es.dx[i] + es.ref_y * es.dy[i];
+					const float c = (float)((double)e_ref * k);
+					const float cx = (float)((double)es.dx[i] * k);
+					const float cy = (float)((double)es.dy[i] * k);
+					es.attr.MulAdd(*v[i], c);
+					es.attr_dx.MulAdd(*v[i], cx);
+					es.attr_dy.MulAdd(*v[i], cy);
+					es.rcp_w += Vec3{ c, cx, cy };
+				}
+			}
+
+			const int bx0 = rect.x0 & ~(block_size - 1);
+			const int by0 = rect.y0 & ~(block_size - 1);
+
+			if constexpr (bool(render_flag & RF_ENABLE_TILE_BINNING))
+			{
+				//分块模式下已经是在tile的线程里了，按顺序处理块
+				for (int by = by0; by < rect.y1; by += block_size)
+				{
+					for (int bx = bx0; bx < rect.x1; bx += block_size)
+					{
+						RasterizeBlockAt(bx, by, rect, es, tri, v);
+					}
+				}
+			}
+			else
+			{
+				//非分块模式下按块行并行
+#pragma omp parallel for
+				for (int by = by0; by < rect.y1; by += block_size)
+				{
+					for (int bx = bx0; bx < rect.x1; bx += block_size)
+					{
+						RasterizeBlockAt(bx, by, rect, es, tri, v);
+					}
+				}
+			}
+		}
+
+		//光栅化左上角在(bx,by)的块，先对整个块分类，再做Hi-Z剔除
+		void RasterizeBlockAt(int bx, int by, const TileRect& rect, const EdgeSetup& es, Vec2* tri, vs_out_t** v)
+		{
+			const bool msaa = es.samples > 1;
+
+			//用块的四个角上的像素中心来分类，边函数是线性的，所以极值一定在角上
+			bool inside = true;
+			bool outside = false;
+			for (size_t i = 0; i < 3; ++i)
+			{
+				const int64 e = es.e[i] + bx * es.dx[i] + by * es.dy[i];
+				const int64 ox = es.dx[i] * (block_size - 1);
+				const int64 oy = es.dy[i] * (block_size - 1);
+				//MSAA时采样点离像素中心不超过半个像素
+				const int64 margin = msaa ? (std::abs(es.dx[i]) + std::abs(es.dy[i])) / 2 : 0;
+				const int64 e_min = e + (std::min)(ox, 0LL) + (std::min)(oy, 0LL) - margin;
+				const int64 e_max = e + (std::max)(ox, 0LL) + (std::max)(oy, 0LL) + margin;
+				if (e_max < 0)
 				{
-					float temq = x1;
-					x1 = x2;
-					x2 = temq;
+					outside = true;
+					break;
 				}
-				if (x1 - x2 < epsilon)
+				if (e_min < 0)
 				{
-					x1 = left;
-					x2 = right;
+					inside = false;
 				}
-				int start = (int)x1;
-				int end = (int)x2;
+			}
 
-				for (int x = start; x <= end; ++x)
+			if (outside)
+			{
+				return;
+			}
+
+			if constexpr (bool(render_flag & RF_ENABLE_DEPTH_TEST))
+			{
+				//Hi-Z剔除，三角形最近的地方都比块中最远的像素远，整块都不会通过深度测试
+				if (es.z_min > context.GetHiZ(bx / block_size, by / block_size))
 				{
-					PixelProcessing(x, y, p, p0, p1, p2);
+					return;
 				}
 			}
+
+			//块第一次被写，先写入延后的清除值
+			context.PrepareBlock(bx / block_size, by / block_size);
+			if constexpr (std::is_same_v<Color, fs_out_t> && bool(render_flag & RF_ENABLE_BLEND))
+			{
+				if (context.oit_active)
+				{
+					context.PrepareOITBlock(bx / block_size, by / block_size);
+				}
+			}
+
+			const TileRect block = Intersect({ bx, by, bx + block_size, by + block_size }, rect);
+			if (inside)
+			{
+				RasterizeBlock<true>(block, es, tri, v);
+			}
+			else
+			{
+				RasterizeBlock<false>(block, es, tri, v);
+			}
+		}
+
+		//沿着扫描线增量地计算属性，只在被覆盖的像素上步进到当前位置，所以行内不连续的像素也只需要一次乘加
+		struct AttributeSpan
+		{
+			vs_out_t row;	//当前行起点的属性/w
+			vs_out_t attr;	//当前行x_attr处的属性/w
+			vs_out_t interp;	//透视修复后的插值结果
+			float rcp_w_row;	//当前行起点的1/w
+			int x0;
+			int x_attr;
+
+			AttributeSpan(const EdgeSetup& es, int x, int y) : row(es.attr), x0(x)
+			{
+				row.MulAdd(es.attr_dx, (float)(x - es.ref_x)).MulAdd(es.attr_dy, (float)(y - es.ref_y));
+				rcp_w_row = es.rcp_w.x + (x - es.ref_x) * es.rcp_w.y + (y - es.ref_y) * es.rcp_w.z;
+				attr = row;
+				x_attr = x0;
+			}
+
+			//像素(x, 当前行)中心处的插值结果，x不能比上一次调用的小
+			const vs_out_t& At(int x, const EdgeSetup& es)
+			{
+				if (x != x_attr)
+				{
+					attr.MulAdd(es.attr_dx, (float)(x - x_attr));
+					x_attr = x;
+				}
+				interp = attr;
+				interp *= 1.f / (rcp_w_row + (x - x0) * es.rcp_w.y);
+				return interp;
+			}
+
+			void NextRow(const EdgeSetup& es)
+			{
+				row.MulAdd(es.attr_dy, 1.f);
+				rcp_w_row += es.rcp_w.z;
+				attr = row;
+				x_attr = x0;
+			}
+		};
+
+		//光栅化一个块，full为true表示整个块都在三角形内，不需要逐像素测试覆盖
+		template<bool full>
+		void RasterizeBlock(const TileRect& block, const EdgeSetup& es, Vec2* tri, vs_out_t** v)
+		{
+			if constexpr (is_depth_only)
+			{
+				RasterizeBlockDepth<full>(block, es);
+			}
+			else if constexpr (is_quad)
+			{
+				RasterizeBlockQuad<full>(block, es);
+			}
+			else
+			{
+				if (es.samples > 1)
+				{
+					RasterizeBlockMSAA<full>(block, es);
+				}
+				else
+				{
+					RasterizeBlockColor<full>(block, es, tri, v);
+				}
+			}
+		}
+
+		//逐像素着色地光栅化一个块
+		template<bool full>
+		void RasterizeBlockColor(const TileRect& block, const EdgeSetup& es, Vec2* tri, vs_out_t** v)
+		{
+			int64 e_row[3] = {
+				es.e[0] + block.x0 * es.dx[0] + block.y0 * es.dy[0],
+				es.e[1] + block.x0 * es.dx[1] + block.y0 * es.dy[1],
+				es.e[2] + block.x0 * es.dx[2] + block.y0 * es.dy[2]
+			};
+			AttributeSpan span(es, block.x0, block.y0);
+
+			for (int y = block.y0; y < block.y1; ++y)
+			{
+				int64 e[3] = { e_row[0], e_row[1], e_row[2] };
+				for (int x = block.x0; x < block.x1; ++x)
+				{
+					if (full || (e[0] | e[1] | e[2]) >= 0)
+					{
+						if constexpr (is_aa)
+						{
+							PixelProcessing_AA(x, y, tri, v[0], v[1], v[2]);
+						}
+						else
+						{
+							PixelProcessing_NoAA(x, y, span.At(x, es));
+						}
+					}
+					e[0] += es.dx[0];
+					e[1] += es.dx[1];
+					e[2] += es.dx[2];
+				}
+				e_row[0] += es.dy[0];
+				e_row[1] += es.dy[1];
+				e_row[2] += es.dy[2];
+				span.NextRow(es);
+			}
+
+			if constexpr (bool(render_flag & RF_ENABLE_DEPTH_TEST))
+			{
+				//通过深度测试的像素深度只会变小，原来的Hi-Z值依然是保守的，先标记，用到的时候再更新
+				context.MarkHiZDirty(block.x0 / block_size, block.y0 / block_size);
+			}
+		}
+		//只写深度地光栅化一个块，z/w在屏幕空间是线性的，直接用边函数插值，不需要透视修复，也不需要插值其他属性
+		template<bool full>
+		void RasterizeBlockDepth(const TileRect& block, const EdgeSetup& es)
+		{
+			const int all_samples = (1 << es.samples) - 1;
+			int64 e_row[3] = {
+				es.e[0] + block.x0 * es.dx[0] + block.y0 * es.dy[0],
+				es.e[1] + block.x0 * es.dx[1] + block.y0 * es.dy[1],
+				es.e[2] + block.x0 * es.dx[2] + block.y0 * es.dy[2]
+			};
+
+			for (int y = block.y0; y < block.y1; ++y)
+			{
+				int64 e[3] = { e_row[0], e_row[1], e_row[2] };
+				for (int x = block.x0; x < block.x1; ++x)
+				{
+					const int coverage = full ? all_samples : GetCoverage(e, es);
+					if (coverage)
+					{
+						const float depth = (float)e[0] * es.z_plane.x + (float)e[1] * es.z_plane.y + (float)e[2] * es.z_plane.z;
+						const int pass = DepthTest(x, y, coverage, depth, es);
+						if constexpr (bool(render_flag & RF_ENABLE_DEPTH_TEST))
+						{
+							float* depth0 = context.GetSampleDepths(x, y);
+							for (int s = 0; s < es.samples; ++s)
+							{
+								if (pass >> s & 1)
+								{
+									depth0[s] = depth + es.sample_z[s];
+								}
+							}
+						}
+					}
+					e[0] += es.dx[0];
+					e[1] += es.dx[1];
+					e[2] += es.dx[2];
+				}
+				e_row[0] += es.dy[0];
+				e_row[1] += es.dy[1];
+				e_row[2] += es.dy[2];
+			}
+
+			if constexpr (bool(render_flag & RF_ENABLE_DEPTH_TEST))
+			{
+				context.MarkHiZDirty(block.x0 / block_size, block.y0 / block_size);
+			}
+		}
+
+		//以2x2的quad为单位光栅化一个块，块的起点是8对齐的，所以quad不会跨块
+		template<bool full>
+		void RasterizeBlockQuad(const TileRect& block, const EdgeSetup& es)
+		{
+			//quad中四个像素相对左上角的偏移
+			constexpr int qx[4] = { 0, 1, 0, 1 };
+			constexpr int qy[4] = { 0, 0, 1, 1 };
+
+			const int x0 = block.x0 & ~1;
+			const int y0 = block.y0 & ~1;
+			for (int y = y0; y < block.y1; y += 2)
+			{
+				for (int x = x0; x < block.x1; x += 2)
+				{
+					int64 e[4][3];
+					int coverage[4];
+					bool covered = false;
+					for (int i = 0; i < 4; ++i)
+					{
+						const int px = x + qx[i];
+						const int py = y + qy[i];
+						for (size_t k = 0; k < 3; ++k)
+						{
+							e[i][k] = es.e[k] + px * es.dx[k] + py * es.dy[k];
+						}
+						//块被rect裁剪过，quad可能有一部分在块外面
+						const bool in_block = px >= block.x0 && px < block.x1 && py >= block.y0 && py < block.y1;
+						coverage[i] = !in_block ? 0 : full ? (1 << es.samples) - 1 : GetCoverage(e[i], es);
+						covered = covered || coverage[i];
+					}
+
+					if (!covered)
+					{
+						continue;
+					}
+
+					QuadProcessing(x, y, coverage, es);
+				}
+			}
+
+			if constexpr (bool(render_flag & RF_ENABLE_DEPTH_TEST))
+			{
+				context.MarkHiZDirty(block.x0 / block_size, block.y0 / block_size);
+			}
+		}
+
+		//quad的pixel processing，先对需要写入的像素做深度测试，全部没通过就不用着色了，coverage是每个像素被覆盖的采样点
+		void QuadProcessing(int x, int y, const int coverage[4], const EdgeSetup& es)
+		{
+			//左上角像素的属性/w，另外三个像素从它步进得到，辅助像素也要插值(外推)，用来求导数
+			vs_out_t attr = es.attr;
+			attr.MulAdd(es.attr_dx, (float)(x - es.ref_x)).MulAdd(es.attr_dy, (float)(y - es.ref_y));
+			const float rcp_w = es.rcp_w.x + (x - es.ref_x) * es.rcp_w.y + (y - es.ref_y) * es.rcp_w.z;
+
+			fs_quad<vs_out_t> quad;
+			float depth[4];
+			int pass[4];
+			int mask = 0;
+			for (int i = 0; i < 4; ++i)
+			{
+				quad.frag[i] = attr;
+				float frag_rcp_w = rcp_w;
+				if (i & 1)
+				{
+					quad.frag[i].MulAdd(es.attr_dx, 1.f);
+					frag_rcp_w += es.rcp_w.y;
+				}
+				if (i & 2)
+				{
+					quad.frag[i].MulAdd(es.attr_dy, 1.f);
+					frag_rcp_w += es.rcp_w.z;
+				}
+				quad.frag[i] *= 1.f / frag_rcp_w;
+				depth[i] = quad.frag[i].position.z / quad.frag[i].position.w;
+				//深度测试
+				pass[i] = coverage[i] ? DepthTest(x + (i & 1), y + (i >> 1), coverage[i], depth[i], es) : 0;
+				if (pass[i])
+				{
+					mask |= 1 << i;
+				}
+			}
+
+			if (mask == 0)
+			{
+				return;
+			}
+			quad.mask = mask;
+
+			std::array<fs_out_t, 4> fs_out;
+			if constexpr (has_fs_quad<Shader, fs_quad<vs_out_t>>::value)
+			{
+				fs_out = shader.FSQuad(quad);
+			}
+			else
+			{
+				for (int i = 0; i < 4; ++i)
+				{
+					if (mask >> i & 1)
+					{
+						fs_out[i] = shader.FS(quad.frag[i]);
+					}
+				}
+			}
+
+			for (int i = 0; i < 4; ++i)
+			{
+				if (pass[i])
+				{
+					WriteSamples(x + (i & 1), y + (i >> 1), pass[i], depth[i], quad.frag[i].position.w, es, fs_out[i]);
+				}
+			}
+		}
+
+		//MSAA下光栅化一个块，full为true表示块中所有的采样点都在三角形内
+		template<bool full>
+		void RasterizeBlockMSAA(const TileRect& block, const EdgeSetup& es)
+		{
+			const int all_samples = (1 << es.samples) - 1;
+			int64 e_row[3] = {
+				es.e[0] + block.x0 * es.dx[0] + block.y0 * es.dy[0],
+				es.e[1] + block.x0 * es.dx[1] + block.y0 * es.dy[1],
+				es.e[2] + block.x0 * es.dx[2] + block.y0 * es.dy[2]
+			};
+			AttributeSpan span(es, block.x0, block.y0);
+
+			for (int y = block.y0; y < block.y1; ++y)
+			{
+				int64 e[3] = { e_row[0], e_row[1], e_row[2] };
+				for (int x = block.x0; x < block.x1; ++x)
+				{
+					const int coverage = full ? all_samples : GetCoverage(e, es);
+					if (coverage)
+					{
+						//在像素中心插值，像素中心不一定在三角形内
+						PixelProcessing_MSAA(x, y, coverage, span.At(x, es), es);
+					}
+					e[0] += es.dx[0];
+					e[1] += es.dx[1];
+					e[2] += es.dx[2];
+				}
+				e_row[0] += es.dy[0];
+				e_row[1] += es.dy[1];
+				e_row[2] += es.dy[2];
+				span.NextRow(es);
+			}
+
+			if constexpr (bool(render_flag & RF_ENABLE_DEPTH_TEST))
+			{
+				context.MarkHiZDirty(block.x0 / block_size, block.y0 / block_size);
+			}
+		}
+
+		//像素中被三角形覆盖的采样点，e是像素中心处的边函数，第s位为1表示第s个采样点被覆盖
+		static int GetCoverage(const int64 e[3], const EdgeSetup& es)
+		{
+			int coverage = 0;
+			for (int s = 0; s < es.samples; ++s)
+			{
+				if (((e[0] + es.sample_e[s][0]) | (e[1] + es.sample_e[s][1]) | (e[2] + es.sample_e[s][2])) >= 0)
+				{
+					coverage |= 1 << s;
+				}
+			}
+			return coverage;
+		}
+
+		//对像素中被覆盖的采样点做深度测试，depth是像素中心的深度，返回通过测试的采样点
+		int DepthTest(int x, int y, int coverage, float depth, const EdgeSetup& es)
+		{
+			if constexpr (bool(render_flag & RF_ENABLE_DEPTH_TEST))
+			{
+				const float* depth0 = context.GetSampleDepths(x, y);
+				int pass = 0;
+				for (int s = 0; s < es.samples; ++s)
+				{
+					if ((coverage >> s & 1) && depth + es.sample_z[s] <= depth0[s])
+					{
+						pass |= 1 << s;
+					}
+				}
+				return pass;
+			}
+			else
+			{
+				return coverage;
+			}
+		}
+
+		//把像素着色的结果写到通过深度测试的采样点上，view_z是观察空间的深度，OIT时用来算权重
+		void WriteSamples(int x, int y, int pass, float depth, float view_z, const EdgeSetup& es, fs_out_t fs_out)
+		{
+			if constexpr (std::is_same_v<Color, fs_out_t> && bool(render_flag & RF_ENABLE_BLEND))
+			{
+				//OIT模式下半透明的片元只累加，不写深度，按通过测试的采样点比例算覆盖率
+				if (context.oit_active && fs_out.a < (1.f - epsilon))
+				{
+					int count = 0;
+					for (int s = 0; s < es.samples; ++s)
+					{
+						count += pass >> s & 1;
+					}
+					context.AccumulateOIT(x, y, fs_out, view_z, (float)count / es.samples);
+					return;
+				}
+			}
+
+			format_t* color = context.GetSamples(x, y);
+			float* depth0 = context.GetSampleDepths(x, y);
+			//不透明的颜色只需要编码一次
+			const format_t& encoded = format::Encode(fs_out);
+			for (int s = 0; s < es.samples; ++s)
+			{
+				if (!(pass >> s & 1))
+				{
+					continue;
+				}
+				if constexpr (bool(render_flag & RF_ENABLE_DEPTH_TEST))
+				{
+					//写入depth_buffer
+					depth0[s] = depth + es.sample_z[s];
+				}
+				if constexpr (std::is_same_v<Color, fs_out_t> && bool(render_flag & RF_ENABLE_BLEND))
+				{
+					//颜色混合，每个采样点和自己原来的颜色混合
+					if (fs_out.a < (1.f - epsilon))
+					{
+						color[s] = format::Encode(gmath::utility::BlendColor(format::Decode(color[s]), fs_out));
+						continue;
+					}
+				}
+				//写入fragment_buffer
+				color[s] = encoded;
+			}
+		}
+
+		//MSAA的pixel processing，每个像素只着色一次，深度测试和写入按采样点来做
+		void PixelProcessing_MSAA(int x, int y, int coverage, const vs_out_t& interp, const EdgeSetup& es)
+		{
+			float depth = interp.position.z / interp.position.w;
+
+			//深度测试
+			const int pass = DepthTest(x, y, coverage, depth, es);
+			if (pass == 0)
+			{
+				return;
+			}
+
+			WriteSamples(x, y, pass, depth, interp.position.w, es, shader.FS(interp));
 		}
 
 		//像素着色过程，采用了简单的抗锯齿算法，利用了MSAA的思想，不过没有增加采样点深度buffer信息，所以面片之间的显示会出一些问题，混合模式改成线性叠加（还没实现）或许能够解决一部分问题
@@ -346,7 +1334,7 @@ namespace core
 
 			vs_out_t interp = *p0 * weight.x + *p1 * weight.y + *p2 * weight.z;
 			Color color = shader.FS(interp);
-			Color color0 = context.back_buffer_view.Get(x, y);
+			Color color0 = format::Decode(context.back_buffer_view.Get(x, y));
 
 			using gmath::utility::Lerp;
 			using gmath::utility::BlendColor;
@@ -369,30 +1357,19 @@ namespace core
 			}
 
 			//写入fragment_buffer
-			context.back_buffer_view.Set(x, y, color);
+			context.back_buffer_view.Set(x, y, format::Encode(color));
 			//写入depth_buffer
 			context.depth_buffer_view.Set(x, y, depth);
-		}
-
-		// 不带AA的pixel processing
-		void PixelProcessing_NoAA(int x, int y, Vec2* triangle, vs_out_t* p0, vs_out_t* p1, vs_out_t* p2)
-		{
-			Vec3 weight = GetInterpolationWeight(x + 0.5f, y + 0.5f, triangle);
-
-			//判断是否在三角形内
-			if (weight.x < epsilon || weight.y < epsilon || weight.z < epsilon)
+			//这里写入的深度可能比原来的大，要保证Hi-Z依然是最大值
+			if (depth > context.hiz_buffer_view.Get(x / block_size, y / block_size))
 			{
-				return;
+				context.hiz_buffer_view.Set(x / block_size, y / block_size, depth);
 			}
+		}
 
-			//对插值进行透视修复
-			weight.x /= p0->position.w;
-			weight.y /= p1->position.w;
-			weight.z /= p2->position.w;
-			weight /= (weight.x + weight.y + weight.z);
-
-			//求插值
-			vs_out_t interp = *p0 * weight.x + *p1 * weight.y + *p2 * weight.z;
+		// 不带AA的pixel processing, interp是已经做过透视修复的插值结果
+		void PixelProcessing_NoAA(int x, int y, const vs_out_t& interp)
+		{
 			float depth = interp.position.z / interp.position.w;
 
 			//深度测试
@@ -403,42 +1380,40 @@ namespace core
 				{
 					return;
 				}
-				//写入depth_buffer
-				context.depth_buffer_view.Set(x, y, depth);
 			}
 
 			fs_out_t fs_out = shader.FS(interp);
 
 			if constexpr (std::is_same_v<Color, fs_out_t> && bool(render_flag & RF_ENABLE_BLEND))
 			{
-				//颜色混合
 				if (fs_out.a < (1.f - epsilon))
 				{
-					Color color0 = context.back_buffer_view.Get(x, y);
+					//OIT模式下半透明的片元只累加，不写深度
+					if (context.oit_active)
+					{
+						context.AccumulateOIT(x, y, fs_out, interp.position.w, 1.f);
+						return;
+					}
+					//颜色混合
+					Color color0 = format::Decode(context.back_buffer_view.Get(x, y));
 					fs_out = gmath::utility::BlendColor(color0, fs_out);
 				}
 			}
-			//写入fragment_buffer
-			context.back_buffer_view.Set(x, y, fs_out);
-		}
-		void PixelProcessing(int x, int y, Vec2* triangle, vs_out_t* p0, vs_out_t* p1, vs_out_t* p2)
-		{
-			if constexpr (bool(render_flag & RF_ENABLE_SIMPLE_AA) && std::is_same_v<Color, fs_out_t>)
-			{
-				PixelProcessing_AA(x, y, triangle, p0, p1, p2);
-			}
-			else
+			if constexpr (bool(render_flag & RF_ENABLE_DEPTH_TEST))
 			{
-				PixelProcessing_NoAA(x, y, triangle, p0, p1, p2);
+				//写入depth_buffer
+				context.depth_buffer_view.Set(x, y, depth);
 			}
+			//写入fragment_buffer
+			context.back_buffer_view.Set(x, y, format::Encode(fs_out));
 		}
 
 		//简单剔除，如果三角形有一个点在CVV之外，就全部剔除
-		bool SimpleCull(vs_out_t triangle[3])
+		bool SimpleCull(vs_out_t* const triangle[3])
 		{
 			for (size_t i = 0; i < 3; ++i)
 			{
-				const auto& v = triangle[i];
+				const auto& v = *triangle[i];
 				if (v.position.z < 0 ||
 					v.position.w < epsilon ||
 					v.position.z > v.position.w ||
@@ -455,20 +1430,20 @@ namespace core
 		}
 
 		//如果三角形三个点都在CVV之外,直接剔除
-		bool CVVCull(vs_out_t triangle[3])
-		{
-			float w0 = triangle[0].position.w;
-			float w1 = triangle[1].position.w;
-			float w2 = triangle[2].position.w;
-			float z0 = triangle[0].position.z;
-			float z1 = triangle[1].position.z;
-			float z2 = triangle[2].position.z;
-			float x0 = triangle[0].position.x;
-			float x1 = triangle[1].position.x;
-			float x2 = triangle[2].position.x;
-			float y0 = triangle[0].position.y;
-			float y1 = triangle[1].position.y;
-			float y2 = triangle[2].position.y;
+		bool CVVCull(vs_out_t* const triangle[3])
+		{
+			float w0 = triangle[0]->position.w;
+			float w1 = triangle[1]->position.w;
+			float w2 = triangle[2]->position.w;
+			float z0 = triangle[0]->position.z;
+			float z1 = triangle[1]->position.z;
+			float z2 = triangle[2]->position.z;
+			float x0 = triangle[0]->position.x;
+			float x1 = triangle[1]->position.x;
+			float x2 = triangle[2]->position.x;
+			float y0 = triangle[0]->position.y;
+			float y1 = triangle[1]->position.y;
+			float y2 = triangle[2]->position.y;
 
 			if (w0 < epsilon && w1 < epsilon && w2 < epsilon ||
 				z0 < 0 && z1 < 0 && z2 < 0 ||
@@ -484,6 +1459,29 @@ namespace core
 			return false;
 		}
 
+		//保护带的大小(NDC)，x,y方向的裁剪平面是 x = ±guard_band * w, 要保证保护带里的顶点映射到屏幕后不会超出max_raster_coord，并且float还有足够的精度吸附到亚像素网格上
+		//只开了RF_CULL_CVV_CLIP时x,y方向裁剪到视口；开了保护带，或者不做CVV裁剪时，x,y方向只裁掉保护带外面的部分
+		static constexpr float guard_band = bool(render_flag & RF_CULL_CVV_CLIP) && !bool(render_flag & RF_CULL_CVV_GUARD_BAND) ? 1.f : 16.f;
+
+		//CVV裁剪用到的平面，按裁剪的顺序排列
+		static constexpr int clip_planes[7] = { 'z>0', 'w>e', 'z<w', 'x<w', 'x>-w', 'y<w', 'y>-w' };
+		//不做CVV裁剪时也要裁剪的平面(w>e和保护带)，裁剪之后顶点的屏幕坐标一定在max_raster_coord以内
+		static constexpr int raster_range_planes = 1 << 1 | 1 << 3 | 1 << 4 | 1 << 5 | 1 << 6;
+
+		//顶点在哪些平面的外侧，第i位对应clip_planes[i]
+		int GetOutCode(vs_out_t* p)
+		{
+			int code = 0;
+			for (int i = 0; i < 7; ++i)
+			{
+				if (!IsInside(p, clip_planes[i]))
+				{
+					code |= 1 << i;
+				}
+			}
+			return code;
+		}
+
 		// 在某个平面内，这里的内指的是，该点和平面某点连线与平面法线的点乘为负
 		bool IsInside(vs_out_t* p, int plane)
 		{
@@ -497,10 +1495,10 @@ namespace core
 			case 'z>0':  return z > 0;	// 这个叫多字节字符字面量，其实直接用字符串字面量是一样的效果，这里是为了偷懒，为了不额外定义6个面的枚举
 			case 'w>e':  return w > epsilon; // epsilon 是一个很小的量，直接在w=0平面上剔除，可能会导致原本z=0的顶点被剔除掉
 			case 'z<w':  return z < w;
-			case 'x<w':  return x < w;
-			case 'x>-w': return x > -w;
-			case 'y<w':  return y < w;
-			case 'y>-w': return y > -w;
+			case 'x<w':  return x < guard_band * w;	// x,y方向的平面会被推到保护带上
+			case 'x>-w': return x > -guard_band * w;
+			case 'y<w':  return y < guard_band * w;
+			case 'y>-w': return y > -guard_band * w;
 			}
 			return false;
 		}
@@ -525,10 +1523,10 @@ namespace core
 			case 'z>0':  t = z1 / (z1 - z2); break;
 			case 'w>e':  t = (epsilon - w1) / (w2 - w1); break;
 			case 'z<w':  t = (w1 - z1) / ((z2 - z1) - (w2 - w1)); break;
-			case 'x<w':  t = (w1 - x1) / ((x2 - x1) - (w2 - w1)); break;
-			case 'x>-w': t = -(w1 + x1) / ((x2 - x1) + (w2 - w1)); break;
-			case 'y<w':  t = (w1 - y1) / ((y2 - y1) - (w2 - w1)); break;
-			case 'y>-w': t = -(w1 + y1) / ((y2 - y1) + (w2 - w1)); break;
+			case 'x<w':  t = (guard_band * w1 - x1) / ((x2 - x1) - guard_band * (w2 - w1)); break;
+			case 'x>-w': t = -(guard_band * w1 + x1) / ((x2 - x1) + guard_band * (w2 - w1)); break;
+			case 'y<w':  t = (guard_band * w1 - y1) / ((y2 - y1) - guard_band * (w2 - w1)); break;
+			case 'y>-w': t = -(guard_band * w1 + y1) / ((y2 - y1) + guard_band * (w2 - w1)); break;
 			}
 
 			//根据长度之比，用相似三角形法则，通过插值计算出p点坐标
@@ -579,18 +1577,18 @@ namespace core
 			return len_out;
 		}
 
-		//三角形与CVV相交，裁剪，并计算生成多边形的顶点数量
-		size_t CVVClip(vs_out_t* polygon_in, vs_out_t* polygon_out)
+		//三角形与CVV相交，只和planes中标记的平面裁剪，polygon和temp轮流作为输入输出，返回结果所在的数组，len为多边形的顶点数量
+		vs_out_t* CVVClip(vs_out_t* polygon, vs_out_t* temp, size_t& len, int planes)
 		{
-			size_t len = 3;
-			len = ClipAgainstPlane(polygon_in, len, polygon_out, 'z>0');
-			len = ClipAgainstPlane(polygon_out, len, polygon_in, 'w>e');
-			len = ClipAgainstPlane(polygon_in, len, polygon_out, 'z<w');
-			len = ClipAgainstPlane(polygon_out, len, polygon_in, 'x<w');
-			len = ClipAgainstPlane(polygon_in, len, polygon_out, 'x>-w');
-			len = ClipAgainstPlane(polygon_out, len, polygon_in, 'y<w');
-			len = ClipAgainstPlane(polygon_in, len, polygon_out, 'y>-w');
-			return len;
+			for (int i = 0; i < 7 && len >= 3; ++i)
+			{
+				if (planes & (1 << i))
+				{
+					len = ClipAgainstPlane(polygon, len, temp, clip_planes[i]);
+					std::swap(polygon, temp);
+				}
+			}
+			return polygon;
 		}
 
 		// 将三角形顶点从, NDC变换到屏幕坐标系
@@ -660,7 +1658,12 @@ namespace core
 		}
 
 	protected:
-		Context<fs_out_t>& context; //这个fs_out_t可以是color也可以是Gbuffer
+		context_t& context; //这个fs_out_t可以是color也可以是Gbuffer
 		const Shader& shader;
+		std::vector<Batch> batches; //分块模式下，每一批等待光栅化的三角形；非分块模式下只用到第一个
+		std::vector<std::vector<ScreenTriangle*>> bins; //每个tile中的三角形
+		std::vector<vs_out_t> vertex_cache; //顶点着色的结果
+		std::vector<uint8> vertex_used; //索引绘制时顶点是否被用到
+		Statistics statistics;
 	};
 }
@@ -1,22 +1,58 @@
 ﻿#pragma once
 
 #include "types_and_defs.hpp"
+#include "color_format.hpp"
+#include <cmath>
+#include <cassert>
 
 namespace core
 {
+	//贴图的储存格式，采样时都解码成Vec4(线性空间)
+	enum class ETextureFormat
+	{
+		RGBA32F, //每texel 16字节，默认格式，只有这个格式可以用GetRef/GetData直接修改
+		RGBA8_SRGB, //4字节，用于颜色贴图(albedo)，和颜色缓冲的RGBA8_SRGB是同一种编码
+		RG8_NORMAL, //2字节，切线空间法线贴图
+		R16F, //2字节，单通道
+		RGBA16F, //8字节，用于HDR的环境贴图
+	};
+
+	//texel在内存中的排列方式
+	enum class ETextureLayout
+	{
+		Linear, //按行排列
+		//4x4的块按行排列，块内按z型曲线排列，宽高补齐到4的倍数
+		//双线性采样的4个texel和相邻像素的texel大多在同一个块里，uv旋转之后也一样，按行排列时y和y+1差了一整行
+		Tiled,
+	};
+
 	class Texture
 	{
 	public:
+		//texel按缓存行对齐，Tiled布局下一个2x2的块正好在一个缓存行里
+		using data_t = std::vector<Vec4, aligned_allocator<Vec4>>;
+
 		Texture() :_w{ 0 }, _h{ 0 }/*, _xorder{ 0 }, _yorder{ 0 }, _order{ 0 }*/ {}
 		Texture(const Texture&) = delete;
 		Texture& operator=(const Texture& other) = delete;
-		Texture(Texture&& other) noexcept : _data{ std::move(other._data) }, _w{ other._w }, _h{ other._h }
-			/*,_xorder{ other._xorder }, _yorder{ other._yorder }, _order{ other._order } */{}
+		Texture(Texture&& other) noexcept : _data{ std::move(other._data) }, _texels{ std::move(other._texels) }, _mips{ std::move(other._mips) },
+			_format{ other._format }, _layout{ other._layout }, _w{ other._w }, _h{ other._h }
+			/*,_xorder{ other._xorder }, _yorder{ other._yorder }, _order{ other._order } */
+		{
+			other._w = other._h = 0;
+		}
 		Texture& operator=(Texture&& other) noexcept
 		{
 			if (this == &other) { return *this; }
-			memcpy(this, &other, sizeof(Texture));
-			memset(&other, 0, sizeof(Texture));
+			_data = std::move(other._data);
+			_texels = std::move(other._texels);
+			_mips = std::move(other._mips);
+			_format = other._format;
+			_layout = other._layout;
+			_w = other._w;
+			_h = other._h;
+			other._w = other._h = 0;
+			return *this;
 		}
 		Texture(size_t w, size_t h) :_w{ w }, _h{ h }/*, _order{ 0 }*/
 		{
@@ -54,11 +90,13 @@ namespace core
 
 			//const size_t i = x + y * _w;
 			const size_t i = GetIndex(x, y);
-			return _data[i];
+			return Fetch(i);
 		}
 
+		//只能用于RGBA32F格式
 		Vec4& GetRef(size_t x, size_t y)
 		{
+			assert(_format == ETextureFormat::RGBA32F);
 			using gmath::utility::Clamp;
 			x = Clamp(x, 0ULL, _w - 1);
 			y = Clamp(y, 0ULL, _h - 1);
@@ -69,25 +107,79 @@ namespace core
 			return _data[i];
 		}
 
+		//在第0级上双线性采样
 		static Vec4 Sample(Texture* tex, Vec2 uv) noexcept
 		{
 			if (!tex) return { 0,0,0,1.f };
-			float x = uv.x * tex->_w - 0.5f;
-			float y = uv.y * tex->_h - 0.5f;
-			auto _x = (size_t)x;
-			auto _y = (size_t)y;
-			x = x - _x;
-			y = y - _y;
+			return tex->Bilinear(uv);
+		}
 
-			//双线性插值
-			auto color0 = tex->Get(_x, _y);
-			auto color1 = tex->Get(_x + 1, _y);
-			auto color2 = tex->Get(_x, _y + 1);
-			auto color3 = tex->Get(_x + 1, _y + 1);
-			auto color01 = color0 * (1.f - x) + color1 * x;
-			auto color23 = color2 * (1.f - x) + color3 * x;
-			auto color = color01 * (1.f - y) + color23 * y;
-			return color;
+		//指定lod的三线性采样，在相邻的两级上各做一次双线性采样再按lod的小数部分插值
+		//没有生成mipmap时只有第0级，和Sample一样
+		static Vec4 SampleLevel(Texture* tex, Vec2 uv, float lod) noexcept
+		{
+			if (!tex) return { 0,0,0,1.f };
+			const float max_lod = (float)tex->_mips.size();
+			//!(lod > 0)顺便把NaN也当成0
+			lod = !(lod > 0.f) ? 0.f : lod < max_lod ? lod : max_lod;
+			const size_t level = (size_t)lod;
+			const float t = lod - level;
+			const Vec4 color0 = tex->GetLevel(level).Bilinear(uv);
+			if (t <= 0.f)
+			{
+				return color0;
+			}
+			const Vec4 color1 = tex->GetLevel(level + 1).Bilinear(uv);
+			return color0 * (1.f - t) + color1 * t;
+		}
+
+		//用uv在屏幕空间的导数选lod做三线性采样，导数一般由quad着色(fs_quad的Ddx/Ddy)求出
+		//lod = log2(一个像素在第0级上覆盖的texel数)，取x,y两个方向上较大的那个
+		static Vec4 SampleGrad(Texture* tex, Vec2 uv, Vec2 ddx, Vec2 ddy) noexcept
+		{
+			if (!tex) return { 0,0,0,1.f };
+			const float w = (float)tex->_w;
+			const float h = (float)tex->_h;
+			const float dx2 = ddx.x * ddx.x * w * w + ddx.y * ddx.y * h * h;
+			const float dy2 = ddy.x * ddy.x * w * w + ddy.y * ddy.y * h * h;
+			const float rho2 = dx2 > dy2 ? dx2 : dy2;
+			//log2(sqrt(rho2)) = 0.5 * log2(rho2)
+			const float lod = rho2 > 1.f ? 0.5f * std::log2(rho2) : 0.f;
+			return SampleLevel(tex, uv, lod);
+		}
+
+		//从第0级生成完整的mip链，一直缩小到1x1，每一级的宽高是上一级的一半(向下取整，最小为1)
+		//奇数边长用3个texel的多相box滤波，保证每个texel对下一级的贡献相同，不会因为丢掉一行/一列而偏移
+		//数据要是线性空间的颜色，修改第0级之后要重新生成
+		void GenerateMips()
+		{
+			_mips.clear();
+			const Texture* src = this;
+			while (src->_w > 1 || src->_h > 1)
+			{
+				Texture dst = src->Downsample();
+				_mips.emplace_back(std::move(dst));
+				src = &_mips.back();
+			}
+			//整条链都用浮点计算，最后再转换格式，误差不会逐级累积
+			for (auto& mip : _mips)
+			{
+				mip.Convert(_format);
+				mip.SetLayout(_layout);
+			}
+		}
+
+		//mipmap的级数，包括第0级
+		size_t GetMipCount() const noexcept
+		{
+			return _mips.size() + 1;
+		}
+
+		//第level级，0是自身，超出范围时返回最小的一级
+		const Texture& GetLevel(size_t level) const noexcept
+		{
+			if (level == 0 || _mips.empty()) return *this;
+			return _mips[(level <= _mips.size() ? level : _mips.size()) - 1];
 		}
 
 		size_t GetWidth() const noexcept
@@ -105,18 +197,154 @@ namespace core
 		//	return _order;
 		//}
 
+		//texel的个数(第0级)
 		size_t GetSize() const noexcept
 		{
-			return _data.size();
+			return _w * _h;
+		}
+
+		ETextureFormat GetFormat() const noexcept
+		{
+			return _format;
+		}
+
+		static size_t GetTexelSize(ETextureFormat format) noexcept
+		{
+			switch (format)
+			{
+			case ETextureFormat::RGBA8_SRGB: return sizeof(RGBA8_SRGB);
+			case ETextureFormat::RG8_NORMAL: return sizeof(RG8_NORMAL);
+			case ETextureFormat::R16F: return sizeof(R16F);
+			case ETextureFormat::RGBA16F: return sizeof(RGBA16F);
+			default: return sizeof(Vec4);
+			}
+		}
+
+		//实际储存的texel个数(第0级)，Tiled布局下包括补齐的部分
+		size_t GetStorageSize() const noexcept
+		{
+			if (_layout == ETextureLayout::Linear)
+			{
+				return _w * _h;
+			}
+			return ((_w + 3) & ~3ULL) * ((_h + 3) & ~3ULL);
+		}
+
+		ETextureLayout GetLayout() const noexcept
+		{
+			return _layout;
+		}
+
+		//改变texel的排列方式，mipmap一起改变，GetData得到的数据是按排列方式储存的
+		//IBL::Save/Load直接读写数据，只支持Linear
+		void SetLayout(ETextureLayout layout)
+		{
+			for (auto& mip : _mips)
+			{
+				mip.SetLayout(layout);
+			}
+			if (layout == _layout)
+			{
+				return;
+			}
+
+			Texture dst{};
+			dst._format = _format;
+			dst._layout = layout;
+			dst._w = _w;
+			dst._h = _h;
+			const size_t texel_size = GetTexelSize(_format);
+			if (_format == ETextureFormat::RGBA32F)
+			{
+				dst._data.resize(dst.GetStorageSize());
+			}
+			else
+			{
+				dst._texels.resize(dst.GetStorageSize() * texel_size);
+			}
+#pragma omp parallel for
+			for (int y = 0; y < (int)_h; ++y)
+			{
+				for (size_t x = 0; x < _w; ++x)
+				{
+					const size_t i = GetIndex(x, y);
+					const size_t j = dst.GetIndex(x, y);
+					if (_format == ETextureFormat::RGBA32F)
+					{
+						dst._data[j] = _data[i];
+					}
+					else
+					{
+						memcpy(&dst._texels[j * texel_size], &_texels[i * texel_size], texel_size);
+					}
+				}
+			}
+			_data = std::move(dst._data);
+			_texels = std::move(dst._texels);
+			_layout = layout;
+		}
+
+		//占用的内存(字节)，包括所有mipmap
+		size_t GetMemorySize() const noexcept
+		{
+			size_t size = GetStorageSize() * GetTexelSize(_format);
+			for (const auto& mip : _mips)
+			{
+				size += mip.GetMemorySize();
+			}
+			return size;
+		}
+
+		//转换储存格式，mipmap一起转换，转换成有损的格式后再转回RGBA32F不能恢复原来的精度
+		//RGBA8_SRGB要求数据是线性空间的颜色(在这里做gamma编码)，RG8_NORMAL要求数据是 法线 * 0.5 + 0.5
+		void Convert(ETextureFormat format)
+		{
+			for (auto& mip : _mips)
+			{
+				mip.Convert(format);
+			}
+			if (format == _format)
+			{
+				return;
+			}
+
+			data_t data;
+			if (_format == ETextureFormat::RGBA32F)
+			{
+				data = std::move(_data);
+			}
+			else
+			{
+				data.resize(GetStorageSize());
+				for (size_t i = 0; i < data.size(); ++i)
+				{
+					data[i] = Fetch(i);
+				}
+			}
+			_data = {};
+			_texels = {};
+			_format = format;
+
+			switch (format)
+			{
+			case ETextureFormat::RGBA8_SRGB: EncodeTexels<RGBA8_SRGB>(data); break;
+			case ETextureFormat::RG8_NORMAL: EncodeTexels<RG8_NORMAL>(data); break;
+			case ETextureFormat::R16F: EncodeTexels<R16F>(data); break;
+			case ETextureFormat::RGBA16F: EncodeTexels<RGBA16F>(data); break;
+			default: _data = std::move(data); break;
+			}
 		}
 
-		std::vector<Vec4>& GetData()
+		//只能用于RGBA32F格式，其他格式是空的
+		data_t& GetData()
 		{
+			assert(_format == ETextureFormat::RGBA32F);
 			return _data;
 		}
 
-		const std::vector<Vec4>& GetCData() const noexcept
+		const data_t& GetCData() const noexcept
 		{
+			assert(_format == ETextureFormat::RGBA32F);
 			return _data;
 		}
 
@@ -128,29 +356,194 @@ namespace core
 			//_yorder = (size_t)ceil(log2(h));
 			//_order = _xorder + _yorder;
 			//_data.resize((size_t)pow(2, _order));
-			_data.resize(w * h);
+			if (_format == ETextureFormat::RGBA32F)
+			{
+				_data.resize(GetStorageSize());
+			}
+			else
+			{
+				_texels.resize(GetStorageSize() * GetTexelSize(_format));
+			}
+			_mips.clear();
 		}
 
 	protected:
-		//计算二维z型曲线的morton code
+		//按排列方式计算texel的下标
+		//下标可以拆成只和x有关、只和y有关的两部分之和，双线性采样时x,y各算两次就够了
 		size_t GetIndex(size_t x, size_t y) const noexcept
 		{
-			return x + y * _w;
-			//size_t z = 0;
-			//size_t i = 0;
-			//for (size_t j = 0; j < _order; ++j) {
-			//	size_t mask = 1ULL << j;
-			//	if (j < _xorder) {
-			//		if (x & mask) z |= 1ULL << i;
-			//		++i;
-			//	}
-			//	if (j < _yorder) {
-			//		if (y & mask) z |= 1ULL << i;
-			//		++i;
-			//	}
-			//}
-			//return z;
+			return GetIndexX(x) + GetIndexY(y);
+		}
+
+		//Tiled: 块的下标乘16，加上块内2位x,2位y交错成的z型曲线下标(x0,y0,x1,y1)
+		size_t GetIndexX(size_t x) const noexcept
+		{
+			if (_layout == ETextureLayout::Linear)
+			{
+				return x;
+			}
+			return ((x >> 2) << 4) + ((x & 1) | ((x & 2) << 1));
+		}
+
+		size_t GetIndexY(size_t y) const noexcept
+		{
+			if (_layout == ETextureLayout::Linear)
+			{
+				return y * _w;
+			}
+			const size_t tiles_x = (_w + 3) >> 2;
+			return (((y >> 2) * tiles_x) << 4) + (((y & 1) << 1) | ((y & 2) << 2));
+		}
+		template<typename Format>
+		void EncodeTexels(const data_t& data)
+		{
+			_texels.resize(data.size() * sizeof(Format));
+			Format* texels = reinterpret_cast<Format*>(_texels.data());
+#pragma omp parallel for
+			for (int i = 0; i < (int)data.size(); ++i)
+			{
+				texels[i] = format_traits<Color, Format>::Encode(data[i]);
+			}
+		}
+
+		//读取下标为i的texel并解码，Format是储存格式，RGBA32F对应Vec4
+		template<typename Format>
+		Vec4 FetchAs(size_t i) const noexcept
+		{
+			if constexpr (std::is_same_v<Format, Vec4>)
+			{
+				return _data[i];
+			}
+			else
+			{
+				return format_traits<Color, Format>::Decode(reinterpret_cast<const Format*>(_texels.data())[i]);
+			}
+		}
+
+		Vec4 Fetch(size_t i) const noexcept
+		{
+			switch (_format)
+			{
+			case ETextureFormat::RGBA8_SRGB: return FetchAs<RGBA8_SRGB>(i);
+			case ETextureFormat::RG8_NORMAL: return FetchAs<RG8_NORMAL>(i);
+			case ETextureFormat::R16F: return FetchAs<R16F>(i);
+			case ETextureFormat::RGBA16F: return FetchAs<RGBA16F>(i);
+			default: return FetchAs<Vec4>(i);
+			}
+		}
+
+		//x,y可以越界(包括负数)，clamp到边缘
+		Vec4 Texel(int64 x, int64 y) const noexcept
+		{
+			using gmath::utility::Clamp;
+			x = Clamp(x, 0LL, (int64)_w - 1);
+			y = Clamp(y, 0LL, (int64)_h - 1);
+			return Fetch(GetIndex((size_t)x, (size_t)y));
+		}
+
+		//每次采样只按格式分派一次，4个texel的读取和解码都是内联的
+		Vec4 Bilinear(Vec2 uv) const noexcept
+		{
+			switch (_format)
+			{
+			case ETextureFormat::RGBA8_SRGB: return BilinearAs<RGBA8_SRGB>(uv);
+			case ETextureFormat::RG8_NORMAL: return BilinearAs<RG8_NORMAL>(uv);
+			case ETextureFormat::R16F: return BilinearAs<R16F>(uv);
+			case ETextureFormat::RGBA16F: return BilinearAs<RGBA16F>(uv);
+			default: return BilinearAs<Vec4>(uv);
+			}
 		}
+
+		template<typename Format>
+		Vec4 BilinearAs(Vec2 uv) const noexcept
+		{
+			float x = uv.x * _w - 0.5f;
+			float y = uv.y * _h - 0.5f;
+			const float fx = std::floor(x);
+			const float fy = std::floor(y);
+			const auto _x = (int64)fx;
+			const auto _y = (int64)fy;
+			x = x - fx;
+			y = y - fy;
+
+			using gmath::utility::Clamp;
+			const size_t x0 = GetIndexX((size_t)Clamp(_x, 0LL, (int64)_w - 1));
+			const size_t x1 = GetIndexX((size_t)Clamp(_x + 1, 0LL, (int64)_w - 1));
+			const size_t y0 = GetIndexY((size_t)Clamp(_y, 0LL, (int64)_h - 1));
+			const size_t y1 = GetIndexY((size_t)Clamp(_y + 1, 0LL, (int64)_h - 1));
+
+			//双线性插值
+			auto color0 = FetchAs<Format>(x0 + y0);
+			auto color1 = FetchAs<Format>(x1 + y0);
+			auto color2 = FetchAs<Format>(x0 + y1);
+			auto color3 = FetchAs<Format>(x1 + y1);
+			auto color01 = color0 * (1.f - x) + color1 * x;
+			auto color23 = color2 * (1.f - x) + color3 * x;
+			auto color = color01 * (1.f - y) + color23 * y;
+			return color;
+		}
+
+		//一维的缩小一半的滤波权重，偶数边长是2个texel各0.5
+		//奇数边长n缩小到m=(n-1)/2，第i个texel覆盖源的[i*n/m, (i+1)*n/m)，落在2i,2i+1,2i+2三个texel上
+		static void DownsampleWeights(size_t n, size_t i, float weight[3]) noexcept
+		{
+			if (n % 2 == 0 || n == 1)
+			{
+				weight[0] = 0.5f;
+				weight[1] = 0.5f;
+				weight[2] = 0.f;
+				return;
+			}
+			const size_t m = n / 2;
+			weight[0] = (float)(m - i) / n;
+			weight[1] = (float)m / n;
+			weight[2] = (float)(i + 1) / n;
+		}
+
+		//生成下一级(RGBA32F)，先横向再纵向，两次都是可分离的一维滤波
+		Texture Downsample() const
+		{
+			const size_t w = _w > 1 ? _w / 2 : 1;
+			const size_t h = _h > 1 ? _h / 2 : 1;
+
+			//横向，宽度是1时不缩小
+			std::vector<Vec4> temp(w * _h);
+#pragma omp parallel for
+			for (int y = 0; y < (int)_h; ++y)
+			{
+				for (size_t x = 0; x < w; ++x)
+				{
+					if (_w == 1)
+					{
+						temp[x + y * w] = Texel(0, y);
+						continue;
+					}
+					float weight[3];
+					DownsampleWeights(_w, x, weight);
+					const int64 x0 = (int64)(x * 2);
+					temp[x + y * w] = Texel(x0, y) * weight[0] + Texel(x0 + 1, y) * weight[1] + Texel(x0 + 2, y) * weight[2];
+				}
+			}
+
+			//纵向
+			Texture dst{ w, h };
+#pragma omp parallel for
+			for (int y = 0; y < (int)h; ++y)
+			{
+				float weight[3];
+				DownsampleWeights(_h, y, weight);
+				const size_t y0 = _h > 1 ? y * 2 : 0;
+				const size_t y1 = (std::min)(y0 + 1, _h - 1);
+				const size_t y2 = (std::min)(y0 + 2, _h - 1);
+				for (size_t x = 0; x < w; ++x)
+				{
+					dst.GetRef(x, y) = _h == 1 ? temp[x] :
+						temp[x + y0 * w] * weight[0] + temp[x + y1 * w] * weight[1] + temp[x + y2 * w] * weight[2];
+				}
+			}
+			return dst;
+		}
+
 		////计算二维z型曲线的x,y值
 		//void GetXYformIndex(size_t index, size_t& x, size_t& y) const noexcept
 		//{
@@ -171,7 +564,11 @@ namespace core
 		//}
 
 	protected:
-		std::vector<Vec4> _data;
+		data_t _data; //RGBA32F格式的texel
+		std::vector<uint8, aligned_allocator<uint8>> _texels; //其他格式的texel
+		std::vector<Texture> _mips; //第1级开始的mipmap，_mips[i]是第i+1级，没有调用GenerateMips时为空
+		ETextureFormat _format = ETextureFormat::RGBA32F;
+		ETextureLayout _layout = ETextureLayout::Linear;
 		size_t _w;
 		size_t _h;
 		//size_t _order;
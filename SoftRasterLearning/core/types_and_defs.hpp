@@ -4,6 +4,7 @@
 #include "vs_out.hpp"
 #include <vector>
 #include <algorithm>
+#include <new>
 
 namespace core
 {
@@ -16,9 +17,12 @@ namespace core
 	using Mat3 = gmath::Mat3x3<float>;
 	using Quat = gmath::Quaternions<float>;
 
+	using int8 = signed char;
 	using uint8 = unsigned char;
+	using int16 = short;
 	using uint16 = unsigned short;
 	using uint32 = unsigned int;
+	using int64 = long long;
 	static constexpr float epsilon = 1e-20f;
 	static constexpr float pi = 3.14159265358979f;
 	static constexpr float gamma = 2.2f;//2.2f;
@@ -38,4 +42,43 @@ namespace core
 	{
 		return static_cast<T>(std::forward<U>(u));
 	}
+
+	//按align字节对齐的分配器，缓存行对齐的数组不会有元素跨两个缓存行
+	template<typename T, size_t align = 64>
+	struct aligned_allocator
+	{
+		using value_type = T;
+
+		template<typename U>
+		struct rebind
+		{
+			using other = aligned_allocator<U, align>;
+		};
+
+		aligned_allocator() noexcept = default;
+		template<typename U>
+		aligned_allocator(const aligned_allocator<U, align>&) noexcept {}
+
+		T* allocate(size_t n)
+		{
+			return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t{ align }));
+		}
+
+		void deallocate(T* p, size_t) noexcept
+		{
+			::operator delete(p, std::align_val_t{ align });
+		}
+
+		template<typename U>
+		bool operator==(const aligned_allocator<U, align>&) const noexcept
+		{
+			return true;
+		}
+
+		template<typename U>
+		bool operator!=(const aligned_allocator<U, align>&) const noexcept
+		{
+			return false;
+		}
+	};
 }
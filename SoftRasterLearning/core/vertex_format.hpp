@@ -0,0 +1,176 @@
+﻿#pragma once
+
+#include "types_and_defs.hpp"
+#include "color_format.hpp"
+#include "bounds.hpp"
+#include <cmath>
+
+namespace core
+{
+	struct Model_Vertex
+	{
+		Vec3 position;
+		Vec2 uv;
+		Vec3 normal;
+		Vec3 tangent;
+
+		Model_Vertex() = default;
+		Model_Vertex(Vec3 p, Vec2 t, Vec3 n) :
+			position(p),
+			uv(t),
+			normal(n)
+		{
+		}
+	};
+
+	//压缩的顶点，18字节，Model_Vertex是64字节
+	//位置是相对模型包围盒量化的16位定点数，uv是半精度浮点，法线和切线一起编码成一个四元数(QTangent)
+	struct Model_Vertex_Packed
+	{
+		uint16 position[3];
+		uint16 uv[2];
+		int16 qtangent[4]; //x,y,z,w，w>=0
+	};
+
+	namespace vertex_detail
+	{
+		inline int16 PackSnorm16(float v) noexcept
+		{
+			const float c = v < -1.f ? -1.f : v > 1.f ? 1.f : v;
+			return (int16)std::lround(c * 32767.f);
+		}
+
+		//法线和切线组成的正交基编码成单位四元数，副切线总是 normal x tangent，所以不需要保存手性
+		inline void PackQTangent(Vec3 normal, Vec3 tangent, int16(&q)[4]) noexcept
+		{
+			const Vec3 n = normal.Normalize();
+			Vec3 t = tangent - n * n.Dot(tangent);
+			const float len = t.Length();
+			if (!(len > 1e-6f))
+			{
+				//没有切线时随便取一个和法线垂直的方向
+				t = std::abs(n.x) < 0.9f ? Vec3{ 1,0,0 } : Vec3{ 0,1,0 };
+				t = t - n * n.Dot(t);
+			}
+			t = t.Normalize();
+			const Vec3 b = n.Cross(t);
+
+			//旋转矩阵的三列是 t,b,n
+			const float m00 = t.x, m10 = t.y, m20 = t.z;
+			const float m01 = b.x, m11 = b.y, m21 = b.z;
+			const float m02 = n.x, m12 = n.y, m22 = n.z;
+			float x, y, z, w;
+			const float trace = m00 + m11 + m22;
+			if (trace > 0.f)
+			{
+				const float s = std::sqrt(trace + 1.f) * 2.f;
+				w = 0.25f * s;
+				x = (m21 - m12) / s;
+				y = (m02 - m20) / s;
+				z = (m10 - m01) / s;
+			}
+			else if (m00 > m11 && m00 > m22)
+			{
+				const float s = std::sqrt(1.f + m00 - m11 - m22) * 2.f;
+				w = (m21 - m12) / s;
+				x = 0.25f * s;
+				y = (m01 + m10) / s;
+				z = (m02 + m20) / s;
+			}
+			else if (m11 > m22)
+			{
+				const float s = std::sqrt(1.f + m11 - m00 - m22) * 2.f;
+				w = (m02 - m20) / s;
+				x = (m01 + m10) / s;
+				y = 0.25f * s;
+				z = (m12 + m21) / s;
+			}
+			else
+			{
+				const float s = std::sqrt(1.f + m22 - m00 - m11) * 2.f;
+				w = (m10 - m01) / s;
+				x = (m02 + m20) / s;
+				y = (m12 + m21) / s;
+				z = 0.25f * s;
+			}
+			//q和-q表示同一个旋转，统一成w>=0
+			const float sign = w < 0.f ? -1.f : 1.f;
+			q[0] = PackSnorm16(x * sign);
+			q[1] = PackSnorm16(y * sign);
+			q[2] = PackSnorm16(z * sign);
+			q[3] = PackSnorm16(w * sign);
+		}
+
+		inline void UnpackQTangent(const int16(&q)[4], Vec3& normal, Vec3& tangent) noexcept
+		{
+			float x = q[0], y = q[1], z = q[2], w = q[3];
+			const float inv_len = 1.f / std::sqrt(x * x + y * y + z * z + w * w);
+			x *= inv_len;
+			y *= inv_len;
+			z *= inv_len;
+			w *= inv_len;
+			//旋转矩阵的第0列和第2列
+			tangent = { 1.f - 2.f * (y * y + z * z), 2.f * (x * y + w * z), 2.f * (x * z - w * y) };
+			normal = { 2.f * (x * z + w * y), 2.f * (y * z - w * x), 1.f - 2.f * (x * x + y * y) };
+		}
+	}
+
+	//压缩过的顶点数组，绘制时在取顶点(vertex fetch)的阶段解码成Model_Vertex，再交给顶点着色器
+	struct PackedMesh
+	{
+		std::vector<Model_Vertex_Packed> vertices;
+		Vec3 position_offset = { 0,0,0 }; //量化的位置 * position_scale + position_offset = 原来的位置
+		Vec3 position_scale = { 0,0,0 };
+
+		PackedMesh() = default;
+
+		//位置相对于包围盒量化，bounds需要包含所有顶点
+		PackedMesh(const std::vector<Model_Vertex>& mesh, const AABB& bounds) :
+			position_offset{ bounds.min },
+			position_scale{ (bounds.max - bounds.min) / 65535.f }
+		{
+			using namespace vertex_detail;
+			const Vec3 extent = bounds.max - bounds.min;
+			const Vec3 inv_extent = {
+				extent.x > 0.f ? 65535.f / extent.x : 0.f,
+				extent.y > 0.f ? 65535.f / extent.y : 0.f,
+				extent.z > 0.f ? 65535.f / extent.z : 0.f,
+			};
+			vertices.resize(mesh.size());
+			for (size_t i = 0; i < mesh.size(); ++i)
+			{
+				const Model_Vertex& v = mesh[i];
+				Model_Vertex_Packed& p = vertices[i];
+				const Vec3 q = (v.position - bounds.min) * inv_extent;
+				p.position[0] = (uint16)std::lround((std::clamp)(q.x, 0.f, 65535.f));
+				p.position[1] = (uint16)std::lround((std::clamp)(q.y, 0.f, 65535.f));
+				p.position[2] = (uint16)std::lround((std::clamp)(q.z, 0.f, 65535.f));
+				p.uv[0] = format_detail::FloatToHalf(v.uv.x);
+				p.uv[1] = format_detail::FloatToHalf(v.uv.y);
+				PackQTangent(v.normal, v.tangent, p.qtangent);
+			}
+		}
+
+		size_t size() const noexcept
+		{
+			return vertices.size();
+		}
+
+		bool empty() const noexcept
+		{
+			return vertices.empty();
+		}
+
+		//解码第i个顶点
+		Model_Vertex Fetch(size_t i) const noexcept
+		{
+			using namespace vertex_detail;
+			const Model_Vertex_Packed& p = vertices[i];
+			Model_Vertex v;
+			v.position = Vec3{ (float)p.position[0], (float)p.position[1], (float)p.position[2] } * position_scale + position_offset;
+			v.uv = { format_detail::HalfToFloat(p.uv[0]), format_detail::HalfToFloat(p.uv[1]) };
+			UnpackQTangent(p.qtangent, v.normal, v.tangent);
+			return v;
+		}
+	};
+}
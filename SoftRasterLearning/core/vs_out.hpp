@@ -66,6 +66,85 @@ namespace core
 
 			return ret;
 		}
+
+		//原地运算 this += rhs * s，不产生临时变量，光栅化时用来逐像素地增量插值
+		T& MulAdd(const T& rhs, float s) {
+			static_assert(std::is_base_of_v<vs_out_base<T>, T>);
+			float* buffer_lhs = reinterpret_cast<float*>(this);
+			const float* buffer_rhs = reinterpret_cast<const float*>(&rhs);
+			constexpr size_t size = sizeof(T) / sizeof(float);
+
+			if constexpr (alignof(T) == 16)
+			{
+				const __m128 _s = _mm_set_ps1(s);
+				for (size_t i = 0; i < size; i += 4)
+				{
+					__m128 _lhs = _mm_load_ps(&buffer_lhs[i]);
+					__m128 _rhs = _mm_load_ps(&buffer_rhs[i]);
+					_mm_store_ps(&buffer_lhs[i], _mm_add_ps(_lhs, _mm_mul_ps(_rhs, _s)));
+				}
+			}
+			else
+			{
+				for (size_t i = 0; i < size; ++i)
+				{
+					buffer_lhs[i] += buffer_rhs[i] * s;
+				}
+			}
+
+			return static_cast<T&>(*this);
+		}
+
+		//原地运算 this *= rhs
+		T& operator*=(float rhs) {
+			static_assert(std::is_base_of_v<vs_out_base<T>, T>);
+			float* buffer_lhs = reinterpret_cast<float*>(this);
+			constexpr size_t size = sizeof(T) / sizeof(float);
+
+			if constexpr (alignof(T) == 16)
+			{
+				const __m128 _rhs = _mm_set_ps1(rhs);
+				for (size_t i = 0; i < size; i += 4)
+				{
+					__m128 _lhs = _mm_load_ps(&buffer_lhs[i]);
+					_mm_store_ps(&buffer_lhs[i], _mm_mul_ps(_lhs, _rhs));
+				}
+			}
+			else
+			{
+				for (size_t i = 0; i < size; ++i)
+				{
+					buffer_lhs[i] *= rhs;
+				}
+			}
+
+			return static_cast<T&>(*this);
+		}
+	};
+
+	//2x2的像素块(quad)，四个像素的插值结果按 左上、右上、左下、右下 排列
+	//quad中可能有不在三角形内的辅助像素(helper)，它们的插值是外推出来的，只用来求导数，着色结果不会被写入
+	template<typename T>
+	struct fs_quad
+	{
+		T frag[4];
+		int mask; //第i位为1表示第i个像素需要写入
+
+		//屏幕空间x方向的导数(同一行相邻像素之差)
+		template<typename M>
+		M Ddx(M T::* member, size_t i = 0) const
+		{
+			const size_t row = i & 2;
+			return frag[row + 1].*member - frag[row].*member;
+		}
+
+		//屏幕空间y方向的导数(同一列相邻像素之差)
+		template<typename M>
+		M Ddy(M T::* member, size_t i = 0) const
+		{
+			const size_t col = i & 1;
+			return frag[col + 2].*member - frag[col].*member;
+		}
 	};
 
 	template<typename T, typename... Args>
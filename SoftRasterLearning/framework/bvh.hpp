@@ -0,0 +1,422 @@
+﻿#pragma once
+
+#include "../core/bounds.hpp"
+#include <vector>
+
+namespace framework
+{
+	//动态的包围体层次结构(BVH)，叶子是物体的包围盒，内部结点是子结点包围盒的并集
+	//叶子储存的是放大过的包围盒(fat AABB)，物体小范围移动时不用改动树，移出去了才重新插入
+	//插入时按表面积启发式(SAH)选兄弟结点，再用旋转保持平衡，所以树高是O(log n)的
+	class DynamicBVH
+	{
+	public:
+		static constexpr int null_node = -1;
+
+		//插入一个叶子，返回它的编号，user_data由使用者定义(比如物体的下标)
+		int Insert(const core::AABB& box, size_t user_data)
+		{
+			const int leaf = AllocateNode();
+			nodes[leaf].box = Fatten(box);
+			nodes[leaf].user_data = user_data;
+			nodes[leaf].height = 0;
+			InsertLeaf(leaf);
+			return leaf;
+		}
+
+		void Remove(int leaf)
+		{
+			RemoveLeaf(leaf);
+			FreeNode(leaf);
+		}
+
+		//更新叶子的包围盒，还在原来的fat AABB里时什么都不做，返回是否改动了树
+		bool Move(int leaf, const core::AABB& box)
+		{
+			if (nodes[leaf].box.Contains(box))
+			{
+				//包围盒大幅缩小时也要重新插入，否则fat AABB会一直比物体大很多
+				if (box.Expand(4.f * Margin(box)).Contains(nodes[leaf].box))
+				{
+					return false;
+				}
+			}
+			RemoveLeaf(leaf);
+			nodes[leaf].box = Fatten(box);
+			InsertLeaf(leaf);
+			return true;
+		}
+
+		size_t GetUserData(int leaf) const
+		{
+			return nodes[leaf].user_data;
+		}
+
+		void SetUserData(int leaf, size_t user_data)
+		{
+			nodes[leaf].user_data = user_data;
+		}
+
+		const core::AABB& GetFatAABB(int leaf) const
+		{
+			return nodes[leaf].box;
+		}
+
+		void Clear()
+		{
+			nodes.clear();
+			root = null_node;
+			free_list = null_node;
+		}
+
+		//和视锥相交的叶子，完全在视锥内的子树不再逐个测试
+		template<typename F>
+		void QueryFrustum(const core::Frustum& frustum, F&& callback) const
+		{
+			if (root == null_node)
+			{
+				return;
+			}
+			stack.clear();
+			stack.push_back(root);
+			while (!stack.empty())
+			{
+				const int i = stack.back();
+				stack.pop_back();
+				const core::ECullResult result = frustum.Classify(nodes[i].box);
+				if (result == core::ECullResult::Outside)
+				{
+					continue;
+				}
+				if (result == core::ECullResult::Inside)
+				{
+					VisitLeaves(i, callback);
+					continue;
+				}
+				if (nodes[i].IsLeaf())
+				{
+					callback(nodes[i].user_data);
+				}
+				else
+				{
+					stack.push_back(nodes[i].child[0]);
+					stack.push_back(nodes[i].child[1]);
+				}
+			}
+		}
+
+		//和球相交的叶子
+		template<typename F>
+		void QuerySphere(const core::Vec3& center, float radius, F&& callback) const
+		{
+			Traverse([&](const core::AABB& box) { return box.Overlaps(center, radius); }, callback);
+		}
+
+		//和包围盒相交的叶子
+		template<typename F>
+		void QueryAABB(const core::AABB& query, F&& callback) const
+		{
+			Traverse([&](const core::AABB& box) { return box.Overlaps(query); }, callback);
+		}
+
+		//和射线(origin + t * dir, 0 <= t <= t_max)相交的叶子，回调的第二个参数是射线进入叶子包围盒的t
+		template<typename F>
+		void QueryRay(const core::Vec3& origin, const core::Vec3& dir, float t_max, F&& callback) const
+		{
+			const core::Vec3 inv_dir = 1.f / dir;
+			if (root == null_node)
+			{
+				return;
+			}
+			stack.clear();
+			stack.push_back(root);
+			while (!stack.empty())
+			{
+				const int i = stack.back();
+				stack.pop_back();
+				float t_near;
+				if (!nodes[i].box.Intersects(origin, inv_dir, t_max, t_near))
+				{
+					continue;
+				}
+				if (nodes[i].IsLeaf())
+				{
+					callback(nodes[i].user_data, t_near);
+				}
+				else
+				{
+					stack.push_back(nodes[i].child[0]);
+					stack.push_back(nodes[i].child[1]);
+				}
+			}
+		}
+
+	private:
+		struct Node
+		{
+			core::AABB box;
+			int parent = null_node; //在空闲链表中时表示下一个空闲结点
+			int child[2] = { null_node, null_node };
+			int height = -1; //叶子是0，空闲结点是-1
+			size_t user_data = 0;
+
+			bool IsLeaf() const noexcept
+			{
+				return child[0] == null_node;
+			}
+		};
+
+		std::vector<Node> nodes;
+		int root = null_node;
+		int free_list = null_node;
+		mutable std::vector<int> stack; //遍历用的栈，复用避免每次查询都分配内存
+
+		static float Margin(const core::AABB& box)
+		{
+			const core::Vec3 e = box.Extent();
+			return 0.1f * (std::max)({ e.x, e.y, e.z });
+		}
+
+		static core::AABB Fatten(const core::AABB& box)
+		{
+			return box.Expand(Margin(box));
+		}
+
+		int AllocateNode()
+		{
+			if (free_list == null_node)
+			{
+				nodes.emplace_back();
+				return (int)nodes.size() - 1;
+			}
+			const int i = free_list;
+			free_list = nodes[i].parent;
+			nodes[i] = Node{};
+			return i;
+		}
+
+		void FreeNode(int i)
+		{
+			nodes[i].parent = free_list;
+			nodes[i].height = -1;
+			free_list = i;
+		}
+
+		template<typename Test, typename F>
+		void Traverse(Test&& test, F&& callback) const
+		{
+			if (root == null_node)
+			{
+				return;
+			}
+			stack.clear();
+			stack.push_back(root);
+			while (!stack.empty())
+			{
+				const int i = stack.back();
+				stack.pop_back();
+				if (!test(nodes[i].box))
+				{
+					continue;
+				}
+				if (nodes[i].IsLeaf())
+				{
+					callback(nodes[i].user_data);
+				}
+				else
+				{
+					stack.push_back(nodes[i].child[0]);
+					stack.push_back(nodes[i].child[1]);
+				}
+			}
+		}
+
+		//访问子树下的所有叶子，不做测试
+		template<typename F>
+		void VisitLeaves(int subtree, F& callback) const
+		{
+			const size_t base = stack.size();
+			stack.push_back(subtree);
+			while (stack.size() > base)
+			{
+				const int i = stack.back();
+				stack.pop_back();
+				if (nodes[i].IsLeaf())
+				{
+					callback(nodes[i].user_data);
+				}
+				else
+				{
+					stack.push_back(nodes[i].child[0]);
+					stack.push_back(nodes[i].child[1]);
+				}
+			}
+		}
+
+		void InsertLeaf(int leaf)
+		{
+			if (root == null_node)
+			{
+				root = leaf;
+				nodes[root].parent = null_node;
+				return;
+			}
+
+			//从根往下找代价最小的兄弟结点
+			const core::AABB leaf_box = nodes[leaf].box;
+			int index = root;
+			while (!nodes[index].IsLeaf())
+			{
+				const int c0 = nodes[index].child[0];
+				const int c1 = nodes[index].child[1];
+				const float area = nodes[index].box.SurfaceArea();
+				const float combined_area = nodes[index].box.Union(leaf_box).SurfaceArea();
+
+				//在这里新建一个父结点的代价
+				const float cost = 2.f * combined_area;
+				//继续往下走时，祖先结点包围盒增大的代价
+				const float inheritance_cost = 2.f * (combined_area - area);
+
+				auto child_cost = [&](int c) {
+					const float new_area = nodes[c].box.Union(leaf_box).SurfaceArea();
+					return nodes[c].IsLeaf() ?
+						new_area + inheritance_cost :
+						new_area - nodes[c].box.SurfaceArea() + inheritance_cost;
+				};
+				const float cost0 = child_cost(c0);
+				const float cost1 = child_cost(c1);
+
+				if (cost < cost0 && cost < cost1)
+				{
+					break;
+				}
+				index = cost0 < cost1 ? c0 : c1;
+			}
+
+			//sibling和新叶子共用一个新的父结点
+			const int sibling = index;
+			const int old_parent = nodes[sibling].parent;
+			const int new_parent = AllocateNode();
+			nodes[new_parent].parent = old_parent;
+			nodes[new_parent].box = leaf_box.Union(nodes[sibling].box);
+			nodes[new_parent].height = nodes[sibling].height + 1;
+			nodes[new_parent].child[0] = sibling;
+			nodes[new_parent].child[1] = leaf;
+			nodes[sibling].parent = new_parent;
+			nodes[leaf].parent = new_parent;
+
+			if (old_parent == null_node)
+			{
+				root = new_parent;
+			}
+			else
+			{
+				Node& p = nodes[old_parent];
+				p.child[p.child[0] == sibling ? 0 : 1] = new_parent;
+			}
+
+			Refit(nodes[leaf].parent);
+		}
+
+		void RemoveLeaf(int leaf)
+		{
+			if (leaf == root)
+			{
+				root = null_node;
+				return;
+			}
+
+			//父结点被删掉，兄弟结点顶替父结点的位置
+			const int parent = nodes[leaf].parent;
+			const int grand_parent = nodes[parent].parent;
+			const int sibling = nodes[parent].child[nodes[parent].child[0] == leaf ? 1 : 0];
+
+			if (grand_parent == null_node)
+			{
+				root = sibling;
+				nodes[sibling].parent = null_node;
+			}
+			else
+			{
+				Node& g = nodes[grand_parent];
+				g.child[g.child[0] == parent ? 0 : 1] = sibling;
+				nodes[sibling].parent = grand_parent;
+				Refit(grand_parent);
+			}
+			FreeNode(parent);
+		}
+
+		//从index往上重新计算包围盒和高度，顺便做旋转保持平衡
+		void Refit(int index)
+		{
+			while (index != null_node)
+			{
+				index = Balance(index);
+				Node& n = nodes[index];
+				const Node& c0 = nodes[n.child[0]];
+				const Node& c1 = nodes[n.child[1]];
+				n.height = 1 + (std::max)(c0.height, c1.height);
+				n.box = c0.box.Union(c1.box);
+				index = n.parent;
+			}
+		}
+
+		//a的某个子树比另一个高2以上时做一次旋转，把高的子树提上来，返回旋转后在原位置上的结点
+		int Balance(int a)
+		{
+			if (nodes[a].IsLeaf() || nodes[a].height < 2)
+			{
+				return a;
+			}
+			const int b = nodes[a].child[0];
+			const int c = nodes[a].child[1];
+			const int balance = nodes[c].height - nodes[b].height;
+			if (balance > 1)
+			{
+				return Rotate(a, 1);
+			}
+			if (balance < -1)
+			{
+				return Rotate(a, 0);
+			}
+			return a;
+		}
+
+		//把a的第side个子结点提到a的位置上
+		int Rotate(int a, int side)
+		{
+			const int up = nodes[a].child[side];
+			const int f = nodes[up].child[0];
+			const int g = nodes[up].child[1];
+
+			//up取代a
+			nodes[up].child[0] = a;
+			nodes[up].parent = nodes[a].parent;
+			nodes[a].parent = up;
+			if (nodes[up].parent == null_node)
+			{
+				root = up;
+			}
+			else
+			{
+				Node& p = nodes[nodes[up].parent];
+				p.child[p.child[0] == a ? 0 : 1] = up;
+			}
+
+			//up的两个子结点中高的留在up下面，矮的交给a
+			const int keep = nodes[f].height > nodes[g].height ? f : g;
+			const int give = keep == f ? g : f;
+			nodes[up].child[1] = keep;
+			nodes[a].child[side] = give;
+			nodes[give].parent = a;
+
+			const Node& a0 = nodes[nodes[a].child[0]];
+			const Node& a1 = nodes[nodes[a].child[1]];
+			nodes[a].box = a0.box.Union(a1.box);
+			nodes[a].height = 1 + (std::max)(a0.height, a1.height);
+			nodes[up].box = nodes[a].box.Union(nodes[keep].box);
+			nodes[up].height = 1 + (std::max)(nodes[a].height, nodes[keep].height);
+			return up;
+		}
+	};
+}
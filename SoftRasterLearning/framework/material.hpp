@@ -1,5 +1,7 @@
 ﻿#pragma once
 
+#include "../core/command_list.hpp"
+
 namespace framework
 {
 	class IRenderEngine;
@@ -9,7 +11,14 @@ namespace framework
 	class IMaterial
 	{
 	public:
+		//立即绘制
 		virtual void Render(const Entity&, IRenderEngine&) = 0;
+		//录制到命令列表中，默认是把整个Render推迟到回放的时候，这样录制本身没有做任何工作
+		//材质应该在这里准备好shader数据，只把绘制录制下来，这样材质设置可以在多个线程中进行
+		virtual void Record(const Entity& entity, IRenderEngine& engine, core::CommandList& list)
+		{
+			list.Record([this, &entity, &engine] { Render(entity, engine); });
+		}
 		virtual ~IMaterial() = default;
 	};
 }
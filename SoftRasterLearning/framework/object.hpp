@@ -2,6 +2,7 @@
 
 #include "../core/software_renderer.hpp"
 #include "../core/model.hpp"
+#include "../core/command_list.hpp"
 #include "material.hpp"
 #include <memory>
 
@@ -9,11 +10,47 @@ namespace framework
 {
 	class IRenderEngine;
 
+	//选择LOD时需要的摄像机信息
+	struct LodView
+	{
+		core::Mat view_projection;
+		float pixel_scale; //距离摄像机(裁剪空间的w)为1处，一个单位长度在屏幕上占多少像素
+
+		LodView(const core::Mat& vp, float viewport_height) :
+			view_projection(vp)
+		{
+			//视图矩阵是刚体变换，投影*视图矩阵第二行的长度就是投影矩阵的y方向缩放
+			const core::Vec3 row1 = core::Vec4(vp.Transpose().column[1]);
+			pixel_scale = row1.Length() * viewport_height * 0.5f;
+		}
+
+		//点p处一个单位长度在屏幕上的像素数，点在摄像机附近或者后面时返回无穷大
+		float PixelsPerUnit(const core::Vec3& p) const
+		{
+			const float w = (view_projection * core::Vec4(p, 1.f)).w;
+			return w > 1e-4f ? pixel_scale / w : core::inf;
+		}
+	};
+
 	//渲染接口
 	class IRenderAble
 	{
 	public:
 		virtual void Render(IRenderEngine& engine) const = 0;
+		//录制到命令列表中，默认是把整个Render推迟到回放的时候
+		virtual void Record(IRenderEngine& engine, core::CommandList& list) const
+		{
+			list.Record([this, &engine] { Render(engine); });
+		}
+		//世界空间的包围球，用于视锥剔除，返回false表示没有包围球，这样的物体总是会被绘制
+		virtual bool GetBoundingSphere(core::BoundingSphere& sphere) const
+		{
+			return false;
+		}
+		//每帧绘制之前根据在屏幕上的大小选择LOD
+		virtual void SelectLod(const LodView& view)
+		{
+		}
 	};
 
 	//...
@@ -44,6 +81,140 @@ namespace framework
 	{
 	public:
 		std::shared_ptr<core::Model> model;
+		size_t lod = 0; //当前使用的LOD
+		float lod_error_pixels = 1.f; //LOD的误差投影到屏幕上不超过这么多像素
+
+		//当前LOD的索引，材质用它和model->mesh一起绘制
+		const std::vector<core::uint32>& GetIndices() const
+		{
+			return model->GetLodIndices((std::min)(lod, model->GetLodCount() - 1));
+		}
+
+		//用renderer绘制模型，默认用当前LOD的索引，模型压缩过时从压缩的顶点解码
+		template<typename R>
+		void Draw(R& renderer) const
+		{
+			Draw(renderer, GetIndices());
+		}
+
+		template<typename R>
+		void Draw(R& renderer, const std::vector<core::uint32>& indices) const
+		{
+			if (indices.empty())
+			{
+				return;
+			}
+			if (model->IsPacked())
+			{
+				renderer.DrawIndex(model->packed, indices.data(), indices.size());
+			}
+			else
+			{
+				renderer.DrawIndex(model->mesh.data(), indices.data(), indices.size());
+			}
+		}
+
+		//用renderer实例化绘制当前LOD
+		template<typename R, typename Instance>
+		void DrawInstanced(R& renderer, const Instance* instances, size_t instance_count) const
+		{
+			const auto& indices = GetIndices();
+			if (indices.empty())
+			{
+				return;
+			}
+			if (model->IsPacked())
+			{
+				renderer.DrawIndexedInstanced(model->packed, indices.data(), indices.size(), instances, instance_count);
+			}
+			else
+			{
+				renderer.DrawIndexedInstanced(model->mesh.data(), indices.data(), indices.size(), instances, instance_count);
+			}
+		}
+
+		//录制到命令列表中的版本
+		template<size_t render_flag = core::RF_DEFAULT, typename Shader, typename FsOut, typename Format>
+		void Draw(core::CommandList& list, core::Context<FsOut, Format>& ctx, const Shader& shader) const
+		{
+			const auto& indices = GetIndices();
+			if (indices.empty())
+			{
+				return;
+			}
+			if (model->IsPacked())
+			{
+				list.DrawIndex<render_flag>(ctx, shader, model->packed, indices.data(), indices.size());
+			}
+			else
+			{
+				list.DrawIndex<render_flag>(ctx, shader, model->mesh.data(), indices.data(), indices.size());
+			}
+		}
+
+		template<size_t render_flag = core::RF_DEFAULT, typename Shader, typename FsOut, typename Format, typename Instance>
+		void DrawInstanced(core::CommandList& list, core::Context<FsOut, Format>& ctx, const Shader& shader, std::vector<Instance> instances) const
+		{
+			const auto& indices = GetIndices();
+			if (indices.empty())
+			{
+				return;
+			}
+			if (model->IsPacked())
+			{
+				list.DrawIndexedInstanced<render_flag>(ctx, shader, model->packed, indices.data(), indices.size(), std::move(instances));
+			}
+			else
+			{
+				list.DrawIndexedInstanced<render_flag>(ctx, shader, model->mesh.data(), indices.data(), indices.size(), std::move(instances));
+			}
+		}
+
+		void SelectLod(const LodView& view) override
+		{
+			if (model)
+			{
+				SelectLodByScale(ModelPixelsPerUnit(view, transform));
+			}
+		}
+
+		bool GetBoundingSphere(core::BoundingSphere& sphere) const override
+		{
+			if (!model || !model->bounding_sphere.IsValid())
+			{
+				return false;
+			}
+			sphere = model->bounding_sphere.Transform(transform.GetModelMatrix());
+			return true;
+		}
+
+	protected:
+		//切换LOD的滞后量，变简单时误差要比阈值小这么多，避免在阈值附近来回切换
+		static constexpr float lod_hysteresis = 0.25f;
+
+		//模型以transform摆放时，模型空间的一个单位长度在屏幕上的像素数
+		float ModelPixelsPerUnit(const LodView& view, const Transform& t) const
+		{
+			const core::Vec3 center = core::Vec3(t.GetModelMatrix() * core::Vec4(model->bounding_sphere.center, 1.f));
+			const float scale = (std::max)({ std::abs(t.scale.x), std::abs(t.scale.y), std::abs(t.scale.z) });
+			return view.PixelsPerUnit(center) * scale;
+		}
+
+		//pixels_per_unit是模型空间的单位长度在屏幕上的像素数，误差超过阈值就换精细的LOD，低于阈值一定比例才换简单的
+		void SelectLodByScale(float pixels_per_unit)
+		{
+			const size_t count = model->GetLodCount();
+			size_t level = (std::min)(lod, count - 1);
+			while (level > 0 && model->GetLodError(level) * pixels_per_unit > lod_error_pixels)
+			{
+				--level;
+			}
+			while (level + 1 < count && model->GetLodError(level + 1) * pixels_per_unit <= lod_error_pixels * (1.f - lod_hysteresis))
+			{
+				++level;
+			}
+			lod = level;
+		}
 	};
 
 	//拥有材质的物体
@@ -55,5 +226,46 @@ namespace framework
 		{
 			material->Render(*this, engine);
 		}
+		void Record(framework::IRenderEngine& engine, core::CommandList& list) const override
+		{
+			material->Record(*this, engine, list);
+		}
+	};
+
+	//共用同一个模型的一组物体，支持实例化的材质会用一次draw call把它们全部画出来
+	class InstancedEntity : public MaterialEntity
+	{
+	public:
+		std::vector<std::shared_ptr<MaterialEntity>> instances; //每个实例的位置和材质参数
+
+		//所有实例的包围球合并起来，实例用的是这组物体的模型
+		bool GetBoundingSphere(core::BoundingSphere& sphere) const override
+		{
+			if (!model || !model->bounding_sphere.IsValid())
+			{
+				return false;
+			}
+			sphere = {};
+			for (const auto& o : instances)
+			{
+				sphere = sphere.Merge(model->bounding_sphere.Transform(o->transform.GetModelMatrix()));
+			}
+			return sphere.IsValid();
+		}
+
+		//所有实例共用一个LOD，按离摄像机最近(在屏幕上最大)的实例来选
+		void SelectLod(const LodView& view) override
+		{
+			if (!model)
+			{
+				return;
+			}
+			float pixels_per_unit = 0.f;
+			for (const auto& o : instances)
+			{
+				pixels_per_unit = (std::max)(pixels_per_unit, ModelPixelsPerUnit(view, o->transform));
+			}
+			SelectLodByScale(pixels_per_unit);
+		}
 	};
 };
@@ -2,6 +2,10 @@
 
 #include "object.hpp"
 #include "render_engine.hpp"
+#include "bvh.hpp"
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
 #include <memory.h>
 
 namespace framework
@@ -14,6 +18,11 @@ namespace framework
 		virtual void HandleInput(const IRenderEngine&) = 0;
 		virtual void RenderFrame(IRenderEngine&) = 0;
 		virtual const ICamera* GetMainCamera() const = 0;
+		//场景需要的每像素采样点数量(MSAA)，引擎在渲染这个场景前按它设置主颜色缓冲
+		virtual size_t GetSampleCount() const
+		{
+			return 1;
+		}
 	};
 
 	class Scene : public IScene
@@ -49,17 +58,210 @@ namespace framework
 		virtual void Init(IRenderEngine& engine) override {};
 		virtual void Update(const IRenderEngine&) override {};
 		virtual void HandleInput(const IRenderEngine&) override {};
+		//更新所有物体的包围球和BVH，物体的transform可以随时修改，所以每帧都要重新取一次包围球
+		//包围球在多个线程中计算，包围球没变的物体不碰树，变了的也只有移出了fat AABB才会在树中重新插入
+		//叶子按物体的地址对应，objects重新排序或者删除了物体也能找到原来的叶子，删掉的物体的叶子会被移除
+		void UpdateBounds()
+		{
+			const int n = core::narrow_cast<int>(objects.size());
+			object_bounds.resize(n);
+
+#pragma omp parallel for schedule(static)
+			for (int i = 0; i < n; ++i)
+			{
+				if (!objects[i]->GetBoundingSphere(object_bounds[i]))
+				{
+					object_bounds[i] = {};
+				}
+			}
+
+			++bounds_frame;
+			unbounded_objects.clear();
+			for (int i = 0; i < n; ++i)
+			{
+				const core::BoundingSphere& sphere = object_bounds[i];
+				if (!sphere.IsValid())
+				{
+					//原来有叶子的话在后面和删掉的物体一起移除
+					unbounded_objects.push_back(i);
+					continue;
+				}
+				Proxy& proxy = proxies[objects[i].get()];
+				proxy.frame = bounds_frame;
+				if (proxy.leaf == DynamicBVH::null_node)
+				{
+					proxy.leaf = bvh.Insert(sphere.GetAABB(), i);
+				}
+				else
+				{
+					//物体在objects中的下标可能变了
+					bvh.SetUserData(proxy.leaf, i);
+					const bool moved = sphere.radius != proxy.sphere.radius || sphere.center.x != proxy.sphere.center.x ||
+						sphere.center.y != proxy.sphere.center.y || sphere.center.z != proxy.sphere.center.z;
+					if (moved)
+					{
+						bvh.Move(proxy.leaf, sphere.GetAABB());
+					}
+				}
+				proxy.sphere = sphere;
+			}
+
+			//这一帧没有出现在objects中(被删除了)或者没有包围球了的物体
+			for (auto it = proxies.begin(); it != proxies.end();)
+			{
+				if (it->second.frame != bounds_frame)
+				{
+					bvh.Remove(it->second.leaf);
+					it = proxies.erase(it);
+				}
+				else
+				{
+					++it;
+				}
+			}
+		}
+
+		//和球相交的物体(按包围球判断)，没有包围球的物体不会被返回，结果按物体的顺序排列
+		//用的是上一次UpdateBounds的结果
+		void QuerySphere(const core::Vec3& center, float radius, std::vector<std::shared_ptr<IRenderAble>>& result) const
+		{
+			query_index.clear();
+			bvh.QuerySphere(center, radius, [&](size_t i) {
+				const core::BoundingSphere& s = object_bounds[i];
+				const core::Vec3 d = s.center - center;
+				if (d.Dot(d) <= (s.radius + radius) * (s.radius + radius))
+				{
+					query_index.push_back(i);
+				}
+			});
+			std::sort(query_index.begin(), query_index.end());
+			for (size_t i : query_index)
+			{
+				result.push_back(objects[i]);
+			}
+		}
+
+		//射线拾取，返回包围球最先被射线(origin + t * dir)碰到的物体，t_hit是碰到的位置，dir不需要归一化
+		std::shared_ptr<IRenderAble> Raycast(const core::Vec3& origin, const core::Vec3& dir, float& t_hit, float t_max = (std::numeric_limits<float>::max)()) const
+		{
+			std::shared_ptr<IRenderAble> hit;
+			t_hit = t_max;
+			const float a = dir.Dot(dir);
+			bvh.QueryRay(origin, dir, t_max, [&](size_t i, float t_near) {
+				if (t_near > t_hit)
+				{
+					return;
+				}
+				//射线和球求交
+				const core::BoundingSphere& s = object_bounds[i];
+				const core::Vec3 oc = origin - s.center;
+				const float b = oc.Dot(dir);
+				const float c = oc.Dot(oc) - s.radius * s.radius;
+				const float delta = b * b - a * c;
+				if (delta < 0.f)
+				{
+					return;
+				}
+				float t = (-b - std::sqrt(delta)) / a;
+				if (t < 0.f)
+				{
+					//起点在球内
+					t = 0.f;
+				}
+				if (t <= t_hit && (-b + std::sqrt(delta)) >= 0.f)
+				{
+					t_hit = t;
+					hit = objects[i];
+				}
+			});
+			return hit;
+		}
+
+		//先用摄像机的视锥剔除看不见的物体，剩下的物体被分成几段，每段在一个线程中录制成一个命令列表，再按物体的顺序回放，所以绘制的顺序和原来一样
 		virtual void RenderFrame(IRenderEngine& engine) override
 		{
-			for (auto& object : objects)
+			UpdateBounds();
+			CullObjects(engine);
+
+			const int count = core::narrow_cast<int>((visible_objects.size() + objects_per_list - 1) / objects_per_list);
+			if (command_lists.size() < (size_t)count)
+			{
+				command_lists.resize(count);
+			}
+
+#pragma omp parallel for schedule(dynamic)
+			for (int i = 0; i < count; ++i)
 			{
-				object->Render(engine);
+				const size_t end = (std::min)((i + 1) * objects_per_list, visible_objects.size());
+				for (size_t j = i * objects_per_list; j < end; ++j)
+				{
+					visible_objects[j]->Record(engine, command_lists[i]);
+				}
+			}
+
+			for (int i = 0; i < count; ++i)
+			{
+				command_lists[i].Execute();
 			}
 		};
 
 		virtual ~Scene() = default;
 
 	protected:
+		//用BVH做视锥剔除，结果放在visible_objects里，保持原来的顺序，没有摄像机或者没有包围球的物体都算可见
+		void CullObjects(IRenderEngine& engine)
+		{
+			visible_objects.clear();
+			const ICamera* camera = engine.GetMainCamera();
+			if (!camera)
+			{
+				for (const auto& o : objects)
+				{
+					visible_objects.push_back(o.get());
+				}
+				return;
+			}
+
+			const core::Frustum frustum = core::Frustum::FromMatrix(camera->GetProjectionViewMatrix());
+			query_index.assign(unbounded_objects.begin(), unbounded_objects.end());
+			bvh.QueryFrustum(frustum, [&](size_t i) {
+				//叶子上是放大过的包围盒，再用包围球精确地测一次
+				if (frustum.Intersects(object_bounds[i]))
+				{
+					query_index.push_back(i);
+				}
+			});
+			std::sort(query_index.begin(), query_index.end());
+
+			//可见的物体根据屏幕上的大小选择LOD
+			const LodView lod_view = { camera->GetProjectionViewMatrix(), (float)engine.GetCtx().depth_buffer_view.h };
+			for (size_t i : query_index)
+			{
+				objects[i]->SelectLod(lod_view);
+				visible_objects.push_back(objects[i].get());
+			}
+		}
+
+		//每个命令列表录制的物体数量
+		static constexpr size_t objects_per_list = 4;
+
 		std::vector<std::shared_ptr<IRenderAble>> objects;
+		std::vector<const IRenderAble*> visible_objects; //这一帧通过视锥剔除的物体
+
+		//物体在bvh中的叶子
+		struct Proxy
+		{
+			int leaf = DynamicBVH::null_node;
+			core::BoundingSphere sphere; //插入或者移动叶子时的包围球
+			size_t frame = 0; //最后一次出现在objects中是第几次UpdateBounds
+		};
+
+		DynamicBVH bvh; //所有有包围球的物体，叶子的user_data是物体在objects中的下标，每次UpdateBounds时更新
+		std::vector<core::BoundingSphere> object_bounds; //每个物体世界空间的包围球，没有的是无效的球
+		std::unordered_map<const IRenderAble*, Proxy> proxies; //按物体的地址找它在bvh中的叶子
+		size_t bounds_frame = 0; //UpdateBounds的次数
+		std::vector<size_t> unbounded_objects; //没有包围球的物体，总是可见
+		mutable std::vector<size_t> query_index;
+		std::vector<core::CommandList> command_lists;
 	};
 }
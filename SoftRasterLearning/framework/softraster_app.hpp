@@ -92,6 +92,7 @@ namespace framework
 					Update();
 
 					RenderFrame();
+					ctx.Resolve();
 					ctx.CopyToBuffer(dc_wnd.GetFrameBufferView());
 					dc_wnd.BitBltBuffer();
 					EndFrame();
@@ -257,6 +258,12 @@ namespace framework
 		//渲染每帧
 		virtual void RenderFrame() override
 		{
+			//切换场景后采样点数量可能变了，重新分配颜色缓冲
+			const size_t samples = scene->GetSampleCount();
+			if (samples != ctx.sample_count)
+			{
+				ctx.Viewport(ctx.back_buffer_view.w, ctx.back_buffer_view.h, samples);
+			}
 			ctx.Clear({ 0.05f, 0.05f, 0.05f, 1.f });
 			scene->RenderFrame(*this);
 		}
@@ -38,7 +38,10 @@ namespace loader::bmp
 #pragma pack(pop)
 
 
-	std::shared_ptr<core::Texture> LoadFromFile(const wchar_t* file_path, bool b_gamma_conrrection = true)
+	//format是加载之后的储存格式，默认不压缩
+	//b_generate_mips为true时生成mipmap，只有用SampleLevel/SampleGrad采样的贴图需要，会多占三分之一的内存
+	std::shared_ptr<core::Texture> LoadFromFile(const wchar_t* file_path, bool b_gamma_conrrection = true,
+		core::ETextureFormat format = core::ETextureFormat::RGBA32F, bool b_generate_mips = false)
 	{
 		std::ifstream bmp_file;
 		bmp_file.open(file_path, std::ios::binary | std::ios::in);
@@ -83,7 +86,7 @@ namespace loader::bmp
 			};
 		}
 
-		std::vector<core::Vec4>& tex_data = texture.GetData();
+		auto& tex_data = texture.GetData();
 		if (b_gamma_conrrection) {
 			std::transform(tex_data.begin(), tex_data.end(), tex_data.begin(),
 				[](core::Vec4 color) {
@@ -96,6 +99,13 @@ namespace loader::bmp
 				});
 		}
 
+		//在线性空间生成mipmap
+		if (b_generate_mips)
+		{
+			texture.GenerateMips();
+		}
+		texture.Convert(format);
+
 		return std::make_shared<core::Texture>(std::move(texture));
 	}
 }
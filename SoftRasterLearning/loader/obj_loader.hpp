@@ -6,6 +6,8 @@
 #include <tuple>
 #include <optional>
 #include <type_traits>
+#include <unordered_map>
+#include <cmath>
 #include "../core/types_and_defs.hpp"
 #include "../core/model.hpp"
 
@@ -19,15 +21,37 @@ namespace loader::obj
 	template<typename T> using Opt = std::optional<T>;
 	using Model_Vertex = core::Model_Vertex;
 	using Model = core::Model;
+	using uint32 = core::uint32;
 
 	struct ObjParser
 	{
+		//面上的一个顶点引用的 位置/uv/法线 下标
+		struct VertexRef
+		{
+			size_t v[3];
+
+			bool operator==(const VertexRef& rhs) const noexcept
+			{
+				return v[0] == rhs.v[0] && v[1] == rhs.v[1] && v[2] == rhs.v[2];
+			}
+		};
+
+		struct VertexRefHash
+		{
+			size_t operator()(const VertexRef& r) const noexcept
+			{
+				return (r.v[0] * 73856093) ^ (r.v[1] * 19349663) ^ (r.v[2] * 83492791);
+			}
+		};
+
 		struct IntermediateData
 		{
 			std::vector<Vec3> position_buffer;
 			std::vector<Vec3> normal_buffer;
 			std::vector<Vec2> uv_buffer;
-			std::vector<Model_Vertex> mesh;
+			std::vector<Model_Vertex> mesh; //去重之后的顶点
+			std::vector<uint32> indices;
+			std::unordered_map<VertexRef, uint32, VertexRefHash> vertex_map; //面上引用的顶点 -> mesh中的下标
 		};
 
 		Model ParseObjStr(SV src)
@@ -40,6 +64,8 @@ namespace loader::obj
 			data.normal_buffer.reserve(guess);
 			data.uv_buffer.reserve(guess);
 			data.mesh.reserve(guess);
+			data.indices.reserve(guess * 2);
+			data.vertex_map.reserve(guess);
 
 			size_t len = src.length();
 			for (size_t i = 0; i < len;)
@@ -57,17 +83,22 @@ namespace loader::obj
 
 			CreateTriangle(data);
 
-			return std::move(*reinterpret_cast<Model*>(&data.mesh));
+			Model model;
+			model.mesh = std::move(data.mesh);
+			model.indices = std::move(data.indices);
+			model.ComputeBounds();
+			return model;
 		}
 
 		void CreateTriangle(IntermediateData& data)
 		{
-			size_t len = data.mesh.size();
+			//顶点被多个三角形共用，先把每个三角形的切线累加到顶点上
+			size_t len = data.indices.size();
 			for (size_t i = 0; i < len; i += 3)
 			{
-				auto& v0 = data.mesh[i];
-				auto& v1 = data.mesh[i + 1];
-				auto& v2 = data.mesh[i + 2];
+				auto& v0 = data.mesh[data.indices[i]];
+				auto& v1 = data.mesh[data.indices[i + 1]];
+				auto& v2 = data.mesh[data.indices[i + 2]];
 
 				Vec3 e0 = v1.position - v0.position;
 				Vec3 e1 = v2.position - v0.position;
@@ -80,14 +111,43 @@ namespace loader::obj
 				float ty = f * (duv1.y * e0.y - duv0.y * e1.y);
 				float tz = f * (duv1.y * e0.z - duv0.y * e1.z);
 
+				//uv退化的三角形没有切线
+				if (!std::isfinite(tx) || !std::isfinite(ty) || !std::isfinite(tz))
+				{
+					continue;
+				}
+
 				//求出平面的切线
 				Vec3 tangent = Vec3{ tx,ty,tz }.Normalize();
 
-				//求出每个顶点的切线（因为可能有自定义法线）
-				v0.tangent = (tangent - (tangent.Dot(v0.normal) * v0.normal)).Normalize();
-				v1.tangent = (tangent - (tangent.Dot(v1.normal) * v1.normal)).Normalize();
-				v2.tangent = (tangent - (tangent.Dot(v2.normal) * v2.normal)).Normalize();
+				v0.tangent += tangent;
+				v1.tangent += tangent;
+				v2.tangent += tangent;
+			}
+
+			//求出每个顶点的切线（因为可能有自定义法线）
+			for (auto& v : data.mesh)
+			{
+				Vec3 tangent = v.tangent - (v.tangent.Dot(v.normal) * v.normal);
+				if (tangent.Dot(tangent) < 1e-12f)
+				{
+					//相邻三角形的uv都退化(或者切线互相抵消)，没有可用的切线，随便取一个和法线垂直的方向
+					const Vec3 axis = std::fabs(v.normal.x) < 0.9f ? Vec3{ 1.f,0.f,0.f } : Vec3{ 0.f,1.f,0.f };
+					tangent = v.normal.Cross(axis);
+				}
+				v.tangent = tangent.Normalize();
+			}
+		}
+
+		//添加面上的一个顶点，相同的 位置/uv/法线 组合只储存一次
+		void AddVertex(IntermediateData& data, const size_t(&ref)[3])
+		{
+			auto [it, inserted] = data.vertex_map.try_emplace(VertexRef{ { ref[0], ref[1], ref[2] } }, (uint32)data.mesh.size());
+			if (inserted)
+			{
+				data.mesh.emplace_back(data.position_buffer[ref[0] - 1], data.uv_buffer[ref[1] - 1], data.normal_buffer[ref[2] - 1]);
 			}
+			data.indices.push_back(it->second);
 		}
 
 		static Opt<std::tuple<SV, SV>> MatchToken(SV src)
@@ -241,12 +301,12 @@ namespace loader::obj
 					size_t c[3] = { match_int(token3.data()),match_int(), match_int() };
 					size_t d[3] = { match_int(token4.data()),match_int(), match_int() };
 
-					data.mesh.emplace_back(data.position_buffer[a[0] - 1], data.uv_buffer[a[1] - 1], data.normal_buffer[a[2] - 1]);
-					data.mesh.emplace_back(data.position_buffer[b[0] - 1], data.uv_buffer[b[1] - 1], data.normal_buffer[b[2] - 1]);
-					data.mesh.emplace_back(data.position_buffer[c[0] - 1], data.uv_buffer[c[1] - 1], data.normal_buffer[c[2] - 1]);
-					data.mesh.emplace_back(data.position_buffer[d[0] - 1], data.uv_buffer[d[1] - 1], data.normal_buffer[d[2] - 1]);
-					data.mesh.emplace_back(data.position_buffer[a[0] - 1], data.uv_buffer[a[1] - 1], data.normal_buffer[a[2] - 1]);
-					data.mesh.emplace_back(data.position_buffer[c[0] - 1], data.uv_buffer[c[1] - 1], data.normal_buffer[c[2] - 1]);
+					AddVertex(data, a);
+					AddVertex(data, b);
+					AddVertex(data, c);
+					AddVertex(data, d);
+					AddVertex(data, a);
+					AddVertex(data, c);
 					return;
 				}
 
@@ -260,9 +320,9 @@ namespace loader::obj
 					size_t b[3] = { match_int(token2.data()),match_int(), match_int() };
 					size_t c[3] = { match_int(token3.data()),match_int(), match_int() };
 
-					data.mesh.emplace_back(data.position_buffer[a[0] - 1], data.uv_buffer[a[1] - 1], data.normal_buffer[a[2] - 1]);
-					data.mesh.emplace_back(data.position_buffer[b[0] - 1], data.uv_buffer[b[1] - 1], data.normal_buffer[b[2] - 1]);
-					data.mesh.emplace_back(data.position_buffer[c[0] - 1], data.uv_buffer[c[1] - 1], data.normal_buffer[c[2] - 1]);
+					AddVertex(data, a);
+					AddVertex(data, b);
+					AddVertex(data, c);
 
 					return;
 				}
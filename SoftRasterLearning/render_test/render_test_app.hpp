@@ -51,6 +51,11 @@ public:
 	{
 		return sub_scenes[sub_scene_id]->GetMainCamera();
 	}
+
+	virtual size_t GetSampleCount() const override
+	{
+		return sub_scenes[sub_scene_id]->GetSampleCount();
+	}
 };
 
 class RenderTestApp final : public framework::SoftRasterApp
@@ -68,13 +73,28 @@ protected:
 		auto _bunny = loader::obj::LoadFromFile(L".\\resource\\models\\bunny2.obj");
 		auto _sphere = loader::obj::LoadFromFile(L".\\resource\\models\\sphere.obj");
 		auto _box = loader::obj::LoadFromFile(L".\\resource\\models\\box.obj");
+		//远处的兔子和球用简化过的模型
+		core::GenerateLods(*_bunny);
+		core::GenerateLods(*_sphere);
+		//重排三角形和顶点，提高顶点缓存命中率、减少overdraw
+		core::OptimizeModel(*_bunny);
+		core::OptimizeModel(*_sphere);
+		core::OptimizeModel(*_box);
+		//兔子的顶点压缩之后只有原来的三分之一左右
+		_bunny->Pack(true);
 
-		auto _tex = loader::bmp::LoadFromFile(L".\\resource\\pictures\\tex0.bmp");
-		auto _sunlight_icon = loader::bmp::LoadFromFile(L".\\resource\\pictures\\icon\\sunlight.bmp");
-		auto _bulblight_icon = loader::bmp::LoadFromFile(L".\\resource\\pictures\\icon\\bulblight.bmp");
+		//颜色贴图按sRGB储存，法线贴图只存x,y，都是原来的四分之一或八分之一
+		//tex0在blinn-phong场景里用SampleGrad做三线性采样，需要mipmap
+		auto _tex = loader::bmp::LoadFromFile(L".\\resource\\pictures\\tex0.bmp", true, core::ETextureFormat::RGBA8_SRGB, true);
+		auto _sunlight_icon = loader::bmp::LoadFromFile(L".\\resource\\pictures\\icon\\sunlight.bmp", true, core::ETextureFormat::RGBA8_SRGB);
+		auto _bulblight_icon = loader::bmp::LoadFromFile(L".\\resource\\pictures\\icon\\bulblight.bmp", true, core::ETextureFormat::RGBA8_SRGB);
 
-		auto _normal_map = loader::bmp::LoadFromFile(L".\\resource\\pictures\\normal.bmp", false);
-		auto _bunny_normal_map = loader::bmp::LoadFromFile(L".\\resource\\pictures\\bunny_normal.bmp", false);
+		auto _normal_map = loader::bmp::LoadFromFile(L".\\resource\\pictures\\normal.bmp", false, core::ETextureFormat::RG8_NORMAL);
+		auto _bunny_normal_map = loader::bmp::LoadFromFile(L".\\resource\\pictures\\bunny_normal.bmp", false, core::ETextureFormat::RG8_NORMAL);
+		//贴在模型上的贴图采样方向是任意的，按4x4的块排列
+		_tex->SetLayout(core::ETextureLayout::Tiled);
+		_normal_map->SetLayout(core::ETextureLayout::Tiled);
+		_bunny_normal_map->SetLayout(core::ETextureLayout::Tiled);
 
 
 		auto _front = loader::bmp::LoadFromFile(L".\\resource\\pictures\\cubemap\\front.bmp");
@@ -107,6 +127,8 @@ protected:
 				return core::Vec4{ _mm_sinh_ps(color * 2.1f) } / 2.1f; //把原来接近1的亮度提高到2, 而低亮度信息改变很少
 				});
 		}
+		//HDR的天空盒和环境光照贴图用半精度储存
+		_cubemap->Convert(core::ETextureFormat::RGBA16F);
 		//...
 		// 运行时计算环境光照贴图
 		//std::thread t{ [&]() {
@@ -119,6 +141,7 @@ protected:
 		//_env_map->Save(L".\\resource\\env\\evn.ibl"); //小心覆盖
 		//// 从文件加载光照贴图
 		_env_map->Load(L".\\resource\\env\\evn.ibl");
+		_env_map->Convert(core::ETextureFormat::RGBA16F);
 		//...
 		SoftRasterApp::Init();
 		scene = std::make_shared<RenderTestScene>();
@@ -4,6 +4,8 @@
 #include "../framework/framework.hpp"
 #include "vs_out_type.hpp"
 
+struct ShaderDrPBR;
+
 class MaterialDrPBR : public framework::IMaterial
 {
 public:
@@ -14,30 +16,74 @@ public:
 	float roughness = 0;
 	bool b_enable_light = false;
 	bool b_enable_ibl = true;
+	static constexpr size_t render_flag = core::RF_DEFAULT | core::RF_ENABLE_TILE_BINNING;
+	ShaderDrPBR MakeShader(const framework::Entity& entity, framework::IRenderEngine& engine);
 	virtual void Render(const framework::Entity& entity, framework::IRenderEngine& engine) override;
+	virtual void Record(const framework::Entity& entity, framework::IRenderEngine& engine, core::CommandList& list) override;
 };
 
 //输出到GBuffer
 struct ShaderDrPBR
 {
-	MaterialDrPBR* material = nullptr;
+	//每个实例的数据
+	struct Instance
+	{
+		core::Mat mvp;
+		core::Mat model;
+		core::Mat3 normal_mat; //保证法线矩阵是正交的
+
+		static Instance Create(const core::Mat& vp, const core::Mat& model)
+		{
+			return { vp * model, model, model.ToMat3x3().Inverse().Transpose() };
+		}
+	};
+
+	const MaterialDrPBR* material = nullptr; //不用实例化绘制时的材质
+	const std::vector<std::shared_ptr<framework::MaterialEntity>>* instance_entities = nullptr; //实例化绘制时每个实例的物体，FS按instance_id取它们的材质
 	core::Vec3 cam_pos_ws = {};
-	core::Mat mvp = {};
-	core::Mat model = {};
+	Instance instance = {}; //不用实例化绘制时用这个
+
+	//实例化绘制时每个实例的数据
+	std::vector<Instance> MakeInstances(const core::Mat& vp) const
+	{
+		std::vector<Instance> instances;
+		instances.reserve(instance_entities->size());
+		for (const auto& o : *instance_entities)
+		{
+			instances.push_back(Instance::Create(vp, o->transform.GetModelMatrix()));
+		}
+		return instances;
+	}
+
+	//片元所属实例的材质
+	const MaterialDrPBR& GetMaterial(const VsOut_Light_ws& v) const
+	{
+		if (!instance_entities)
+		{
+			return *material;
+		}
+		const size_t i = (std::min)((size_t)(v.instance_id + 0.5f), instance_entities->size() - 1);
+		return static_cast<const MaterialDrPBR&>(*(*instance_entities)[i]->material);
+	}
 
 	VsOut_Light_ws VS(const core::Model_Vertex& v) const
+	{
+		return VSInstanced(v, instance, 0);
+	}
+
+	VsOut_Light_ws VSInstanced(const core::Model_Vertex& v, const Instance& inst, core::uint32 instance_id) const
 	{
 		using namespace core;
 		VsOut_Light_ws vs_out{};
-		vs_out.position = mvp * v.position.ToHomoCoord();
-		vs_out.position_ws = model * v.position.ToHomoCoord();
-		vs_out.normal_ws = Vec3(model * v.normal).Normalize();
+		vs_out.position = inst.mvp * v.position.ToHomoCoord();
+		vs_out.position_ws = inst.model * v.position.ToHomoCoord();
+		vs_out.normal_ws = Vec3(inst.model * v.normal).Normalize();
 		vs_out.uv = v.uv;
-		Mat3 normal_mat = model.ToMat3x3().Inverse().Transpose(); //保证法线矩阵是正交的
-		Vec3 tangent = (normal_mat * v.tangent).Normalize();
-		Vec3 normal = (normal_mat * v.normal).Normalize();
+		Vec3 tangent = (inst.normal_mat * v.tangent).Normalize();
+		Vec3 normal = (inst.normal_mat * v.normal).Normalize();
 		Vec3 bitangent = normal.Cross(tangent).Normalize();
 		vs_out.TBN = { tangent, bitangent,normal };
+		vs_out.instance_id = (float)instance_id;
 		//...
 		return vs_out;
 	}
@@ -45,20 +91,21 @@ struct ShaderDrPBR
 	framework::GbufferType FS(const VsOut_Light_ws& v) const
 	{
 		using namespace core;
-		Vec3 albedo = material->albedo;
-		float metalness = material->metalness;
-		float roughness = material->roughness;
-		Vec3 N = Vec3(Texture::Sample(material->normal_map.get(), v.uv) * 2 - 1.f);
+		const MaterialDrPBR& material = GetMaterial(v);
+		Vec3 albedo = material.albedo;
+		float metalness = material.metalness;
+		float roughness = material.roughness;
+		Vec3 N = Vec3(Texture::Sample(material.normal_map.get(), v.uv) * 2 - 1.f);
 		N = (v.TBN * N).Normalize();
 		//Vec3 N = v.normal_ws.Normalize();
 		Vec3 V = cam_pos_ws - v.position_ws;
 		float d_cam = V.Length();
 		V = V.Normalize();
 		float NdotV = max(N.Dot(V), 0.0f);
-		auto& IBL = material->ibl;
+		auto& IBL = material.ibl;
 		core::Vec3 ambient = { 0.01f };
 		//计算环境光
-		if (IBL && material->b_enable_ibl)
+		if (IBL && material.b_enable_ibl)
 		{
 			Vec3 F0 = pbr::GetF0(albedo, metalness);
 			Vec3 F = pbr::FresnelSchlickRoughness(F0, NdotV, roughness);
@@ -86,7 +133,7 @@ struct ShaderDrPBR
 		}
 
 		framework::GbufferType g{};
-		g.base_color = Vec4(material->albedo, 1);
+		g.base_color = Vec4(albedo, 1);
 		g.ambient = ambient;
 		g.metallic = metalness;
 		g.roughness = roughness;
@@ -95,16 +142,49 @@ struct ShaderDrPBR
 	}
 };
 
-inline void MaterialDrPBR::Render(const framework::Entity& entity, framework::IRenderEngine& engine)
+//准备shader数据，一组物体用一次实例化绘制画出来，每个实例用自己的材质(包括贴图和IBL)，FS通过instance_id找到它
+inline ShaderDrPBR MaterialDrPBR::MakeShader(const framework::Entity& entity, framework::IRenderEngine& engine)
 {
-	//准备shader数据
 	ShaderDrPBR shader{ this };
-	shader.mvp = engine.GetMainCamera()->GetProjectionViewMatrix() * entity.transform.GetModelMatrix();
-	shader.model = entity.transform.GetModelMatrix();
 	shader.cam_pos_ws = engine.GetMainCamera()->GetPosition();
-	//渲染
-	core::Renderer<ShaderDrPBR> renderer = { engine.GetGBuffer(), shader };
-	renderer.DrawTriangles(&entity.model->mesh[0], entity.model->mesh.size());
+	if (auto* group = dynamic_cast<const framework::InstancedEntity*>(&entity))
+	{
+		shader.instance_entities = &group->instances;
+	}
+	else
+	{
+		shader.instance = ShaderDrPBR::Instance::Create(engine.GetMainCamera()->GetProjectionViewMatrix(), entity.transform.GetModelMatrix());
+	}
+	return shader;
+}
+
+inline void MaterialDrPBR::Render(const framework::Entity& entity, framework::IRenderEngine& engine)
+{
+	const ShaderDrPBR shader = MakeShader(entity, engine);
+	core::Renderer<ShaderDrPBR, render_flag> renderer = { engine.GetGBuffer(), shader };
+	if (shader.instance_entities)
+	{
+		const auto instances = shader.MakeInstances(engine.GetMainCamera()->GetProjectionViewMatrix());
+		entity.DrawInstanced(renderer, instances.data(), instances.size());
+	}
+	else
+	{
+		entity.Draw(renderer);
+	}
+}
+
+//shader数据在录制的线程中准备好，只把绘制录制下来
+inline void MaterialDrPBR::Record(const framework::Entity& entity, framework::IRenderEngine& engine, core::CommandList& list)
+{
+	const ShaderDrPBR shader = MakeShader(entity, engine);
+	if (shader.instance_entities)
+	{
+		entity.DrawInstanced<render_flag>(list, engine.GetGBuffer(), shader, shader.MakeInstances(engine.GetMainCamera()->GetProjectionViewMatrix()));
+	}
+	else
+	{
+		entity.Draw<render_flag>(list, engine.GetGBuffer(), shader);
+	}
 }
 
 class SceneRenderTestDrPBR : public framework::Scene
@@ -138,7 +218,8 @@ public:
 		light3->dirction = { 0,0.5f,0.5f };
 		light3->color = 0.4f;
 
-		//创建3x3个球体，x轴roughness增大,y轴metallic增大
+		//创建2x4个兔子，x轴roughness增大,y轴metallic增大，它们共用一个模型，合成一组做实例化绘制
+		auto bunny_group = Spawn<framework::InstancedEntity>();
 		for (size_t j = 0; j < 2; j++)
 		{
 			for (size_t i = 0; i < 4; i++)
@@ -149,7 +230,7 @@ public:
 				material->roughness = i / 3.f;
 				material->normal_map = framework::GetResource<core::Texture>(L"bunny_normal_map").value();
 				material->ibl = framework::GetResource<core::pbr::IBL>(L"env_map").value();
-				auto bunny = Spawn<framework::MaterialEntity>();
+				auto bunny = std::make_shared<framework::MaterialEntity>();
 				bunny->transform.position = { i * 2.f,j * 2.f,0 };
 				bunny->model = framework::GetResource<core::Model>(L"bunny").value();
 				bunny->transform.scale *= 10.f;
@@ -157,6 +238,9 @@ public:
 				bunnys.push_back(bunny);
 			}
 		}
+		bunny_group->model = framework::GetResource<core::Model>(L"bunny").value();
+		bunny_group->material = bunnys[0]->material;
+		bunny_group->instances = bunnys;
 
 		//创建摄像机
 		target_camera = std::make_shared<framework::TargetCamera>(bunnys[4], 10.f, 0.f, 0.1f);
@@ -252,19 +336,14 @@ public:
 
 		if (b_show_light_icon)
 		{
-			//画家算法对光源（透明物体进行排序）
-			std::sort(lights.begin(), lights.end(), [&](auto l1, auto l2) {
-				//转换到NDC空间
-				auto vp = camera->GetProjectionViewMatrix();
-				auto p1 = vp * l1->transform.position.ToHomoCoord();
-				auto p2 = vp * l2->transform.position.ToHomoCoord();
-				return p1.z / p1.w > p2.z / p2.w;
-				});
-
+			//光源图标是半透明的，用OIT画，不需要再按深度排序
+			auto& ctx = engine.GetCtx();
+			ctx.BeginOIT();
 			for (auto& light : lights)
 			{
 				light->Render(engine);
 			}
+			ctx.ResolveOIT();
 		}
 	}
 
@@ -277,11 +356,18 @@ protected:
 		auto& gbuffer = engine.GetGBuffer();
 		auto& ctx = engine.GetCtx();
 		const int size = narrow_cast<int>(gbuffer.back_buffer.size());
+		const int w = narrow_cast<int>(gbuffer.back_buffer_view.w);
 		auto cam_pos_ws = engine.GetMainCamera()->GetPosition();
+		constexpr int block_size = (int)Context<PixelInfo>::hiz_block_size;
 
-#pragma omp parallel for num_threads(8)
+		//每个线程一次处理一整行块，SetPixel第一次写一个块时会先清除它，不能有两个线程同时写同一个块
+#pragma omp parallel for num_threads(8) schedule(static, w * block_size)
 		for (int i = 0; i < size; i++)
 		{
+			const int x = i % w;
+			const int y = i / w;
+			//G-Buffer中没画到东西的块不用处理
+			if (gbuffer.IsBlockCleared(x / block_size, y / block_size)) { continue; }
 			PixelInfo p_info = gbuffer.back_buffer[i];
 			if (p_info.base_color.a < 1e-8f) { continue; }
 			Color color = {};
@@ -368,11 +454,11 @@ protected:
 			//加上环境光和自发光
 			//计算ssao..暂时不做，太卡了
 			//
-			ctx.back_buffer[i] = color;
+			ctx.SetPixel(x, y, color);
 		}
 
 		//复制深度，这是个设计缺陷
-		std::copy(gbuffer.depth_buffer.begin(), gbuffer.depth_buffer.end(), ctx.depth_buffer.begin());
+		ctx.CopyDepth(gbuffer);
 		gbuffer.Clear();
 	}
 };
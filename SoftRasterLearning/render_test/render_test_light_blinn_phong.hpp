@@ -27,13 +27,33 @@ public:
 	}
 
 	core::Vec4 FS(const VsOut_Light_ws& v) const
+	{
+		return Shade(v, core::Texture::Sample(tex0, v.uv));
+	}
+
+	//按quad着色，用uv的导数选mipmap做三线性采样，远处和掠射角的贴图不会闪烁
+	std::array<core::Vec4, 4> FSQuad(const core::fs_quad<VsOut_Light_ws>& quad) const
+	{
+		std::array<core::Vec4, 4> fs_out{};
+		for (size_t i = 0; i < 4; ++i)
+		{
+			if (quad.mask >> i & 1)
+			{
+				const core::Vec2 ddx = quad.Ddx(&VsOut_Light_ws::uv, i);
+				const core::Vec2 ddy = quad.Ddy(&VsOut_Light_ws::uv, i);
+				fs_out[i] = Shade(quad.frag[i], core::Texture::SampleGrad(tex0, quad.frag[i].uv, ddx, ddy));
+			}
+		}
+		return fs_out;
+	}
+
+	core::Vec4 Shade(const VsOut_Light_ws& v, core::Vec3 base_color) const
 	{
 		using namespace core;
 		Vec3 L = (light_position_ws - v.position_ws).Normalize();
 		Vec3 V = (camera_position_ws - v.position_ws).Normalize();
 		Vec3 H = (L + V).Normalize();
 		Vec3 N = v.normal_ws.Normalize();
-		Vec3 base_color = Texture::Sample(tex0, v.uv);
 		Vec3 Ks = Vec3(0.3f, 0.3f, 0.3f);
 		Vec3 ambient = Vec3(0.01f, 0.012f, 0.01f);
 
@@ -51,10 +71,11 @@ public:
 	std::shared_ptr<core::Texture> tex0;
 	std::shared_ptr<framework::ILight> light;
 
-	void Render(const framework::Entity& entity, framework::IRenderEngine& engine) override
+	static constexpr size_t render_flag = core::RF_DEFAULT | core::RF_ENABLE_TILE_BINNING | core::RF_ENABLE_QUAD_SHADING;
+
+	ShaderBlinnPhong MakeShader(const framework::Entity& entity, framework::IRenderEngine& engine) const
 	{
 		ShaderBlinnPhong shader{};
-		core::Renderer<ShaderBlinnPhong> renderer = { engine.GetCtx(), shader };
 		shader.tex0 = tex0.get();
 		shader.mvp = engine.GetMainCamera()->GetProjectionViewMatrix() * entity.transform.GetModelMatrix();
 		shader.m = entity.transform.GetModelMatrix();
@@ -62,8 +83,19 @@ public:
 		shader.light_color = light->GetColor();
 
 		shader.camera_position_ws = engine.GetMainCamera()->GetPosition();
+		return shader;
+	}
+
+	void Render(const framework::Entity& entity, framework::IRenderEngine& engine) override
+	{
+		const ShaderBlinnPhong shader = MakeShader(entity, engine);
+		core::Renderer<ShaderBlinnPhong, render_flag> renderer = { engine.GetCtx(), shader };
+		entity.Draw(renderer);
+	}
 
-		renderer.DrawTriangles(&entity.model->mesh[0], entity.model->mesh.size());
+	void Record(const framework::Entity& entity, framework::IRenderEngine& engine, core::CommandList& list) override
+	{
+		entity.Draw<render_flag>(list, engine.GetCtx(), MakeShader(entity, engine));
 	}
 };
 
@@ -94,18 +94,30 @@ public:
 	std::shared_ptr<core::Texture> tex0;
 	std::shared_ptr<core::Texture> normal_map;
 
-	void Render(const framework::Entity& entity, framework::IRenderEngine& engine) override
+	static constexpr size_t render_flag = core::RF_DEFAULT | core::RF_ENABLE_TILE_BINNING;
+
+	ShaderNormal MakeShader(const framework::Entity& entity, framework::IRenderEngine& engine) const
 	{
 		ShaderNormal shader{};
-		core::Renderer<ShaderNormal> renderer = { engine.GetCtx(), shader };
 		shader.tex0 = tex0.get();
 		shader.normal_map = normal_map.get();
 		shader.mvp = engine.GetMainCamera()->GetProjectionViewMatrix() * entity.transform.GetModelMatrix();
 		shader.model = entity.transform.GetModelMatrix();
 		shader.light_position_ws = core::Vec3{ 0.f,2.f,3.f };//engine->GetCamera().GetPosition();
 		shader.camera_position_ws = engine.GetMainCamera()->GetPosition();
+		return shader;
+	}
+
+	void Render(const framework::Entity& entity, framework::IRenderEngine& engine) override
+	{
+		const ShaderNormal shader = MakeShader(entity, engine);
+		core::Renderer<ShaderNormal, render_flag> renderer = { engine.GetCtx(), shader };
+		entity.Draw(renderer);
+	}
 
-		renderer.DrawTriangles(&entity.model->mesh[0], entity.model->mesh.size());
+	void Record(const framework::Entity& entity, framework::IRenderEngine& engine, core::CommandList& list) override
+	{
+		entity.Draw<render_flag>(list, engine.GetCtx(), MakeShader(entity, engine));
 	}
 };
 
@@ -4,6 +4,7 @@
 #include "../framework/framework.hpp"
 #include "vs_out_type.hpp"
 
+struct Shader_PBR;
 
 //
 class Material_PBR : public framework::IMaterial
@@ -16,7 +17,10 @@ public:
 	float roughness = 0;
 	bool b_enable_light = false;
 	bool b_enable_ibl = true;
+	static constexpr size_t render_flag = core::RF_DEFAULT | core::RF_ENABLE_TILE_BINNING;
+	Shader_PBR MakeShader(const framework::Entity& entity, framework::IRenderEngine& engine);
 	virtual void Render(const framework::Entity& entity, framework::IRenderEngine& engine) override;
+	virtual void Record(const framework::Entity& entity, framework::IRenderEngine& engine, core::CommandList& list) override;
 };
 
 struct Shader_PBR
@@ -119,16 +123,26 @@ struct Shader_PBR
 	}
 };
 
-inline void Material_PBR::Render(const framework::Entity& entity, framework::IRenderEngine& engine)
+//准备shader数据
+inline Shader_PBR Material_PBR::MakeShader(const framework::Entity& entity, framework::IRenderEngine& engine)
 {
-	//准备shader数据
 	Shader_PBR shader{ this };
 	shader.mvp = engine.GetMainCamera()->GetProjectionViewMatrix() * entity.transform.GetModelMatrix();
 	shader.model = entity.transform.GetModelMatrix();
 	shader.cam_pos_ws = engine.GetMainCamera()->GetPosition();
-	//渲染
-	core::Renderer<Shader_PBR> renderer = { engine.GetCtx(), shader };
-	renderer.DrawTriangles(&entity.model->mesh[0], entity.model->mesh.size());
+	return shader;
+}
+
+inline void Material_PBR::Render(const framework::Entity& entity, framework::IRenderEngine& engine)
+{
+	const Shader_PBR shader = MakeShader(entity, engine);
+	core::Renderer<Shader_PBR, render_flag> renderer = { engine.GetCtx(), shader };
+	entity.Draw(renderer);
+}
+
+inline void Material_PBR::Record(const framework::Entity& entity, framework::IRenderEngine& engine, core::CommandList& list)
+{
+	entity.Draw<render_flag>(list, engine.GetCtx(), MakeShader(entity, engine));
 }
 
 class SceneRenderTestPBR : public framework::Scene
@@ -96,10 +96,11 @@ public:
 	core::Buffer2DView<float>* shadow_map = nullptr;
 	framework::ILight* light = nullptr;
 
-	void Render(const framework::Entity& entity, framework::IRenderEngine& engine) override
+	static constexpr size_t render_flag = core::RF_DEFAULT | core::RF_ENABLE_TILE_BINNING | core::RF_CULL_CVV_GUARD_BAND;
+
+	ShaderShadowMapping MakeShader(const framework::Entity& entity, framework::IRenderEngine& engine) const
 	{
 		ShaderShadowMapping shader{};
-		core::Renderer<ShaderShadowMapping, core::RF_DEFAULT_AA> renderer = { engine.GetCtx(), shader };
 		shader.tex0 = tex0.get();
 		shader.shadow_map = shadow_map;
 		shader.model = entity.transform.GetModelMatrix();
@@ -114,7 +115,20 @@ public:
 		}
 		shader.light_color = light->GetColor();
 		shader.light_mat = light->GetLightMartrix();
-		renderer.DrawTriangles(&entity.model->mesh[0], entity.model->mesh.size());
+		return shader;
+	}
+
+	void Render(const framework::Entity& entity, framework::IRenderEngine& engine) override
+	{
+		const ShaderShadowMapping shader = MakeShader(entity, engine);
+		core::Renderer<ShaderShadowMapping, render_flag> renderer = { engine.GetCtx(), shader };
+		entity.Draw(renderer);
+	}
+
+	//阴影贴图在Scene::RenderFrame之前就画好了，回放时shader读到的是这一帧的阴影贴图
+	void Record(const framework::Entity& entity, framework::IRenderEngine& engine, core::CommandList& list) override
+	{
+		entity.Draw<render_flag>(list, engine.GetCtx(), MakeShader(entity, engine));
 	}
 };
 
@@ -128,7 +142,7 @@ private:
 	std::shared_ptr<framework::PointLight> light_p;
 	std::shared_ptr<framework::ILight> light;
 	std::shared_ptr<MaterialShadowMapping> material;
-	core::Context<core::Color> shadow_ctx;
+	core::Context<core::DepthOnly> shadow_ctx;
 public:
 	void Init(framework::IRenderEngine& engine) override
 	{
@@ -201,6 +215,12 @@ public:
 		return camera.get();
 	}
 
+	//阴影的边缘和模型的轮廓用4x MSAA
+	virtual size_t GetSampleCount() const override
+	{
+		return 4;
+	}
+
 	virtual void Update(const framework::IRenderEngine& engine) override
 	{
 		Scene::Update(engine);
@@ -222,12 +242,7 @@ public:
 			{
 				return { {},mvp * core::Vec4{ v.position, 1.0f } };
 			}
-
-			core::Vec4 FS(const vs_out_t& v) const
-			{
-				//最后的颜色不重要只需要深度贴图
-				return { 0,0,0,0 };
-			}
+			//没有FS，只需要深度贴图
 		};
 
 		shadow_ctx.Clear();
@@ -237,12 +252,14 @@ public:
 			if (const auto* entity = dynamic_cast<framework::Entity*>(object.get()))
 			{
 				Shader_Shadow_Gen shader{};
-				constexpr size_t flag = core::RF_DEFAULT & ~core::RF_CULL_BACK | core::RF_CULL_FRONT;
+				constexpr size_t flag = (core::RF_DEFAULT | core::RF_ENABLE_TILE_BINNING) & ~core::RF_CULL_BACK | core::RF_CULL_FRONT;
 				core::Renderer<Shader_Shadow_Gen, flag> renderer = { shadow_ctx, shader };
 				shader.mvp = light->GetLightMartrix() * entity->transform.GetModelMatrix();
-				renderer.DrawTriangles(&entity->model->mesh[0], entity->model->mesh.size());
+				entity->Draw(renderer, entity->model->indices);
 			}
 		}
+		//阴影贴图会被直接当作贴图读，没画到的块也要写上清除值
+		shadow_ctx.FlushClear();
 
 		Scene::RenderFrame(engine);
 
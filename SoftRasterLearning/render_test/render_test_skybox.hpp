@@ -55,17 +55,29 @@ public:
 	std::shared_ptr<core::CubeMap> cube_map;
 	std::shared_ptr<core::Texture> normal_map;
 
-	void Render(const framework::Entity& entity, framework::IRenderEngine& engine) override
+	static constexpr size_t render_flag = core::RF_DEFAULT | core::RF_ENABLE_TILE_BINNING;
+
+	ShaderMirror MakeShader(const framework::Entity& entity, framework::IRenderEngine& engine) const
 	{
 		ShaderMirror shader{};
-		core::Renderer<ShaderMirror> renderer = { engine.GetCtx(), shader };
 		shader.cube_map = cube_map.get();
 		shader.normal_map = normal_map.get();
 		shader.mvp = engine.GetMainCamera()->GetProjectionViewMatrix() * entity.transform.GetModelMatrix();
 		shader.m = entity.transform.GetModelMatrix();
 		shader.camera_position_ws = engine.GetMainCamera()->GetPosition();
+		return shader;
+	}
+
+	void Render(const framework::Entity& entity, framework::IRenderEngine& engine) override
+	{
+		const ShaderMirror shader = MakeShader(entity, engine);
+		core::Renderer<ShaderMirror, render_flag> renderer = { engine.GetCtx(), shader };
+		entity.Draw(renderer);
+	}
 
-		renderer.DrawTriangles(&entity.model->mesh[0], entity.model->mesh.size());
+	void Record(const framework::Entity& entity, framework::IRenderEngine& engine, core::CommandList& list) override
+	{
+		entity.Draw<render_flag>(list, engine.GetCtx(), MakeShader(entity, engine));
 	}
 };
 
@@ -16,6 +16,7 @@ struct VsOut_Light_ws : core::vs_out_base<VsOut_Light_ws>
 	core::Position position; //clip space
 	core::Vec3 position_ws;
 	core::Vec2 uv;
+	float instance_id = 0; //实例化绘制时实例的序号，插值之后有误差，用的时候要四舍五入。放在uv后面对齐的空隙里，不增加大小
 	core::Vec3 normal_ws; //转换到 world space 要乘模型(法线)矩阵
 	core::Mat3 TBN = {};
 };